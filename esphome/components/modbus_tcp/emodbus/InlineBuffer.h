@@ -0,0 +1,68 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _INLINE_BUFFER_H
+#define _INLINE_BUFFER_H
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// InlineBuffer: fixed-capacity byte buffer held inside the object, providing the part of the
+// std::vector<uint8_t> interface ModbusMessage is using. It never allocates memory.
+// Anything beyond the capacity N is silently cut off - N must fit the largest message to be held.
+template <uint16_t N>
+class InlineBuffer {
+public:
+  typedef uint8_t *iterator;
+  typedef const uint8_t *const_iterator;
+
+  InlineBuffer() : IB_size(0) {}
+  explicit InlineBuffer(const std::vector<uint8_t>& v) : IB_size(0) { insert(end(), v.begin(), v.end()); }
+  InlineBuffer(const InlineBuffer& b) : IB_size(b.IB_size) { memcpy(IB_data, b.IB_data, IB_size); }
+  InlineBuffer& operator=(const InlineBuffer& b) {
+    if (this != &b) {
+      IB_size = b.IB_size;
+      memcpy(IB_data, b.IB_data, IB_size);
+    }
+    return *this;
+  }
+
+  // Capacity is fixed - reserve() and shrink_to_fit() do nothing
+  inline void reserve(size_t) {}
+  inline void shrink_to_fit() {}
+  inline size_t capacity() const { return N; }
+
+  inline size_t size() const { return IB_size; }
+  inline bool empty() const { return IB_size == 0; }
+  inline void clear() { IB_size = 0; }
+  // resize: new bytes are zeroed like in std::vector. Limited to the capacity
+  inline void resize(size_t newSize) {
+    if (newSize > N) newSize = N;
+    if (newSize > IB_size) memset(IB_data + IB_size, 0, newSize - IB_size);
+    IB_size = newSize;
+  }
+  inline void push_back(uint8_t b) {
+    if (IB_size < N) IB_data[IB_size++] = b;
+  }
+  // insert: only appending at end() is supported, as ModbusMessage does
+  template <typename IT>
+  inline void insert(iterator, IT from, IT to) {
+    while (from != to && IB_size < N) IB_data[IB_size++] = *from++;
+  }
+
+  inline uint8_t *data() { return IB_data; }
+  inline const uint8_t *data() const { return IB_data; }
+  inline uint8_t& operator[](size_t index) { return IB_data[index]; }
+  inline const uint8_t& operator[](size_t index) const { return IB_data[index]; }
+  inline iterator begin() { return IB_data; }
+  inline iterator end() { return IB_data + IB_size; }
+  inline const_iterator begin() const { return IB_data; }
+  inline const_iterator end() const { return IB_data + IB_size; }
+
+protected:
+  uint16_t IB_size;     // Bytes used
+  uint8_t IB_data[N];   // Storage
+};
+
+#endif
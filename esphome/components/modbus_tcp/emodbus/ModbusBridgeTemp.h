@@ -6,6 +6,8 @@
 #define _MODBUS_BRIDGE_TEMP_H
 
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <functional>
 #include "ModbusClient.h"
 #include "ModbusServer.h"
@@ -37,6 +39,8 @@ public:
   ~ModbusBridge();
 
   // Method to link external servers to the bridge
+  // attachServer, addFunctionCode, denyFunctionCode and setAsyncForwarding (re-)register workers. They
+  // may be called while the bridge is running, but from one task at a time.
   bool attachServer(uint8_t aliasID, uint8_t serverID, uint8_t functionCode, ModbusClient *client, IPAddress host = IPAddress(0, 0, 0, 0), uint16_t port = 0);
 
   // Link another function code to the server
@@ -44,14 +48,59 @@ public:
 
   // Block a function code (respond with ILLEGAL_FUNCTION error)
   bool denyFunctionCode(uint8_t aliasID, uint8_t functionCode);
+
+  // Forward requests without waiting for the response. The request is queued with the client and the
+  // server is free for the next one; the response is sent back as soon as the client has it. So a single
+  // TCP server may keep many clients busy at once. Default is off: each request is waited for.
+  bool setAsyncForwarding(bool onOff = true);
+
+  // Cache read responses (FC 0x01..0x04) of a server for ttl milliseconds. A read covered by a cached
+  // response - same or smaller address range - is answered from the cache without going to the server.
+  // Any other function code sent to the server empties its cache. ttl == 0 switches the cache off.
+  // maxEntries is the number of responses kept for the server; the oldest is replaced if it is full.
+  bool setCacheTTL(uint8_t aliasID, uint32_t ttl, uint8_t maxEntries = 8);
+
+  // Let identical reads share a single request to the server: a read arriving while the same one is
+  // on its way already is not sent again, but gets the response of the first. Needs async forwarding,
+  // with sync forwarding use setReadCoalescing() of the client instead.
+  bool setReadCoalescing(uint8_t aliasID, bool onOff = true);
   
   // Add/remove request/response filters
   bool addRequestFilter(uint8_t aliasID, MBSworker rF);
+  bool addRequestFilter(uint8_t aliasID, MBSworkerView rF);
   bool removeRequestFilter(uint8_t aliasID);
   bool addResponseFilter(uint8_t aliasID, MBSworker rF);
+  bool addResponseFilter(uint8_t aliasID, MBSworkerView rF);
   bool removeResponseFilter(uint8_t aliasID);
 
 protected:
+  // CacheEntry holds a read response of a server
+  struct CacheEntry {
+    uint8_t functionCode;         // FC 0x01..0x04
+    uint16_t start;               // First address read
+    uint16_t count;               // Number of coils/registers read
+    uint32_t timeStamp;           // millis() when the response arrived
+    ModbusMessage response;       // The response as sent by the server
+  };
+
+  // CacheKey: what a read needs to find its place in the cache when the response comes in
+  struct CacheKey {
+    uint8_t functionCode;         // 0 if the request is not cached
+    uint16_t start;
+    uint16_t count;
+    uint32_t generation;          // cacheGeneration of the server when the request was sent
+  };
+
+  // Flight: a read sent to a server, with the identical reads waiting for its response
+  struct Waiter {
+    uint8_t functionCode;         // Function code as requested
+    ModbusResponder responder;    // To answer the request
+  };
+  struct Flight {
+    CacheKey key;                 // The read
+    std::vector<Waiter> waiters;  // Identical reads arrived after it was sent
+  };
+
   // ServerData holds all data necessary to address a single server
   struct ServerData {
     uint8_t serverID;             // External server id
@@ -61,6 +110,15 @@ protected:
     uint16_t port;                // TCP: host port number, else 0
     MBSworker requestFilter;      // optional filter requests before forwarding them
     MBSworker responseFilter;     // optional filter responses before forwarding them
+    MBSworkerView requestFilterV; // same, taking a view instead of a copy
+    MBSworkerView responseFilterV;
+    std::vector<uint8_t> functionCodes;  // Function codes forwarded to the server
+    uint32_t cacheTTL;            // Time in ms a read response is kept, 0: no caching
+    uint8_t cacheSize;            // Max. number of cached responses
+    uint32_t cacheGeneration;     // Counts the cache invalidations
+    std::vector<CacheEntry> cache;  // Cached read responses
+    bool coalesce;                // Identical reads share a request
+    std::vector<Flight> flights;  // Reads sent, still waiting for the response
 
     // RTU constructor
     ServerData(uint8_t sid, ModbusClient *c) :
@@ -70,7 +128,13 @@ protected:
       host(IPAddress(0, 0, 0, 0)),
       port(0),
       requestFilter(nullptr),
-      responseFilter(nullptr) {}
+      responseFilter(nullptr),
+      requestFilterV(nullptr),
+      responseFilterV(nullptr),
+      cacheTTL(0),
+      cacheSize(0),
+      cacheGeneration(0),
+      coalesce(false) {}
     
     // TCP constructor
     ServerData(uint8_t sid, ModbusClient *c, IPAddress h, uint16_t p) :
@@ -80,31 +144,70 @@ protected:
       host(h),
       port(p),
       requestFilter(nullptr),
-      responseFilter(nullptr) {}
+      responseFilter(nullptr),
+      requestFilterV(nullptr),
+      responseFilterV(nullptr),
+      cacheTTL(0),
+      cacheSize(0),
+      cacheGeneration(0),
+      coalesce(false) {}
   };
 
-  // Default worker functions
-  ModbusMessage bridgeWorker(ModbusMessage msg);
+  // Default worker functions. The forwarding ones are handed their server by the registration,
+  // so requests need not look into the servers map while it may be changed
+  ModbusMessage bridgeWorker(ServerData *server, ModbusMessage msg);
   ModbusMessage bridgeDenyWorker(ModbusMessage msg);
+  // Worker for async forwarding: answers when the client has the response
+  void bridgeAsyncWorker(ServerData *server, ModbusMessage msg, ModbusResponder responder);
+
+  // registerForward: register the worker forwarding functionCode, sync or async as set
+  bool registerForward(uint8_t aliasID, uint8_t functionCode);
 
-  // Map of servers attached
+  // filterRequest: apply the request filter, if any, and address the real server
+  void filterRequest(ServerData *server, ModbusMessage& msg);
+
+  // filterResponse: apply the response filter, if any, and address the response to the requester again
+  ModbusMessage filterResponse(ServerData *server, uint8_t aliasID, uint8_t functionCode, ModbusMessage response);
+
+  // checkCache: answer a read from the cache, if possible. Returns true with the response set if so.
+  // Else key is set up for cacheResponse() and joinFlight() - or the cache is emptied if msg is not a read.
+  bool checkCache(ServerData *server, const ModbusMessage& msg, ModbusMessage& response, CacheKey& key);
+
+  // cacheResponse: keep the response to a read, unless the cache was emptied in the meantime
+  void cacheResponse(ServerData *server, const CacheKey& key, const ModbusMessage& response);
+
+  // joinFlight: attach the request to an identical read on its way. If there is none, it is the
+  // first, then false is returned and a flight for it is set up.
+  bool joinFlight(ServerData *server, const CacheKey& key, uint8_t functionCode, ModbusResponder& responder);
+
+  // landFlight: the response to the read has come in - take the waiters to answer
+  std::vector<Waiter> landFlight(ServerData *server, const CacheKey& key);
+
+  // Map of servers attached. Its entries are not removed before the bridge is destroyed
   std::map<uint8_t, ServerData *> servers;
+  bool asyncForwarding;           // Forward requests without waiting for their responses
+#if USE_MUTEX
+  std::mutex cacheLock;           // Covers the server caches
+#endif
 };
 
 // Constructor for TCP variants
 template<typename SERVERCLASS>
 ModbusBridge<SERVERCLASS>::ModbusBridge() :
-  SERVERCLASS() { } 
+  SERVERCLASS(),
+  asyncForwarding(false) { } 
 
 // Constructors for RTU variant
 template<typename SERVERCLASS>
 ModbusBridge<SERVERCLASS>::ModbusBridge(uint32_t timeout, int rtsPin) :
-  SERVERCLASS(timeout, rtsPin) { }
+  SERVERCLASS(timeout, rtsPin),
+  asyncForwarding(false) { }
 
 // Alternate constructors for RTU variant
 template<typename SERVERCLASS>
 ModbusBridge<SERVERCLASS>::ModbusBridge(uint32_t timeout, RTScallback rts) :
-  SERVERCLASS(timeout, rts) { }
+  SERVERCLASS(timeout, rts),
+  asyncForwarding(false) { }
 
 // Destructor
 template<typename SERVERCLASS>
@@ -119,7 +222,6 @@ ModbusBridge<SERVERCLASS>::~ModbusBridge() {
 // attachServer: memorize the access data for an external server with ID serverID under bridge ID aliasID
 template<typename SERVERCLASS>
 bool ModbusBridge<SERVERCLASS>::attachServer(uint8_t aliasID, uint8_t serverID, uint8_t functionCode, ModbusClient *client, IPAddress host, uint16_t port) {
-
   // Is there already an entry for the aliasID?
   if (servers.find(aliasID) == servers.end()) {
     // No. Store server data in map.
@@ -137,8 +239,7 @@ bool ModbusBridge<SERVERCLASS>::attachServer(uint8_t aliasID, uint8_t serverID,
   }
 
   // Register the server/FC combination for the bridgeWorker
-  addFunctionCode(aliasID, functionCode);
-  return true;
+  return addFunctionCode(aliasID, functionCode);
 }
 
 template<typename SERVERCLASS>
@@ -146,7 +247,11 @@ bool ModbusBridge<SERVERCLASS>::addFunctionCode(uint8_t aliasID, uint8_t functio
   // Is there already an entry for the aliasID?
   if (servers.find(aliasID) != servers.end()) {
     // Yes. Link server to own worker function
-    this->registerWorker(aliasID, functionCode, std::bind(&ModbusBridge<SERVERCLASS>::bridgeWorker, this, std::placeholders::_1));
+    std::vector<uint8_t>& fcs = servers[aliasID]->functionCodes;
+    if (std::find(fcs.begin(), fcs.end(), functionCode) == fcs.end()) {
+      fcs.push_back(functionCode);
+    }
+    if (!registerForward(aliasID, functionCode)) return false;
     LOG_D("FC %02X added for server %02X\n", functionCode, aliasID);
   } else {
     LOG_E("Server %d not attached to bridge!\n", aliasID);
@@ -160,7 +265,9 @@ bool ModbusBridge<SERVERCLASS>::denyFunctionCode(uint8_t aliasID, uint8_t functi
   // Is there already an entry for the aliasID?
   if (servers.find(aliasID) != servers.end()) {
     // Yes. Link server to own worker function
-    this->registerWorker(aliasID, functionCode, std::bind(&ModbusBridge<SERVERCLASS>::bridgeDenyWorker, this, std::placeholders::_1));
+    std::vector<uint8_t>& fcs = servers[aliasID]->functionCodes;
+    fcs.erase(std::remove(fcs.begin(), fcs.end(), functionCode), fcs.end());
+    if (!this->registerWorker(aliasID, functionCode, [this](ModbusMessage msg) { return bridgeDenyWorker(std::move(msg)); })) return false;
     LOG_D("FC %02X blocked for server %02X\n", functionCode, aliasID);
   } else {
     LOG_E("Server %d not attached to bridge!\n", aliasID);
@@ -169,12 +276,92 @@ bool ModbusBridge<SERVERCLASS>::denyFunctionCode(uint8_t aliasID, uint8_t functi
   return true;
 }
 
+// setAsyncForwarding: switch forwarding mode for all function codes forwarded
+template<typename SERVERCLASS>
+bool ModbusBridge<SERVERCLASS>::setAsyncForwarding(bool onOff) {
+  asyncForwarding = onOff;
+  bool accepted = true;
+  // Replace the workers registered already
+  for (auto& sd : servers) {
+    for (uint8_t fc : sd.second->functionCodes) {
+      accepted &= registerForward(sd.first, fc);
+    }
+  }
+  LOG_D("Async forwarding %s\n", onOff ? "ON" : "OFF");
+  return accepted;
+}
+
+// setCacheTTL: set up the read response cache for a server
+template<typename SERVERCLASS>
+bool ModbusBridge<SERVERCLASS>::setCacheTTL(uint8_t aliasID, uint32_t ttl, uint8_t maxEntries) {
+  // Is there already an entry for the aliasID?
+  auto sd = servers.find(aliasID);
+  if (sd != servers.end()) {
+    // Yes. Start over with an empty cache
+    LOCK_GUARD(lockCache, cacheLock);
+    ServerData *server = sd->second;
+    server->cacheTTL = ttl;
+    server->cacheSize = ttl ? maxEntries : 0;
+    server->cache.clear();
+    server->cache.reserve(server->cacheSize);
+    server->cacheGeneration++;
+    LOG_D("Cache TTL %u ms, %u entries for server %02X\n", (unsigned int)ttl, server->cacheSize, aliasID);
+  } else {
+    LOG_E("Server %d not attached to bridge, no cache set!\n", aliasID);
+    return false;
+  }
+  return true;
+}
+
+// setReadCoalescing: let identical reads to a server share a request
+template<typename SERVERCLASS>
+bool ModbusBridge<SERVERCLASS>::setReadCoalescing(uint8_t aliasID, bool onOff) {
+  // Is there already an entry for the aliasID?
+  auto sd = servers.find(aliasID);
+  if (sd != servers.end()) {
+    // Yes. Reads on their way keep their waiters
+    LOCK_GUARD(lockCache, cacheLock);
+    sd->second->coalesce = onOff;
+    LOG_D("Read coalescing %s for server %02X\n", onOff ? "ON" : "OFF", aliasID);
+  } else {
+    LOG_E("Server %d not attached to bridge, no coalescing set!\n", aliasID);
+    return false;
+  }
+  return true;
+}
+
+// registerForward: register the worker forwarding functionCode, sync or async as set
+template<typename SERVERCLASS>
+bool ModbusBridge<SERVERCLASS>::registerForward(uint8_t aliasID, uint8_t functionCode) {
+  ServerData *server = servers[aliasID];
+  if (asyncForwarding) {
+    return this->registerWorker(aliasID, functionCode, [this, server](ModbusMessage msg, ModbusResponder responder) { bridgeAsyncWorker(server, std::move(msg), std::move(responder)); });
+  }
+  return this->registerWorker(aliasID, functionCode, [this, server](ModbusMessage msg) { return bridgeWorker(server, std::move(msg)); });
+}
+
 template<typename SERVERCLASS>
 bool ModbusBridge<SERVERCLASS>::addRequestFilter(uint8_t aliasID, MBSworker rF) {
   // Is there already an entry for the aliasID?
   if (servers.find(aliasID) != servers.end()) {
     // Yes. Chain in filter function
     servers[aliasID]->requestFilter = rF;
+    servers[aliasID]->requestFilterV = nullptr;
+    LOG_D("Request filter added for server %02X\n", aliasID);
+  } else {
+    LOG_E("Server %d not attached to bridge, no request filter set!\n", aliasID);
+    return false;
+  }
+  return true;
+}
+
+template<typename SERVERCLASS>
+bool ModbusBridge<SERVERCLASS>::addRequestFilter(uint8_t aliasID, MBSworkerView rF) {
+  // Is there already an entry for the aliasID?
+  if (servers.find(aliasID) != servers.end()) {
+    // Yes. Chain in filter function
+    servers[aliasID]->requestFilter = nullptr;
+    servers[aliasID]->requestFilterV = rF;
     LOG_D("Request filter added for server %02X\n", aliasID);
   } else {
     LOG_E("Server %d not attached to bridge, no request filter set!\n", aliasID);
@@ -189,6 +376,7 @@ bool ModbusBridge<SERVERCLASS>::removeRequestFilter(uint8_t aliasID) {
   if (servers.find(aliasID) != servers.end()) {
     // Yes. Chain in filter function
     servers[aliasID]->requestFilter = nullptr;
+    servers[aliasID]->requestFilterV = nullptr;
     LOG_D("Request filter removed for server %02X\n", aliasID);
   } else {
     LOG_E("Server %d not attached to bridge, no request filter set!\n", aliasID);
@@ -203,6 +391,22 @@ bool ModbusBridge<SERVERCLASS>::addResponseFilter(uint8_t aliasID, MBSworker rF)
   if (servers.find(aliasID) != servers.end()) {
     // Yes. Chain in filter function
     servers[aliasID]->responseFilter = rF;
+    servers[aliasID]->responseFilterV = nullptr;
+    LOG_D("Response filter added for server %02X\n", aliasID);
+  } else {
+    LOG_E("Server %d not attached to bridge, no response filter set!\n", aliasID);
+    return false;
+  }
+  return true;
+}
+
+template<typename SERVERCLASS>
+bool ModbusBridge<SERVERCLASS>::addResponseFilter(uint8_t aliasID, MBSworkerView rF) {
+  // Is there already an entry for the aliasID?
+  if (servers.find(aliasID) != servers.end()) {
+    // Yes. Chain in filter function
+    servers[aliasID]->responseFilter = nullptr;
+    servers[aliasID]->responseFilterV = rF;
     LOG_D("Response filter added for server %02X\n", aliasID);
   } else {
     LOG_E("Server %d not attached to bridge, no response filter set!\n", aliasID);
@@ -217,6 +421,7 @@ bool ModbusBridge<SERVERCLASS>::removeResponseFilter(uint8_t aliasID) {
   if (servers.find(aliasID) != servers.end()) {
     // Yes. Chain in filter function
     servers[aliasID]->responseFilter = nullptr;
+    servers[aliasID]->responseFilterV = nullptr;
     LOG_D("Response filter removed for server %02X\n", aliasID);
   } else {
     LOG_E("Server %d not attached to bridge, no response filter set!\n", aliasID);
@@ -227,49 +432,260 @@ bool ModbusBridge<SERVERCLASS>::removeResponseFilter(uint8_t aliasID) {
 
 // bridgeWorker: default worker function to process bridge requests
 template<typename SERVERCLASS>
-ModbusMessage ModbusBridge<SERVERCLASS>::bridgeWorker(ModbusMessage msg) {
+ModbusMessage ModbusBridge<SERVERCLASS>::bridgeWorker(ServerData *server, ModbusMessage msg) {
   uint8_t aliasID = msg.getServerID();
   uint8_t functionCode = msg.getFunctionCode();
   ModbusMessage response;
 
-  // Find the (alias) serverID
-  if (servers.find(aliasID) != servers.end()) {
-    // Found it. We may use servers[aliasID] now without allocating a new map slot
-
-    // Request filter hook to be called here
-    if (servers[aliasID]->requestFilter) {
-      LOG_D("Calling request filter\n");
-      msg = servers[aliasID]->requestFilter(msg);
-    }
-
-    // Set real target server ID
-    msg.setServerID(servers[aliasID]->serverID);
+  filterRequest(server, msg);
 
+  // Can the cache answer it?
+  CacheKey key;
+  if (checkCache(server, msg, response, key)) {
+    LOG_D("Request (%02X/%02X) served from cache\n", server->serverID, msg.getFunctionCode());
+  } else {
     // Issue the request
-    LOG_D("Request (%02X/%02X) sent\n", servers[aliasID]->serverID, msg.getFunctionCode());
+    LOG_D("Request (%02X/%02X) sent\n", server->serverID, msg.getFunctionCode());
     // TCP servers have a target host/port that needs to be set in the client
-    if (servers[aliasID]->serverType == TCP_SERVER) {
-      response = reinterpret_cast<ModbusClientTCP *>(servers[aliasID]->client)->syncRequestMT(msg, (uint32_t)millis(), servers[aliasID]->host, servers[aliasID]->port);
+    if (server->serverType == TCP_SERVER) {
+      response = reinterpret_cast<ModbusClientTCP *>(server->client)->syncRequestMT(std::move(msg), (uint32_t)millis(), server->host, server->port);
     } else {
-      response = servers[aliasID]->client->syncRequestM(msg, (uint32_t)millis());
+      response = server->client->syncRequestM(std::move(msg), (uint32_t)millis(), 0);
+    }
+    cacheResponse(server, key, response);
+  }
+
+  return filterResponse(server, aliasID, functionCode, std::move(response));
+}
+
+// bridgeAsyncWorker: worker function to forward requests without waiting for the response
+template<typename SERVERCLASS>
+void ModbusBridge<SERVERCLASS>::bridgeAsyncWorker(ServerData *server, ModbusMessage msg, ModbusResponder responder) {
+  uint8_t aliasID = msg.getServerID();
+  uint8_t functionCode = msg.getFunctionCode();
+
+  filterRequest(server, msg);
+  uint8_t serverID = msg.getServerID();
+
+  // Can the cache answer it?
+  CacheKey key;
+  ModbusMessage cached;
+  if (checkCache(server, msg, cached, key)) {
+    LOG_D("Request (%02X/%02X) served from cache\n", serverID, msg.getFunctionCode());
+    responder.respond(filterResponse(server, aliasID, functionCode, std::move(cached)));
+    return;
+  }
+
+  // Is the same read on its way already?
+  bool inFlight = false;
+  if (key.functionCode && server->coalesce) {
+    if (joinFlight(server, key, functionCode, responder)) {
+      LOG_D("Request (%02X/%02X) joined\n", serverID, msg.getFunctionCode());
+      return;
+    }
+    // No, this one goes out, others may join it
+    inFlight = true;
+  }
+
+  // The client will call this with the response, an error response or a timeout. It is kept in the
+  // client's queue entry - the captures are ordered to pack into the room MBOnDone has.
+  MBOnDone onDone = [this, server, responder, key, aliasID, functionCode, inFlight](ModbusMessage response) mutable {
+    cacheResponse(server, key, response);
+    // Answer the reads that have joined first, the response may be moved on then
+    if (inFlight) {
+      for (Waiter& w : landFlight(server, key)) {
+        w.responder.respond(filterResponse(server, aliasID, w.functionCode, response));
+      }
+    }
+    responder.respond(filterResponse(server, aliasID, functionCode, std::move(response)));
+  };
+
+  // Issue the request
+  LOG_D("Request (%02X/%02X) forwarded\n", serverID, msg.getFunctionCode());
+  Error rc;
+  // TCP servers have a target host/port that needs to be set in the client
+  if (server->serverType == TCP_SERVER) {
+    rc = reinterpret_cast<ModbusClientTCP *>(server->client)->addRequestMT(std::move(msg), (uint32_t)millis(), server->host, server->port, std::move(onDone));
+  } else {
+    rc = server->client->addRequest(std::move(msg), (uint32_t)millis(), std::move(onDone));
+  }
+
+  // Request not taken? onDone is still ours then. Answer with the error as the sync worker would have done
+  if (rc != SUCCESS) {
+    ModbusMessage response;
+    response.setError(serverID, functionCode, rc);
+    onDone(std::move(response));
+  }
+}
+
+// joinFlight: attach the request to an identical read on its way, or start a flight for it
+template<typename SERVERCLASS>
+bool ModbusBridge<SERVERCLASS>::joinFlight(ServerData *server, const CacheKey& key, uint8_t functionCode, ModbusResponder& responder) {
+  LOCK_GUARD(lockCache, cacheLock);
+  // A read sent before the last write does not count
+  for (Flight& f : server->flights) {
+    if (f.key.functionCode == key.functionCode && f.key.start == key.start
+     && f.key.count == key.count && f.key.generation == key.generation) {
+      f.waiters.push_back(Waiter{functionCode, responder});
+      return true;
+    }
+  }
+  server->flights.push_back(Flight{key, std::vector<Waiter>()});
+  return false;
+}
+
+// landFlight: the response to the read has come in - take the waiters to answer
+template<typename SERVERCLASS>
+std::vector<typename ModbusBridge<SERVERCLASS>::Waiter> ModbusBridge<SERVERCLASS>::landFlight(ServerData *server, const CacheKey& key) {
+  std::vector<Waiter> waiters;
+  LOCK_GUARD(lockCache, cacheLock);
+  for (auto it = server->flights.begin(); it != server->flights.end(); ++it) {
+    if (it->key.functionCode == key.functionCode && it->key.start == key.start
+     && it->key.count == key.count && it->key.generation == key.generation) {
+      waiters = std::move(it->waiters);
+      server->flights.erase(it);
+      break;
     }
+  }
+  return waiters;
+}
+
+// checkCache: answer a read from the cache, if possible
+template<typename SERVERCLASS>
+bool ModbusBridge<SERVERCLASS>::checkCache(ServerData *server, const ModbusMessage& msg, ModbusMessage& response, CacheKey& key) {
+  key.functionCode = 0;
+  // Caching or coalescing at all for this server?
+  if ((!server->cacheTTL || !server->cacheSize) && !server->coalesce) return false;
 
-    // Response filter hook to be called here
-    if (servers[aliasID]->responseFilter) {
-      LOG_D("Calling response filter\n");
-      response = servers[aliasID]->responseFilter(response);
+  uint8_t functionCode = msg.getFunctionCode();
+  LOCK_GUARD(lockCache, cacheLock);
+  // Is it a read?
+  if (functionCode < READ_COIL || functionCode > READ_INPUT_REGISTER) {
+    // No. It may change data on the server, so the cached responses are stale now
+    server->cache.clear();
+    server->cacheGeneration++;
+    return false;
+  }
+  if (msg.size() < 6) return false;
+
+  uint16_t start = 0;
+  uint16_t count = 0;
+  msg.get(2, start, count);
+  if (count == 0) return false;
+
+  // Look for a valid response covering the range requested
+  uint32_t now = millis();
+  for (auto& e : server->cache) {
+    if (e.functionCode == functionCode
+     && e.start <= start && (uint32_t)start + count <= (uint32_t)e.start + e.count
+     && now - e.timeStamp < server->cacheTTL) {
+      // Found one. Cut out the range requested.
+      uint16_t offset = start - e.start;
+      const uint8_t *data = e.response.data() + 3;
+      response.add(msg.getServerID(), functionCode);
+      if (functionCode <= READ_DISCR_INPUT) {
+        // Coils and discrete inputs: shift the bits down to start at bit 0 of the first byte
+        uint8_t bytes = (count + 7) / 8;
+        response.add(bytes);
+        for (uint16_t i = 0; i < bytes; ++i) {
+          uint8_t b = 0;
+          for (uint8_t j = 0; j < 8 && i * 8 + j < count; ++j) {
+            uint16_t bit = offset + i * 8 + j;
+            if (data[bit / 8] & (1 << (bit % 8))) b |= (1 << j);
+          }
+          response.add(b);
+        }
+      } else {
+        // Registers: copy them over
+        response.add((uint8_t)(count * 2));
+        response.add(data + offset * 2, count * 2);
+      }
+      return true;
     }
+  }
 
-    // Re-set the requested server ID and function code (may have been modified by filters)
-    response.setServerID(aliasID);
-    if (response.getError() != SUCCESS) {
-      response.setFunctionCode(functionCode | 0x80);
+  // Not found - the response will be cached, unless there is a write before it arrives
+  key.functionCode = functionCode;
+  key.start = start;
+  key.count = count;
+  key.generation = server->cacheGeneration;
+  return false;
+}
+
+// cacheResponse: keep the response to a read, unless the cache was emptied in the meantime
+template<typename SERVERCLASS>
+void ModbusBridge<SERVERCLASS>::cacheResponse(ServerData *server, const CacheKey& key, const ModbusMessage& response) {
+  // Only complete, valid responses to cacheable requests
+  if (!key.functionCode || response.getError() != SUCCESS) return;
+  uint16_t bytes = (key.functionCode <= READ_DISCR_INPUT) ? (key.count + 7) / 8 : key.count * 2;
+  if (response.size() != 3 + bytes || response[2] != bytes) return;
+
+  LOCK_GUARD(lockCache, cacheLock);
+  // Was there a write or a change of the cache settings after the request was sent?
+  if (key.generation != server->cacheGeneration || !server->cacheTTL || !server->cacheSize) return;
+
+  // Take an entry for the same range or an expired one, else a new one or the oldest
+  uint32_t now = millis();
+  CacheEntry *slot = nullptr;
+  for (auto& e : server->cache) {
+    if ((e.functionCode == key.functionCode && e.start == key.start && e.count == key.count)
+     || now - e.timeStamp >= server->cacheTTL) {
+      slot = &e;
+      break;
+    }
+  }
+  if (!slot) {
+    if (server->cache.size() < server->cacheSize) {
+      server->cache.emplace_back();
+      slot = &server->cache.back();
     } else {
-      response.setFunctionCode(functionCode);
+      slot = &server->cache.front();
+      for (auto& e : server->cache) {
+        if (now - e.timeStamp > now - slot->timeStamp) slot = &e;
+      }
     }
+  }
+  slot->functionCode = key.functionCode;
+  slot->start = key.start;
+  slot->count = key.count;
+  slot->timeStamp = now;
+  slot->response = response;
+}
+
+// filterRequest: apply the request filter, if any, and address the real server
+template<typename SERVERCLASS>
+void ModbusBridge<SERVERCLASS>::filterRequest(ServerData *server, ModbusMessage& msg) {
+  // Request filter hook to be called here
+  if (server->requestFilter) {
+    LOG_D("Calling request filter\n");
+    msg = server->requestFilter(msg);
+  } else if (server->requestFilterV) {
+    LOG_D("Calling request filter\n");
+    msg = server->requestFilterV(ModbusMessageView(msg));
+  }
+
+  // Set real target server ID
+  msg.setServerID(server->serverID);
+}
+
+// filterResponse: apply the response filter, if any, and address the response to the requester again
+template<typename SERVERCLASS>
+ModbusMessage ModbusBridge<SERVERCLASS>::filterResponse(ServerData *server, uint8_t aliasID, uint8_t functionCode, ModbusMessage response) {
+  // Response filter hook to be called here
+  if (server->responseFilter) {
+    LOG_D("Calling response filter\n");
+    response = server->responseFilter(response);
+  } else if (server->responseFilterV) {
+    LOG_D("Calling response filter\n");
+    response = server->responseFilterV(ModbusMessageView(response));
+  }
+
+  // Re-set the requested server ID and function code (may have been modified by filters)
+  response.setServerID(aliasID);
+  if (response.getError() != SUCCESS) {
+    response.setFunctionCode(functionCode | 0x80);
   } else {
-    // If we get here, something has gone wrong internally. We send back an error response anyway.
-    response.setError(aliasID, functionCode, INVALID_SERVER);
+    response.setFunctionCode(functionCode);
   }
   return response;
 }
@@ -19,7 +19,12 @@ ModbusClient::ModbusClient() :
   #endif
   onData(nullptr),
   onError(nullptr),
-  onResponse(nullptr) { instanceCounter++; }
+  onResponse(nullptr),
+  onDataV(nullptr),
+  onResponseV(nullptr),
+  syncSlots(nullptr),
+  syncSequence(0),
+  syncTimeout(60000) { instanceCounter++; }
 
 // Default destructor: reduce number of clients by one
 ModbusClient::~ModbusClient() {
@@ -28,37 +33,73 @@ ModbusClient::~ModbusClient() {
   }
 }
 
-// onDataHandler: register callback for data responses
-bool ModbusClient::onDataHandler(MBOnData handler) {
-  if (onData) {
+// claimOnData: check if an onData handler may be registered
+bool ModbusClient::claimOnData() {
+  if (onData || onDataV) {
     LOG_W("onData handler was already claimed\n");
-  } else if (onResponse) {
+  } else if (onResponse || onResponseV) {
     LOG_E("onData handler is unavailable with an onResponse handler\n");
     return false;
   }
-  onData = handler;
   return true;
 }
 
-// onErrorHandler: register callback for error responses
-bool ModbusClient::onErrorHandler(MBOnError handler) {
+// claimOnError: check if an onError handler may be registered
+bool ModbusClient::claimOnError() {
   if (onError) {
     LOG_W("onError handler was already claimed\n");
-  } else if (onResponse) {
+  } else if (onResponse || onResponseV) {
     LOG_E("onError handler is unavailable with an onResponse handler\n");
     return false;
   } 
-  onError = handler;
   return true;
 }
 
-// onResponseHandler: register callback for error responses
-bool ModbusClient::onResponseHandler(MBOnResponse handler) {
-  if (onError || onData) {
+// claimOnResponse: check if an onResponse handler may be registered
+bool ModbusClient::claimOnResponse() {
+  if (onError || onData || onDataV) {
     LOG_E("onResponse handler is unavailable with an onData or onError handler\n");
     return false;
   } 
-  onResponse = handler;
+  return true;
+}
+
+// onDataHandler: register callback for data responses
+bool ModbusClient::onDataHandler(MBOnData handler) {
+  if (!claimOnData()) return false;
+  onData = std::move(handler);
+  onDataV = nullptr;
+  return true;
+}
+
+// onDataHandler: register callback for data responses, getting a view
+bool ModbusClient::onDataHandler(MBOnDataView handler) {
+  if (!claimOnData()) return false;
+  onDataV = std::move(handler);
+  onData = nullptr;
+  return true;
+}
+
+// onErrorHandler: register callback for error responses
+bool ModbusClient::onErrorHandler(MBOnError handler) {
+  if (!claimOnError()) return false;
+  onError = std::move(handler);
+  return true;
+}
+
+// onResponseHandler: register callback for error responses
+bool ModbusClient::onResponseHandler(MBOnResponse handler) {
+  if (!claimOnResponse()) return false;
+  onResponse = std::move(handler);
+  onResponseV = nullptr;
+  return true;
+}
+
+// onResponseHandler: register callback for all responses, getting a view
+bool ModbusClient::onResponseHandler(MBOnResponseView handler) {
+  if (!claimOnResponse()) return false;
+  onResponseV = std::move(handler);
+  onResponse = nullptr;
   return true;
 }
 
@@ -81,30 +122,113 @@ void ModbusClient::resetCounts() {
   }
 }
 
+// setSyncTimeout: set default time to wait for a syncRequest response
+void ModbusClient::setSyncTimeout(uint32_t timeout) {
+  syncTimeout = timeout;
+}
+
+// SyncSlot constructor: register the slot with the client
+ModbusClient::SyncSlot::SyncSlot(ModbusClient *c, uint32_t t) :
+  token(t),
+  id(0),
+  done(false),
+  next(nullptr),
+  client(c) {
+#if HAS_FREERTOS
+  waiter = xTaskGetCurrentTaskHandle();
+#endif
+  LOCK_GUARD(lg, client->syncRespM);
+  // Skip 0 on wrap-around, it marks requests nobody waits for
+  if (++client->syncSequence == 0) client->syncSequence = 1;
+  id = client->syncSequence;
+  next = client->syncSlots;
+  client->syncSlots = this;
+}
+
+// SyncSlot destructor: unlink the slot, so a late response will not find it any more
+ModbusClient::SyncSlot::~SyncSlot() {
+  LOCK_GUARD(lg, client->syncRespM);
+  SyncSlot **sp = &client->syncSlots;
+  while (*sp && *sp != this) sp = &(*sp)->next;
+  if (*sp) *sp = next;
+}
+
 // waitSync: wait for response on syncRequest to arrive
-ModbusMessage ModbusClient::waitSync(uint8_t serverID, uint8_t functionCode, uint32_t token) {
+ModbusMessage ModbusClient::waitSync(SyncSlot& slot, uint8_t serverID, uint8_t functionCode, uint32_t timeout) {
   ModbusMessage response;
-  unsigned long lostPatience = millis();
- 
-  // Default response is TIMEOUT
-  response.setError(serverID, functionCode, TIMEOUT);
+  if (!timeout) timeout = syncTimeout;
 
-  // Loop 60 seconds, if unlucky
-  while (millis() - lostPatience < 60000) {
+#if HAS_FREERTOS
+  unsigned long lostPatience = millis();
+  // Sleep until the worker notifies us or the time is up
+  while (1) {
     {
       LOCK_GUARD(lg, syncRespM);
-      // Look for the token
-      auto sR = syncResponse.find(token);
-      // Is it there?
-      if (sR != syncResponse.end()) {
-        // Yes. get the response, delete it from the map and return
-        response = sR->second;
-        syncResponse.erase(sR);
-        break;
-      }
+      if (slot.done) break;
     }
-    // Give the watchdog time to act
-    delay(10);
+    uint32_t waited = millis() - lostPatience;
+    if (waited >= timeout) break;
+    TickType_t ticks = pdMS_TO_TICKS(timeout - waited);
+    ulTaskNotifyTake(pdTRUE, ticks ? ticks : 1);
+  }
+  LOCK_GUARD(lg, syncRespM);
+#elif IS_LINUX
+  std::unique_lock<std::mutex> lg(syncRespM);
+  slot.cv.wait_for(lg, std::chrono::milliseconds(timeout), [&slot] { return slot.done; });
+#endif
+
+  // Did we get it?
+  if (slot.done) {
+    // Yes. Take it
+    response = std::move(slot.response);
+  } else {
+    // No, timeout must have struck
+    response.setError(serverID, functionCode, TIMEOUT);
   }
   return response;
 }
+
+// deliverSync: hand a response to a waiting syncRequest
+bool ModbusClient::deliverSync(uint32_t syncID, const ModbusMessage& response) {
+  LOCK_GUARD(lg, syncRespM);
+  // Is the slot still waiting? It may have given up already.
+  for (SyncSlot *s = syncSlots; s; s = s->next) {
+    if (s->id == syncID) {
+      // Yes. Fill it and wake up the caller
+      s->response = response;
+      s->done = true;
+#if HAS_FREERTOS
+      xTaskNotifyGive(s->waiter);
+#elif IS_LINUX
+      s->cv.notify_one();
+#endif
+      return true;
+    }
+  }
+  LOG_D("syncRequest not waiting any more\n");
+  return false;
+}
+
+// complete: hand a response to the waiting syncRequest or the completion handler
+void ModbusClient::complete(uint32_t syncID, MBOnDone& onDone, const ModbusMessage& response) {
+  if (syncID) {
+    deliverSync(syncID, response);
+  } else if (onDone) {
+    onDone(response);
+    // Release whatever the handler holds - the queue entry may wait a long time for reuse
+    onDone = nullptr;
+  }
+}
+
+// dropSync: the request was dropped from the queue - let the waiting party know right away
+void ModbusClient::dropSync(uint32_t syncID, MBOnDone& onDone, uint8_t serverID, uint8_t functionCode) {
+  ModbusMessage response;
+  response.setError(serverID, functionCode, TIMEOUT);
+  complete(syncID, onDone, response);
+}
+
+// addRequest: queue a request with its own completion handler
+Error ModbusClient::addRequest(ModbusMessage&& m, uint32_t token, MBOnDone&& onDone) {
+  if (!m) return EMPTY_MESSAGE;
+  return addRequestD(std::move(m), token, std::move(onDone));
+}
@@ -20,7 +20,8 @@ ModbusClientRTU::ModbusClientRTU(int8_t rtsPin, uint16_t queueLimit) :
   MR_qLimit(queueLimit),
   MR_timeoutValue(DEFAULTTIMEOUT),
   MR_useASCII(false),
-  MR_skipLeadingZeroByte(false) {
+  MR_skipLeadingZeroByte(false),
+  MR_coalesce(false) {
     if (MR_rtsPin >= 0) {
       pinMode(MR_rtsPin, OUTPUT);
       MTRSrts = [this](bool level) {
@@ -38,11 +39,12 @@ ModbusClientRTU::ModbusClientRTU(RTScallback rts, uint16_t queueLimit) :
   MR_serial(nullptr),
   MR_lastMicros(micros()),
   MR_interval(2000),
-  MTRSrts(rts),
+  MTRSrts(std::move(rts)),
   MR_qLimit(queueLimit),
   MR_timeoutValue(DEFAULTTIMEOUT),
   MR_useASCII(false),
-  MR_skipLeadingZeroByte(false) {
+  MR_skipLeadingZeroByte(false),
+  MR_coalesce(false) {
     MR_rtsPin = -1;
     MTRSrts(LOW);
 }
@@ -95,15 +97,7 @@ void ModbusClientRTU::doBegin(uint32_t baudRate, int coreID, uint32_t userInterv
 void ModbusClientRTU::end() {
   if (worker) {
     // Clean up queue
-    {
-      // Safely lock access
-      LOCK_GUARD(lockGuard, qLock);
-      // Get all queue entries one by one
-      while (!requests.empty()) {
-        // Remove front entry
-        requests.pop();
-      }
-    }
+    clearQueue();
     // Kill task
     vTaskDelete(worker);
     LOG_D("Client task %d killed.\n", (uint32_t)worker);
@@ -141,6 +135,12 @@ void ModbusClientRTU::skipLeading0x00(bool onOff) {
   LOG_D("Skip leading 0x00 mode = %s\n", onOff ? "ON" : "OFF");
 }
 
+// Let identical reads share a request
+void ModbusClientRTU::setReadCoalescing(bool onOff) {
+  MR_coalesce = onOff;
+  LOG_D("Read coalescing = %s\n", onOff ? "ON" : "OFF");
+}
+
 // Return number of unprocessed requests in queue
 uint32_t ModbusClientRTU::pendingRequests() {
   return requests.size();
@@ -149,9 +149,19 @@ uint32_t ModbusClientRTU::pendingRequests() {
 // Remove all pending request from queue
 void ModbusClientRTU::clearQueue()
 {
-  std::queue<RequestEntry> empty;
-  LOCK_GUARD(lockGuard, qLock);
-  std::swap(requests, empty);
+  std::deque<RequestEntry> empty;
+  {
+    LOCK_GUARD(lockGuard, qLock);
+    std::swap(requests, empty);
+  }
+  // Let waiting callers and completion handlers know
+  while (!empty.empty()) {
+    RequestEntry& request = empty.front();
+    if (request.syncID || request.onDone) {
+      dropSync(request.syncID, request.onDone, request.msg.getServerID(), request.msg.getFunctionCode());
+    }
+    empty.pop_front();
+  }
 }
 
 // Base addRequest taking a preformatted data buffer and length as parameters
@@ -163,7 +173,7 @@ Error ModbusClientRTU::addRequestM(ModbusMessage msg, uint32_t token) {
   // Add it to the queue, if valid
   if (msg) {
     // Queue add successful?
-    if (!addToQueue(token, msg)) {
+    if (!addToQueue(token, std::move(msg))) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -173,18 +183,32 @@ Error ModbusClientRTU::addRequestM(ModbusMessage msg, uint32_t token) {
   return rc;
 }
 
+// addRequestD: queue the request with a completion handler
+Error ModbusClientRTU::addRequestD(ModbusMessage msg, uint32_t token, MBOnDone&& onDone) {
+  if (!msg) return EMPTY_MESSAGE;
+  if (!addToQueue(token, std::move(msg), 0, std::move(onDone))) {
+    return REQUEST_QUEUE_FULL;
+  }
+  return SUCCESS;
+}
+
 // Base syncRequest follows the same pattern
-ModbusMessage ModbusClientRTU::syncRequestM(ModbusMessage msg, uint32_t token) {
+ModbusMessage ModbusClientRTU::syncRequestM(ModbusMessage msg, uint32_t token, uint32_t timeout) {
   ModbusMessage response;
 
   if (msg) {
+    // msg is moved into the queue - keep what is needed for error responses
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    // Set up the slot to receive the response before the worker can see the request
+    SyncSlot slot(this, token);
     // Queue add successful?
-    if (!addToQueue(token, msg, true)) {
+    if (!addToQueue(token, std::move(msg), slot.id)) {
       // No. Return error after deleting the allocated request.
-      response.setError(msg.getServerID(), msg.getFunctionCode(), REQUEST_QUEUE_FULL);
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
     } else {
       // Request is queued - wait for the result.
-      response = waitSync(msg.getServerID(), msg.getFunctionCode(), token);
+      response = waitSync(slot, serverID, functionCode, timeout);
     }
   } else {
     response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
@@ -210,7 +234,7 @@ Error ModbusClientRTU::addBroadcastMessage(const uint8_t *data, uint8_t len) {
     msg.add(data, len);
 
     // Queue add successful?
-    if (!addToQueue(token, msg)) {
+    if (!addToQueue(token, std::move(msg))) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -224,16 +248,19 @@ Error ModbusClientRTU::addBroadcastMessage(const uint8_t *data, uint8_t len) {
 
 
 // addToQueue: send freshly created request to queue
-bool ModbusClientRTU::addToQueue(uint32_t token, ModbusMessage request, bool syncReq) {
+bool ModbusClientRTU::addToQueue(uint32_t token, ModbusMessage&& request, uint32_t syncID, MBOnDone&& onDone) {
   bool rc = false;
   // Did we get one?
   if (request) {
-    RequestEntry re(token, request, syncReq);
     if (requests.size()<MR_qLimit) {
-      // Yes. Safely lock queue and push request to queue
+      // Yes. Safely lock queue and move request into the queue
       rc = true;
-      LOCK_GUARD(lockGuard, qLock);
-      requests.push(re);
+      {
+        LOCK_GUARD(lockGuard, qLock);
+        requests.emplace_back(token, std::move(request), syncID, std::move(onDone));
+      }
+      // Wake up the worker, if it is sleeping
+      MR_wakeup.notify();
     }
     {
       LOCK_GUARD(cntLock, countAccessM);
@@ -245,6 +272,66 @@ bool ModbusClientRTU::addToQueue(uint32_t token, ModbusMessage request, bool syn
   return rc;
 }
 
+// respond: hand a response over to the waiting syncRequest or the handlers
+void ModbusClientRTU::respond(RequestEntry& request, ModbusMessage& response) {
+  // Is someone waiting for this very request?
+  if (request.syncID || request.onDone) {
+    // Yes. Hand the response over to the waiting caller or completion handler
+    complete(request.syncID, request.onDone, response);
+  // No, an async request. Do we have an onResponse handler?
+  } else if (onResponse) {
+    // Yes. Call it
+    onResponse(response, request.token);
+  } else if (onResponseV) {
+    onResponseV(ModbusMessageView(response), request.token);
+  } else {
+    // No, but we may have onData or onError handlers
+    // Did we get a normal response?
+    if (response.getError()==SUCCESS) {
+      // Yes. Do we have an onData handler registered?
+      if (onData) {
+        // Yes. call it
+        onData(response, request.token);
+      } else if (onDataV) {
+        onDataV(ModbusMessageView(response), request.token);
+      }
+    } else {
+      // No, something went wrong. All we have is an error
+      // Do we have an onError handler?
+      if (onError) {
+        // Yes. Forward the error code to it
+        onError(response.getError(), request.token);
+      }
+    }
+  }
+}
+
+// respondIdentical: answer the queued reads identical to the one just done
+void ModbusClientRTU::respondIdentical(const ModbusMessage& request, ModbusMessage& response) {
+  uint8_t functionCode = request.getFunctionCode();
+  if (functionCode < READ_COIL || functionCode > READ_INPUT_REGISTER) return;
+
+  // The front entry is the request done, so the search starts behind it
+  size_t i = 1;
+  while (1) {
+    RequestEntry follower(0, ModbusMessage());
+    {
+      LOCK_GUARD(lockGuard, qLock);
+      // Find the next identical read. A request that is not a read may change the data - stop there.
+      for (; i < requests.size(); ++i) {
+        if (requests[i].msg == request) break;
+        uint8_t fc = requests[i].msg.getFunctionCode();
+        if (fc < READ_COIL || fc > READ_INPUT_REGISTER) return;
+      }
+      if (i >= requests.size()) return;
+      follower = std::move(requests[i]);
+      requests.erase(requests.begin() + i);
+    }
+    LOG_D("Coalesced request answered.\n");
+    respond(follower, response);
+  }
+}
+
 // handleConnection: worker task
 // This was created in begin() to handle the queue entries
 void ModbusClientRTU::handleConnection(ModbusClientRTU *instance) {
@@ -252,12 +339,19 @@ void ModbusClientRTU::handleConnection(ModbusClientRTU *instance) {
   while (instance->MR_serial->available()) instance->MR_serial->read();
   delay(100);
 
+  // Let addToQueue() wake us up
+  instance->MR_wakeup.attach();
+
   // Loop forever - or until task is killed
   while (1) {
     // Do we have a reuest in queue?
     if (!instance->requests.empty()) {
-      // Yes. pull it.
-      RequestEntry request = instance->requests.front();
+      // Yes. pull it. The message is moved out, the emptied entry is removed when done.
+      RequestEntry request(0, ModbusMessage());
+      {
+        LOCK_GUARD(lockGuard, instance->qLock);
+        request = std::move(instance->requests.front());
+      }
 
       LOG_D("Pulled request from queue\n");
 
@@ -308,34 +402,12 @@ void ModbusClientRTU::handleConnection(ModbusClientRTU *instance) {
           instance->errorCount++;
         }
   
-        // Was it a synchronous request?
-        if (request.isSyncRequest) {
-          // Yes. Put it into the response map
-          {
-            LOCK_GUARD(sL, instance->syncRespM);
-            instance->syncResponse[request.token] = response;
-          }
-        // No, an async request. Do we have an onResponse handler?
-        } else if (instance->onResponse) {
-          // Yes. Call it
-          instance->onResponse(response, request.token);
-        } else {
-          // No, but we may have onData or onError handlers
-          // Did we get a normal response?
-          if (response.getError()==SUCCESS) {
-            // Yes. Do we have an onData handler registered?
-            if (instance->onData) {
-              // Yes. call it
-              instance->onData(response, request.token);
-            }
-          } else {
-            // No, something went wrong. All we have is an error
-            // Do we have an onError handler?
-            if (instance->onError) {
-              // Yes. Forward the error code to it
-              instance->onError(response.getError(), request.token);
-            }
-          }
+        // Hand the response over
+        instance->respond(request, response);
+
+        // Identical reads queued behind it get the same response
+        if (instance->MR_coalesce) {
+          instance->respondIdentical(request.msg, response);
         }
       }
       // Clean-up time. 
@@ -343,10 +415,11 @@ void ModbusClientRTU::handleConnection(ModbusClientRTU *instance) {
         // Safely lock the queue
         LOCK_GUARD(lockGuard, instance->qLock);
         // Remove the front queue entry
-        instance->requests.pop();
+        instance->requests.pop_front();
       }
     } else {
-      delay(1);
+      // Nothing to do - sleep until the next request is queued
+      instance->MR_wakeup.wait(WAIT_FOREVER);
     }
   }
 }
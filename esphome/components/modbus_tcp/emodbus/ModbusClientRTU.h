@@ -10,9 +10,11 @@
 #if HAS_FREERTOS
 
 #include "ModbusClient.h"
+#include "WorkerSignal.h"
 #include "Stream.h"
 #include "RTUutils.h"
 #include <queue>
+#include <deque>
 #include <vector>
 
 using std::queue;
@@ -53,6 +55,11 @@ public:
   // Toggle skipping of leading 0x00 byte
   void skipLeading0x00(bool onOff = true);
 
+  // Let identical reads (FC 0x01..0x04) share one request: reads queued behind the same one get its
+  // response without going out on the bus again. A request that is not a read, queued in between,
+  // keeps the later reads apart. Default is off.
+  void setReadCoalescing(bool onOff = true);
+
   // Return number of unprocessed requests in queue
   uint32_t pendingRequests();
 
@@ -66,19 +73,23 @@ protected:
   struct RequestEntry {
     uint32_t token;
     ModbusMessage msg;
-    bool isSyncRequest;
-    RequestEntry(uint32_t t, const ModbusMessage& m, bool syncReq = false) :
+    uint32_t syncID;            // id of the waiting syncRequest's SyncSlot, 0 for async requests
+    MBOnDone onDone;            // Completion handler of the request, if any
+    RequestEntry(uint32_t t, ModbusMessage&& m, uint32_t sID = 0, MBOnDone&& d = MBOnDone()) :
       token(t),
-      msg(m),
-      isSyncRequest(syncReq) {}
+      msg(std::move(m)),
+      syncID(sID),
+      onDone(std::move(d)) {}
   };
 
   // Base addRequest and syncRequest must be present
   Error addRequestM(ModbusMessage msg, uint32_t token) override;
-  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token) override;
+  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token, uint32_t timeout) override;
+  Error addRequestD(ModbusMessage msg, uint32_t token, MBOnDone&& onDone) override;
 
-  // addToQueue: send freshly created request to queue
-  bool addToQueue(uint32_t token, ModbusMessage msg, bool syncReq = false);
+  // addToQueue: send freshly created request to queue. The message is moved into the queue,
+  // onDone only if there was room
+  bool addToQueue(uint32_t token, ModbusMessage&& msg, uint32_t syncID = 0, MBOnDone&& onDone = MBOnDone());
 
   // handleConnection: worker task method
   static void handleConnection(ModbusClientRTU *instance);
@@ -86,11 +97,17 @@ protected:
   // receive: get response via Serial
   ModbusMessage receive(const ModbusMessage request);
 
+  // respond: hand a response over to the waiting syncRequest or the handlers
+  void respond(RequestEntry& request, ModbusMessage& response);
+
+  // respondIdentical: answer the queued reads identical to the one just done
+  void respondIdentical(const ModbusMessage& request, ModbusMessage& response);
+
   // start background task
   void doBegin(uint32_t baudRate, int coreID, uint32_t userInterval);
 
   void isInstance() override { return; }   // make class instantiable
-  queue<RequestEntry> requests;   // Queue to hold requests to be processed
+  std::deque<RequestEntry> requests;  // Queue to hold requests to be processed
   #if USE_MUTEX
   mutex qLock;                    // Mutex to protect queue
   #endif
@@ -98,11 +115,13 @@ protected:
   unsigned long MR_lastMicros;    // Microseconds since last bus activity
   uint32_t MR_interval;           // Modbus RTU bus quiet time
   int8_t MR_rtsPin;               // GPIO pin to toggle RS485 DE/RE line. -1 if none.
-  RTScallback MTRSrts;            // RTS line callback function
+  RTSfunction MTRSrts;            // RTS line callback function
   uint16_t MR_qLimit;             // Maximum number of requests to hold in the queue
   uint32_t MR_timeoutValue;       // Interface default timeout
   bool MR_useASCII;               // true=ModbusASCII, false=ModbusRTU
   bool MR_skipLeadingZeroByte;    // true=skip the first byte if it is 0x00, false=accept all bytes
+  bool MR_coalesce;               // Identical reads share a request
+  WorkerSignal MR_wakeup;         // Wakes the worker when a request is queued
 
 };
 
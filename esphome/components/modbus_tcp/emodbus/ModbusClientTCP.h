@@ -13,13 +13,16 @@
 #endif
 
 #include "ModbusClient.h"
+#include "WorkerSignal.h"
+#include "SlotRing.h"
 #include "Client.h"
-#include <queue>
+#include <atomic>
 #include <vector>
-using std::queue;
 
 #define TARGETHOSTINTERVAL 10
 #define DEFAULTTIMEOUT 2000
+#define MT_RXBUFSIZE 260    // MBAP header plus the largest possible Modbus packet
+#define MT_HEADROOM 6       // Room for the MBAP header in front of a queued request
 
 class ModbusClientTCP : public ModbusClient {
 public:
@@ -41,6 +44,31 @@ public:
   // Set default timeout value (and interval)
   void setTimeout(uint32_t timeout = DEFAULTTIMEOUT, uint32_t interval = TARGETHOSTINTERVAL);
 
+  // Set number of requests to send without waiting for their responses (pipelining).
+  // Responses are matched to requests by transaction ID. Default is 1, i.e. no pipelining.
+  // Only use values >1 with servers/gateways that handle concurrent transactions!
+  // Requests in flight keep their queue slot until answered.
+  void setMaxInflightRequests(uint8_t maxInflight);
+
+  // Group queued requests by target to save target switches. Up to maxBatch requests for the current
+  // target are sent in a row before a request for another target waiting longer gets its turn.
+  // The order of requests for the same target is kept. 0 (default) sends all in strict FIFO order.
+  void setTargetAffinity(uint8_t maxBatch);
+
+  // Add another Client (of the same kind as the first) to the connection pool. Connections to as many
+  // different targets as there are Clients are kept open, so switching between them needs no reconnect.
+  // If all are in use, the least recently used connection is closed for a new target.
+  // Must be called before begin().
+  bool addClient(Client& client);
+
+  // Set time in ms after which unused pool connections are closed. 0 (default) keeps them open.
+  void setIdleTimeout(uint32_t timeout);
+
+  // Let identical reads (FC 0x01..0x04) share one request: a read queued while the same one for the
+  // same target is waiting or in flight is not sent again, but gets the response of the first.
+  // A write to the target queued in between keeps the later read apart. Default is off.
+  void setReadCoalescing(bool onOff = true);
+
   // Switch target host (if necessary)
   bool setTarget(IPAddress host, uint16_t port, uint32_t timeout = 0, uint32_t interval = 0);
 
@@ -116,15 +144,14 @@ protected:
     uint16_t protocolID;        // const 0x0000
     uint16_t len;               // Length of remainder of TCP packet
 
-    inline explicit operator const uint8_t *() {
-      uint8_t *cp = headRoom;
+    // writeTo: put the MSB-first header into the MT_HEADROOM bytes at cp
+    inline void writeTo(uint8_t *cp) const {
       *cp++ = (transactionID >> 8) & 0xFF;
       *cp++ = transactionID  & 0xFF;
       *cp++ = (protocolID >> 8) & 0xFF;
       *cp++ = protocolID  & 0xFF;
       *cp++ = (len >> 8) & 0xFF;
       *cp++ = len  & 0xFF;
-      return headRoom;
     }
 
     inline ModbusTCPhead& operator= (ModbusTCPhead& t) {
@@ -133,34 +160,52 @@ protected:
       len           = t.len;
       return *this;
     }
+  };
 
-  protected:
-    uint8_t headRoom[6] = {0,0,0,0,0,0};        // Buffer to hold MSB-first TCP header
+  // class describing a connection in the pool
+  struct PoolEntry {
+    Client *client;             // Client object to use
+    TargetHost target;          // Target it is (or was last) connected to
+    unsigned long lastUsed;     // Time of the last request sent or answered
+    explicit PoolEntry(Client *c) :
+      client(c),
+      target(TargetHost()),
+      lastUsed(0) {}
   };
 
   struct RequestEntry {
     uint32_t token;
-    ModbusMessage msg;
+    ModbusMessage::MessageData frame;  // MT_HEADROOM bytes for the MBAP header, followed by the request
     TargetHost target;
     ModbusTCPhead head;
-    bool isSyncRequest;
-    RequestEntry(uint32_t t, const ModbusMessage& m, TargetHost tg, bool syncReq = false) :
-      token(t),
-      msg(m),
-      target(tg),
+    uint32_t syncID;            // id of the waiting syncRequest's SyncSlot, 0 for async requests
+    MBOnDone onDone;            // Completion handler of the request, if any
+    unsigned long sentAt;       // Time the request was sent, to detect timeouts
+    RequestEntry *follower;     // Identical read answered together with this one
+    RequestEntry() :
+      token(0),
       head(ModbusTCPhead()),
-      isSyncRequest(syncReq) {}
+      syncID(0),
+      sentAt(0),
+      follower(nullptr) {}
+    // Server ID and function code of the request
+    inline uint8_t getServerID() const { return frame.size() > MT_HEADROOM ? frame[MT_HEADROOM] : 0; }
+    inline uint8_t getFunctionCode() const { return frame.size() > MT_HEADROOM + 1 ? frame[MT_HEADROOM + 1] : 0; }
   };
 
   // Base addRequest and syncRequest must be present
   Error addRequestM(ModbusMessage msg, uint32_t token) override;
-  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token) override;
+  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token, uint32_t timeout) override;
+  Error addRequestD(ModbusMessage msg, uint32_t token, MBOnDone&& onDone) override;
   // TCP-specific addition "...MT()" including adhoc target - used by bridge 
   Error addRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort);
-  ModbusMessage syncRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort);
+  Error addRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort, MBOnDone&& onDone);
+  ModbusMessage syncRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort, uint32_t timeout = 0);
 
-  // addToQueue: send freshly created request to queue
-  bool addToQueue(uint32_t token, ModbusMessage request, TargetHost target, bool syncReq = false);
+  // addToQueue: send freshly created request to queue. The message is put into a free slot,
+  // onDone is moved there only if there was one
+  bool addToQueue(uint32_t token, ModbusMessage&& request, TargetHost target, uint32_t syncID = 0,
+                  MBOnDone&& onDone = MBOnDone());
 
   // handleConnection: worker task method
   static void handleConnection(ModbusClientTCP *instance);
@@ -171,20 +216,62 @@ protected:
   // send: send request via Client connection
   void send(RequestEntry *request);
 
-  // receive: get response via Client connection
-  ModbusMessage receive(RequestEntry *request);
+  // receive: collect response data via Client connection. true if a complete packet has arrived
+  bool receive();
+
+  // checkResponse: validate a received packet against the request it answers
+  ModbusMessage checkResponse(RequestEntry *request);
+
+  // selectConnection: switch to the pool connection for a target
+  void selectConnection(const TargetHost& target);
+
+  // closeIdleConnections: stop unused pool connections, return ms until the next check
+  uint32_t closeIdleConnections();
+
+  // respond: hand a response over to the waiting syncRequest or the handlers, followers included
+  void respond(RequestEntry *request, ModbusMessage& response);
+
+  // nextRequest: choose the request to be sent next. nullptr if there is none
+  RequestEntry *nextRequest();
+
+  // coalesce: attach a newly queued read to an identical one waiting or in flight. true if done
+  bool coalesce(RequestEntry *request);
+
+  // takeRequest: remove the request chosen by nextRequest() from the queue
+  void takeRequest(RequestEntry *request);
+
+  // releaseSlot: return the slot of a finished request to the pool
+  void releaseSlot(RequestEntry *request);
 
   void isInstance() override { return; }   // make class instantiable
-  queue<RequestEntry *> requests;   // Queue to hold requests to be processed
-  #if USE_MUTEX
-  mutex qLock;                    // Mutex to protect queue
-  #endif
+  // The queue is a pool of preallocated request slots, of which the free and the queued ones are
+  // held in lock-free rings. addToQueue() takes a free slot, fills it and passes it on to the worker,
+  // that in turn returns it to the free ring when the request is done. Nothing is allocated or locked.
+  std::vector<RequestEntry> MT_slots;   // Request pool, queueLimit entries
+  SlotRing MT_freeSlots;          // Slots available to addToQueue()
+  SlotRing MT_requests;           // Slots queued for the worker, oldest first
+  std::atomic<uint32_t> MT_pending;  // Number of queued requests not yet sent
+  std::vector<RequestEntry *> MT_waiting;  // Requests taken over from MT_requests, not yet sent (worker task only)
+  std::atomic<bool> MT_clearWaiting;  // clearQueue() was called - MT_waiting has to be dropped
+  uint16_t MT_transactionID;      // Next MBAP transaction ID (worker task only)
   Client& MT_client;              // Client reference for Internet connections (EthernetClient or WifiClient)
+  Client *MT_current;             // Client of the pool connection in use
   TargetHost MT_lastTarget;       // last used server
   TargetHost MT_target;           // Description of target server
   uint32_t MT_defaultTimeout;     // Standard timeout value taken if no dedicated was set
   uint32_t MT_defaultInterval;    // Standard interval value taken if no dedicated was set
   uint16_t MT_qLimit;             // Maximum number of requests to accept in queue
+  uint8_t MT_maxInflight;         // Maximum number of requests sent but not yet answered
+  std::vector<RequestEntry *> inflight;  // Requests waiting for their responses (worker task only)
+  uint8_t MT_rxBuf[MT_RXBUFSIZE]; // Buffer collecting the response packet being received
+  uint16_t MT_rxLen;              // Number of bytes in MT_rxBuf
+  std::vector<PoolEntry> MT_pool; // Connection pool, MT_client being the first
+  uint8_t MT_active;              // Index of MT_current in the pool
+  uint32_t MT_idleTimeout;        // Time in ms to close unused pool connections after. 0=never
+  uint8_t MT_affinity;            // Maximum requests in a row for one target while others wait. 0=FIFO
+  uint8_t MT_batchCount;          // Requests sent in a row to MT_lastTarget
+  bool MT_coalesce;               // Identical reads share a request
+  WorkerSignal MT_wakeup;         // Wakes the worker when a request is queued
 
   // Let any ModbusBridge class use protected members
   template<typename SERVERCLASS> friend class ModbusBridge;
@@ -9,8 +9,11 @@
 
 ModbusClientTCPasync::ModbusClientTCPasync(IPAddress address, uint16_t port, uint16_t queueLimit) :
   ModbusClient(),
+  MTA_slots(queueLimit),
+  MTA_free(),
   txQueue(),
   rxQueue(),
+  MTA_rxLen(0),
   MTA_client(),
   MTA_timeout(DEFAULTTIMEOUT),
   MTA_idleTimeout(DEFAULTIDLETIME),
@@ -32,6 +35,11 @@ ModbusClientTCPasync::ModbusClientTCPasync(IPAddress address, uint16_t port, uin
 
       // disable nagle algorithm ref Modbus spec
       MTA_client.setNoDelay(true);
+
+      // All requests start out free
+      for (RequestEntry& re : MTA_slots) {
+        MTA_free.push_back(&re);
+      }
     }
 
 // Destructor: clean up queue, task etc.
@@ -41,15 +49,9 @@ ModbusClientTCPasync::~ModbusClientTCPasync() {
     // Safely lock access
     LOCK_GUARD(lock1, qLock);
     LOCK_GUARD(lock2, sLock);
-    // Delete all elements from queues
-    while (!txQueue.empty()) {
-      delete txQueue.front();
-      txQueue.pop_front();
-    }
-    for (auto it = rxQueue.cbegin(); it != rxQueue.cend();/* no increment */) {
-      delete it->second;
-      it = rxQueue.erase(it);
-    }
+    // Forget all queued requests. The pool goes with the object.
+    txQueue = RequestList();
+    rxQueue = RequestList();
   }
   // force close client
   MTA_client.close(true);
@@ -96,15 +98,37 @@ void ModbusClientTCPasync::setMaxInflightRequests(uint32_t maxInflightRequests)
   MTA_maxInflightRequests = maxInflightRequests;
 }
 
+// Set send batching on or off
+void ModbusClientTCPasync::setSendBatching(bool enable) {
+  LOCK_GUARD(lock1, qLock);
+  if (enable) {
+    MTA_txBuf.resize(MTA_TXBUFSIZE);
+  } else {
+    std::vector<uint8_t>().swap(MTA_txBuf);
+  }
+}
+
 // Remove all pending request from queue
 void ModbusClientTCPasync::clearQueue()
 {
-  LOCK_GUARD(lock1, qLock);
-  LOCK_GUARD(lock2, sLock);
-  // Delete all elements from queues
-  while (!txQueue.empty()) {
-    delete txQueue.front();
-    txQueue.pop_front();
+  // Requests someone is waiting for - to be told outside the locks
+  struct Dropped { uint32_t syncID; MBOnDone onDone; uint8_t serverID; uint8_t functionCode; };
+  std::vector<Dropped> dropped;
+  {
+    LOCK_GUARD(lock1, qLock);
+    LOCK_GUARD(lock2, sLock);
+    // Return all unsent requests to the pool
+    while (!txQueue.empty()) {
+      RequestEntry *r = txQueue.head;
+      txQueue.remove(r);
+      if (r->syncID || r->onDone) {
+        dropped.push_back({ r->syncID, std::move(r->onDone), r->msg.getServerID(), r->msg.getFunctionCode() });
+      }
+      MTA_free.push_back(r);
+    }
+  }
+  for (Dropped& d : dropped) {
+    dropSync(d.syncID, d.onDone, d.serverID, d.functionCode);
   }
 }
 
@@ -115,7 +139,7 @@ Error ModbusClientTCPasync::addRequestM(ModbusMessage msg, uint32_t token) {
   // Add it to the queue, if valid
   if (msg) {
     // Queue add successful?
-    if (!addToQueue(token, msg)) {
+    if (!addToQueue(token, std::move(msg))) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -125,18 +149,32 @@ Error ModbusClientTCPasync::addRequestM(ModbusMessage msg, uint32_t token) {
   return rc;
 }
 
+// addRequestD: queue the request with a completion handler
+Error ModbusClientTCPasync::addRequestD(ModbusMessage msg, uint32_t token, MBOnDone&& onDone) {
+  if (!msg) return EMPTY_MESSAGE;
+  if (!addToQueue(token, std::move(msg), 0, std::move(onDone))) {
+    return REQUEST_QUEUE_FULL;
+  }
+  return SUCCESS;
+}
+
 // Base syncRequest follows the same pattern
-ModbusMessage ModbusClientTCPasync::syncRequestM(ModbusMessage msg, uint32_t token) {
+ModbusMessage ModbusClientTCPasync::syncRequestM(ModbusMessage msg, uint32_t token, uint32_t timeout) {
   ModbusMessage response;
 
   if (msg) {
+    // msg is moved into the queue - keep what is needed for error responses
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    // Set up the slot to receive the response before the request can be answered
+    SyncSlot slot(this, token);
     // Queue add successful?
-    if (!addToQueue(token, msg, true)) {
+    if (!addToQueue(token, std::move(msg), slot.id)) {
       // No. Return error after deleting the allocated request.
-      response.setError(msg.getServerID(), msg.getFunctionCode(), REQUEST_QUEUE_FULL);
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
     } else {
       // Request is queued - wait for the result.
-      response = waitSync(msg.getServerID(), msg.getFunctionCode(), token);
+      response = waitSync(slot, serverID, functionCode, timeout);
     }
   } else {
     response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
@@ -145,27 +183,29 @@ ModbusMessage ModbusClientTCPasync::syncRequestM(ModbusMessage msg, uint32_t tok
 }
 
 // addToQueue: send freshly created request to queue
-bool ModbusClientTCPasync::addToQueue(int32_t token, ModbusMessage request, bool syncReq) {
+bool ModbusClientTCPasync::addToQueue(int32_t token, ModbusMessage&& request, uint32_t syncID, MBOnDone&& onDone) {
   // Did we get one?
   if (request) {
     LOCK_GUARD(lock1, qLock);
-    if (txQueue.size() + rxQueue.size() < MTA_qLimit) {
+    if (!MTA_free.empty()) {
       HEXDUMP_V("Enqueue", request.data(), request.size());
-      RequestEntry *re = new RequestEntry(token, request, syncReq);
-      if (!re) return false;  //TODO: proper error returning in case allocation fails
+      // Take a pool entry and move the message into it
+      RequestEntry *re = MTA_free.head;
+      MTA_free.remove(re);
+      re->token = token;
       // inject proper transactionID
       re->head.transactionID = messageCount++;
       re->head.len = request.size();
-      // if we're already connected, try to send and push to rxQueue
-      // or else push to txQueue and (re)connect
-      if (MTA_state == CONNECTED && send(re)) {
-        re->sentTime = millis();
-        rxQueue[re->head.transactionID] = re;
-      } else {
-        txQueue.push_back(re);
-        if (MTA_state == DISCONNECTED) {
-          connect();
-        }
+      re->msg = std::move(request);
+      re->syncID = syncID;
+      re->onDone = std::move(onDone);
+      // push to txQueue. If we're already connected, try to send right away
+      // or else (re)connect
+      txQueue.push_back(re);
+      if (MTA_state == CONNECTED) {
+        handleSendingQueue();
+      } else if (MTA_state == DISCONNECTED) {
+        connect();
       }
       return true;
     }
@@ -179,32 +219,32 @@ void ModbusClientTCPasync::onConnected() {
   LOCK_GUARD(lock1, sLock);
   MTA_state = CONNECTED;
   MTA_lastActivity = millis();
+  // Nothing left over from an earlier connection
+  MTA_rxLen = 0;
   // from now on onPoll will be called every 500 msec
 }
 
 void ModbusClientTCPasync::onDisconnected() {
   LOG_D("disconnected\n");
-  LOCK_GUARD(lock1, sLock);
-  MTA_state = DISCONNECTED;
-
-  // empty queue on disconnect, calling errorcode on every waiting request
-  LOCK_GUARD(lock2, qLock);
-  while (!txQueue.empty()) {
-    RequestEntry* r = txQueue.front();
-    if (onError) {
-      onError(IP_CONNECTION_FAILED, r->token);
+  RequestList failed;     // Requests to be told outside the locks
+  {
+    LOCK_GUARD(lock1, sLock);
+    MTA_state = DISCONNECTED;
+
+    // empty queue on disconnect, calling errorcode on every waiting request
+    LOCK_GUARD(lock2, qLock);
+    while (!txQueue.empty()) {
+      RequestEntry* r = txQueue.head;
+      txQueue.remove(r);
+      failed.push_back(r);
     }
-    delete r;
-    txQueue.pop_front();
-  }
-  while (!rxQueue.empty()) {
-    RequestEntry *r = rxQueue.begin()->second;
-    if (onError) {
-      onError(IP_CONNECTION_FAILED, r->token);
+    while (!rxQueue.empty()) {
+      RequestEntry *r = rxQueue.head;
+      rxQueue.remove(r);
+      failed.push_back(r);
     }
-    delete r;
-    rxQueue.erase(rxQueue.begin());
   }
+  failRequests(failed, IP_CONNECTION_FAILED);
 }
 
 
@@ -227,95 +267,111 @@ void ModbusClientTCPasync::onPacket(uint8_t* data, size_t length) {
   // reset idle timeout
   MTA_lastActivity = millis();
 
-  if (length) {
-    LOG_D("parsing (len:%u)\n", length + 1);
-  }
   while (length > 0) {
     RequestEntry* request = nullptr;
-    ModbusMessage* response = nullptr;
-    uint16_t transactionID = 0;
-    bool isOkay = false;
-
-    // 1. Check for valid modbus message
-
-    // MBAP header is 6 bytes, we can't do anything with less
-    // total message should fit MBAP plus remaining bytes (in data[4], data[5])
-    if (length > 6) {
-      transactionID = (data[0] << 8) | data[1];
-      uint16_t protocolID = (data[2] << 8) | data[3];
-      uint16_t messageLength = (data[4] << 8) | data[5];
-      if (protocolID == 0 &&
-        length >= (uint32_t)messageLength + 6 &&
-        messageLength < 256) {
-        response = new ModbusMessage(messageLength);
-        response->add(&data[6], messageLength);
-        LOG_D("packet validated (len:%d)\n", messageLength);
-
-        // on next iteration: adjust remaining length and pointer to data
-        length -= 6 + messageLength;
-        data += 6 + messageLength;
-        isOkay = true;
-      }
+    const uint8_t* frame = nullptr;
+
+    // 1. Find the next complete modbus message
+
+    // MBAP header is 6 bytes, the total message has 6 plus the remaining bytes (in data[4], data[5]).
+    // A message completely contained in the packet is used in place.
+    if (MTA_rxLen == 0 && length > 6 && length >= (uint32_t)((data[4] << 8) | data[5]) + 6) {
+      frame = data;
+    } else {
+      // No. The message is split across packets - collect it in MTA_rxBuf.
+      // Take the header first, then as many bytes as it announces.
+      size_t need = (MTA_rxLen < 6 ? 6 : ((MTA_rxBuf[4] << 8) | MTA_rxBuf[5]) + 6) - MTA_rxLen;
+      if (need > length) need = length;
+      memcpy(MTA_rxBuf + MTA_rxLen, data, need);
+      MTA_rxLen += need;
+      data += need;
+      length -= need;
+      // Need more data?
+      if (MTA_rxLen < 6) break;
+      frame = MTA_rxBuf;
     }
 
-    if (!isOkay) {
-      // invalid packet, abort function
+    uint16_t transactionID = (frame[0] << 8) | frame[1];
+    uint16_t protocolID = (frame[2] << 8) | frame[3];
+    uint16_t messageLength = (frame[4] << 8) | frame[5];
+    if (protocolID != 0 || messageLength == 0 || messageLength > MTA_RXBUFSIZE - 6) {
+      // invalid packet, drop anything collected and abort function
       LOG_W("packet invalid\n");
+      MTA_rxLen = 0;
       return;
+    }
+
+    if (frame == MTA_rxBuf) {
+      // Is the collected message complete now?
+      if (MTA_rxLen < messageLength + 6) continue;
+      MTA_rxLen = 0;
     } else {
-      // 2. we got a valid response, match with a request
+      // on next iteration: adjust remaining length and pointer to data
+      length -= 6 + messageLength;
+      data += 6 + messageLength;
+    }
+    // The response is looked at in place. MTA_rxBuf is not touched again before the next iteration.
+    ModbusMessageView response(frame + 6, messageLength);
+    LOG_D("packet validated (len:%d)\n", messageLength);
+
+    // 2. we got a valid response, match with a request
+    {
       LOCK_GUARD(lock1, qLock);
-      auto i = rxQueue.find(transactionID);
-      if (i != rxQueue.end()) {
-        // found it, handle it and stop iterating
-        request = i->second;
-        i = rxQueue.erase(i);
+      request = findSent(transactionID);
+      if (request) {
+        // found it, handle it
+        rxQueue.remove(request);
         LOG_D("matched request\n");
       } else {
-        // TCP packet did not yield valid modbus response, abort function
+        // No request waiting for it - may have timed out already. Skip to the next message.
         LOG_W("no matching request found\n");
-        return;
+        continue;
       }
     }
 
     // 3. we have a valid request and a valid response, call appropriate callback
-    if (request) {
-      // compare request with response
-      Error error = SUCCESS;
-      if (request->msg.getFunctionCode() != (response->getFunctionCode() & 0x7F)) {
-        error = FC_MISMATCH;
-      } else if (request->msg.getServerID() != response->getServerID()) {
-        error = SERVER_ID_MISMATCH;
-      } else {
-        error = response->getError();
-      }
+    // compare request with response
+    Error error = SUCCESS;
+    if (request->msg.getFunctionCode() != (response.getFunctionCode() & 0x7F)) {
+      error = FC_MISMATCH;
+    } else if (request->msg.getServerID() != response.getServerID()) {
+      error = SERVER_ID_MISMATCH;
+    } else {
+      error = response.getError();
+    }
 
-      if (error != SUCCESS) {
-        LOCK_GUARD(errorCntLock, countAccessM);
-        errorCount++;
-      }
+    if (error != SUCCESS) {
+      LOCK_GUARD(errorCntLock, countAccessM);
+      errorCount++;
+    }
 
-      if (request->isSyncRequest) {
-        {
-          LOCK_GUARD(sL ,syncRespM);
-          syncResponse[request->token] = *response;
+    // Handlers taking a view get the response without it being copied.
+    // Only the others need a ModbusMessage of their own.
+    if (request->syncID || request->onDone) {
+      complete(request->syncID, request->onDone, response.toMessage());
+    } else if (onResponseV) {
+      onResponseV(response, request->token);
+    } else if (onResponse) {
+      onResponse(response.toMessage(), request->token);
+    } else {
+      if (error == SUCCESS) {
+        if (onDataV) {
+          onDataV(response, request->token);
+        } else if (onData) {
+          onData(response.toMessage(), request->token);
         }
-      } else if (onResponse) {
-        onResponse(*response, request->token);
       } else {
-        if (error == SUCCESS) {
-          if (onData) {
-            onData(*response, request->token);
-          }
-        } else {
-          if (onError) {
-            onError(response->getError(), request->token);
-          }
+        if (onError) {
+          onError(response.getError(), request->token);
         }
       }
-      delete request;
     }
-    delete response;
+
+    // Return the request to the pool
+    {
+      LOCK_GUARD(lock1, qLock);
+      MTA_free.push_back(request);
+    }
 
   }  // end processing of incoming data
 
@@ -325,28 +381,25 @@ void ModbusClientTCPasync::onPacket(uint8_t* data, size_t length) {
 }
 
 void ModbusClientTCPasync::onPoll() {
+  RequestList failed;     // Requests to be told outside the lock
   {
   LOCK_GUARD(lock1, qLock);
 
   // try to send whatever is waiting
   handleSendingQueue();
 
-  // next check if timeout has struck for oldest request
-  if (!rxQueue.empty()) {
-    RequestEntry* request = rxQueue.begin()->second;
-    if (millis() - request->sentTime > MTA_timeout) {
-      LOG_D("request timeouts (now:%lu-sent:%u)\n", millis(), request->sentTime);
-      // oldest element timeouts, call onError and clean up
-      if (onError) {
-        // Handle timeout error
-        onError(TIMEOUT, request->token);
-      }
-      delete request;
-      rxQueue.erase(rxQueue.begin());
-    }
+  // next expire all requests whose timeout has struck, oldest first.
+  // The first one still in time ends the search - all sent after it are younger.
+  uint32_t now = millis();
+  while (!rxQueue.empty() && now - rxQueue.head->sentTime > MTA_timeout) {
+    RequestEntry* request = rxQueue.head;
+    LOG_D("request timeouts (now:%u-sent:%u)\n", now, request->sentTime);
+    rxQueue.remove(request);
+    failed.push_back(request);
   }
-    
+
   }  // end lockguard scope
+  failRequests(failed, TIMEOUT);
 
   // if nothing happened during idle timeout, gracefully close connection
   if (millis() - MTA_lastActivity > MTA_idleTimeout) {
@@ -359,19 +412,25 @@ void ModbusClientTCPasync::handleSendingQueue() {
   // Calling sites must assure shared resources are protected
   // by mutex.
 
+  // Batching requests?
+  if (!MTA_txBuf.empty()) {
+    // Yes. Send them together, as long as there are more and room to do so
+    while (sendBatch()) {}
+    return;
+  }
+
   // try to send everything we have waiting
-  std::list<RequestEntry*>::iterator it = txQueue.begin();
-  while (it != txQueue.end()) {
-    // get the actual element
-    if (send(*it)) {
-      // after sending, update timeout value, add to other queue and remove from this queue
-      (*it)->sentTime = millis();
-      rxQueue[(*it)->head.transactionID] = (*it);      // push request to other queue
-      it = txQueue.erase(it);  // remove from toSend queue and point i to next request
-    } else {
-      // sending didn't succeed, try next request
-      ++it;
+  RequestEntry *re = txQueue.head;
+  while (re) {
+    // remember the next element - re will be moved to the other queue
+    RequestEntry *next = re->next;
+    if (send(re)) {
+      // after sending, remove from this queue, update timeout value and add to other queue
+      txQueue.remove(re);
+      markSent(re);
     }
+    // if sending didn't succeed, try next request anyway
+    re = next;
   }
 }
 
@@ -397,3 +456,103 @@ bool ModbusClientTCPasync::send(RequestEntry* re) {
   }
   return false;
 }
+
+bool ModbusClientTCPasync::sendBatch() {
+  // ATTENTION: This method does not have a lock guard.
+  // Calling sites must assure shared resources are protected
+  // by mutex.
+
+  // Pack the requests in queue order until one does not fit any more
+  size_t room = MTA_client.space();
+  if (room > MTA_txBuf.size()) room = MTA_txBuf.size();
+  uint16_t len = 0;
+  uint8_t cnt = 0;
+  while (!txQueue.empty() && rxQueue.size() < MTA_maxInflightRequests) {
+    RequestEntry *re = txQueue.head;
+    uint16_t msgLen = re->msg.size();
+    if ((size_t)len + msgLen + 6 > room) break;
+    memcpy(MTA_txBuf.data() + len, (const uint8_t *)(re->head), 6);
+    memcpy(MTA_txBuf.data() + len + 6, re->msg.data(), msgLen);
+    len += msgLen + 6;
+    cnt++;
+    // Packed - move it over to the other queue
+    txQueue.remove(re);
+    markSent(re);
+  }
+
+  // Anything to send?
+  if (len) {
+    // Yes. Hand it over as a whole
+    MTA_client.add(reinterpret_cast<const char*>(MTA_txBuf.data()), len, ASYNC_WRITE_FLAG_COPY);
+    MTA_client.send();
+    LOG_D("%u requests sent (len:%u)\n", cnt, len);
+    return true;
+  }
+  return false;
+}
+
+void ModbusClientTCPasync::markSent(RequestEntry* re) {
+  // ATTENTION: This method does not have a lock guard.
+  // Calling sites must assure shared resources are protected
+  // by mutex.
+  re->sentTime = millis();
+  rxQueue.push_back(re);
+}
+
+ModbusClientTCPasync::RequestEntry *ModbusClientTCPasync::findSent(uint16_t transactionID) {
+  // ATTENTION: This method does not have a lock guard.
+  // Calling sites must assure shared resources are protected
+  // by mutex.
+
+  // Responses mostly come in the order the requests were sent, so the match is near the head
+  for (RequestEntry *re = rxQueue.head; re; re = re->next) {
+    if (re->head.transactionID == transactionID) return re;
+  }
+  return nullptr;
+}
+
+void ModbusClientTCPasync::failRequests(RequestList& failed, Error error) {
+  while (!failed.empty()) {
+    RequestEntry *re = failed.head;
+    failed.remove(re);
+    // Is a syncRequest or completion handler waiting for it?
+    if (re->syncID || re->onDone) {
+      // Yes. Let it know with an error response
+      ModbusMessage response;
+      response.setError(re->msg.getServerID(), re->msg.getFunctionCode(), error);
+      complete(re->syncID, re->onDone, response);
+    } else if (onError) {
+      onError(error, re->token);
+    }
+    // Return the request to the pool
+    LOCK_GUARD(lock1, qLock);
+    MTA_free.push_back(re);
+  }
+}
+
+void ModbusClientTCPasync::RequestList::push_back(RequestEntry* re) {
+  re->prev = tail;
+  re->next = nullptr;
+  if (tail) {
+    tail->next = re;
+  } else {
+    head = re;
+  }
+  tail = re;
+  count++;
+}
+
+void ModbusClientTCPasync::RequestList::remove(RequestEntry* re) {
+  if (re->prev) {
+    re->prev->next = re->next;
+  } else {
+    head = re->next;
+  }
+  if (re->next) {
+    re->next->prev = re->prev;
+  } else {
+    tail = re->prev;
+  }
+  re->prev = re->next = nullptr;
+  count--;
+}
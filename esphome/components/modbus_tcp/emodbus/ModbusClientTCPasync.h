@@ -13,8 +13,6 @@
 #include "options.h"
 #include "ModbusMessage.h"
 #include "ModbusClient.h"
-#include <list>
-#include <map>
 #include <vector>
 #if USE_MUTEX
 #include <mutex>      // NOLINT
@@ -24,6 +22,8 @@ using std::vector;
 
 #define DEFAULTTIMEOUT 10000
 #define DEFAULTIDLETIME 60000
+#define MTA_RXBUFSIZE 260    // MBAP header plus the largest possible Modbus packet
+#define MTA_TXBUFSIZE 1436   // Batch of requests fitting into one TCP segment (default lwIP MSS)
 
 class ModbusClientTCPasync : public ModbusClient {
 public:
@@ -50,6 +50,11 @@ public:
   // Set maximum amount of messages awaiting a response. Subsequent messages will be queued.
   void setMaxInflightRequests(uint32_t maxInflightRequests);
 
+  // Send requests that are ready at the same time - on connect, or when responses free room for
+  // more requests in flight - packed into one TCP segment instead of one segment each.
+  // No request is held back to wait for others. Default is off.
+  void setSendBatching(bool enable);
+
 // Remove all pending request from queue
   void clearQueue();
 
@@ -99,25 +104,60 @@ protected:
     ModbusMessage msg;
     ModbusTCPhead head;
     uint32_t sentTime;
-    bool isSyncRequest;
-    RequestEntry(uint32_t t, const ModbusMessage& m, bool syncReq = false) :
-      token(t),
-      msg(m),
+    uint32_t syncID;            // id of the waiting syncRequest's SyncSlot, 0 for async requests
+    MBOnDone onDone;            // Completion handler of the request, if any
+    RequestEntry *prev;         // Neighbours in the list the entry is in
+    RequestEntry *next;
+    RequestEntry() :
+      token(0),
       head(ModbusTCPhead()),
       sentTime(0),
-      isSyncRequest(syncReq) {}
+      syncID(0),
+      prev(nullptr),
+      next(nullptr) {}
+  };
+
+  // Intrusive FIFO list of RequestEntry, linked by their prev/next pointers.
+  // An entry is in exactly one list at a time: free, txQueue, rxQueue or a local list of failed requests.
+  struct RequestList {
+    RequestEntry *head;
+    RequestEntry *tail;
+    uint16_t count;
+    RequestList() :
+      head(nullptr),
+      tail(nullptr),
+      count(0) {}
+    inline bool empty() const { return head == nullptr; }
+    inline uint16_t size() const { return count; }
+    void push_back(RequestEntry *re);
+    void remove(RequestEntry *re);
   };
 
   // Base addRequest and syncRequest both must be present
   Error addRequestM(ModbusMessage msg, uint32_t token) override;
-  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token) override;
+  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token, uint32_t timeout) override;
+  Error addRequestD(ModbusMessage msg, uint32_t token, MBOnDone&& onDone) override;
 
-  // addToQueue: send freshly created request to queue
-  bool addToQueue(int32_t token, ModbusMessage request, bool syncReq = false);
+  // addToQueue: send freshly created request to queue. The message is moved into a pool entry,
+  // onDone only if there was one
+  bool addToQueue(int32_t token, ModbusMessage&& request, uint32_t syncID = 0, MBOnDone&& onDone = MBOnDone());
 
   // send: send request via Client connection
   bool send(RequestEntry *request);
 
+  // sendBatch: send as many waiting requests as fit into one TCP segment. false if none was sent
+  bool sendBatch();
+
+  // markSent: move a sent request to the end of rxQueue
+  void markSent(RequestEntry *request);
+
+  // findSent: look up the request with the given transaction ID in rxQueue. nullptr if not found
+  RequestEntry *findSent(uint16_t transactionID);
+
+  // failRequests: report error for all requests in the list and return them to the pool.
+  // Must be called without holding the locks, as the handlers may come back with new requests.
+  void failRequests(RequestList& failed, Error error);
+
   // receive: get response via Client connection
   // TCPResponse* receive(uint8_t* data, size_t length);
 
@@ -133,8 +173,15 @@ protected:
   void onPoll();
   void handleSendingQueue();
 
-  std::list<RequestEntry*> txQueue;           // Queue to hold requests to be sent
-  std::map<uint16_t, RequestEntry*> rxQueue;  // Queue to hold requests to be processed
+  // Requests live in a pool allocated once by the constructor and are passed between the lists.
+  // rxQueue is in the order the requests were sent. As all share the same timeout, this is the
+  // order they expire in: onPoll() only needs to look at the head of the list.
+  std::vector<RequestEntry> MTA_slots;  // Request pool, queueLimit entries
+  RequestList MTA_free;             // Unused pool entries
+  RequestList txQueue;              // Queue to hold requests to be sent
+  RequestList rxQueue;              // Queue to hold requests to be processed
+  uint8_t MTA_rxBuf[MTA_RXBUFSIZE]; // Message split across packets, collected until complete
+  uint16_t MTA_rxLen;               // Number of bytes in MTA_rxBuf
   #if USE_MUTEX
   std::mutex sLock;                         // Mutex to protect state
   std::mutex qLock;                         // Mutex to protect queues
@@ -146,6 +193,7 @@ protected:
   uint16_t MTA_qLimit;              // Maximum number of requests to accept in queue
   uint32_t MTA_maxInflightRequests; // Maximum number of inflight requests
   uint32_t MTA_lastActivity;        // Last time there was activity (disabled when queues are not empty)
+  std::vector<uint8_t> MTA_txBuf;   // Batch being packed. Only allocated with send batching enabled
   enum {
     DISCONNECTED,
     CONNECTING,
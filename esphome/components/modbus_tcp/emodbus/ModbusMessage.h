@@ -9,6 +9,20 @@
 #include <type_traits>
 #include <vector>
 
+// Build option: define MODBUS_INLINE_MESSAGES=1 to keep the data of every ModbusMessage in a
+// fixed buffer of MODBUS_INLINE_SIZE bytes inside the object instead of on the heap.
+// No message will allocate memory then, but each takes the full size wherever it is held -
+// mind task stacks and queue limits. Longer messages are cut off.
+#ifndef MODBUS_INLINE_MESSAGES
+#define MODBUS_INLINE_MESSAGES 0
+#endif
+#if MODBUS_INLINE_MESSAGES
+#include "InlineBuffer.h"
+#ifndef MODBUS_INLINE_SIZE
+#define MODBUS_INLINE_SIZE 260   // MBAP header plus the largest Modbus message
+#endif
+#endif
+
 using Modbus::Error;
 using Modbus::FCType;
 using Modbus::FCT;
@@ -55,15 +69,22 @@ public:
   operator bool();
   
   // Exposed methods of std::vector
-  const uint8_t   *data();  // address of MM_data
-  uint16_t   size();  // used length in MM_data
+  const uint8_t   *data() const;  // address of MM_data
+  uint16_t   size() const;  // used length in MM_data
   uint8_t    operator[](uint16_t index) const; // provide restricted operator[] interface
   void push_back(const uint8_t& val); // add a byte at the end of MM_data
   void clear();             // delete message contents
   uint16_t resize(uint16_t newSize);  // resize MM_data
 
+  // Container type of MM_data
+#if MODBUS_INLINE_MESSAGES
+  typedef InlineBuffer<MODBUS_INLINE_SIZE> MessageData;
+#else
+  typedef std::vector<uint8_t> MessageData;
+#endif
+
   // provide iterator interface on MM_data
-  typedef std::vector<uint8_t>::const_iterator const_iterator;
+  typedef MessageData::const_iterator const_iterator;
   const_iterator begin() const { return MM_data.begin(); }
   const_iterator end() const   { return MM_data.end(); }
 
@@ -183,7 +204,7 @@ protected:
   // Error output in case a message constructor will fail
   static void printError(const char *file, int lineNo, Error e, uint8_t serverID, uint8_t functionCode);
 
-  std::vector<uint8_t> MM_data;  // Message data buffer
+  MessageData MM_data;  // Message data buffer
 
   static uint8_t floatOrder[sizeof(float)]; // order of bytes in a float variable
   static uint8_t doubleOrder[sizeof(double)]; // order of bytes in a double variable
@@ -194,6 +215,11 @@ protected:
   static float swapFloat(float& f, int swapRule);
   static double swapDouble(double& f, int swapRule);
 
+  // getFloat(), getDouble(): read a value from any byte buffer. Used by get() and ModbusMessageView
+  static uint16_t getFloat(const uint8_t *data, uint16_t size, uint16_t index, float& v, int swapRule);
+  static uint16_t getDouble(const uint8_t *data, uint16_t size, uint16_t index, double& v, int swapRule);
+  friend class ModbusMessageView;
+
   // getOne() - read a MSB-first value starting at byte index. Returns updated index
   template <typename T> uint16_t getOne(uint16_t index, T& retval) const {
     uint16_t sz = sizeof(retval);    // Size of value to be read
@@ -0,0 +1,267 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "ModbusRegisterBank.h"
+
+#undef LOCAL_LOG_LEVEL
+// #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
+#include "Logging.h"
+
+// inRange: true, if count values starting at address fit into an area of size values
+static inline bool inRange(uint16_t address, uint16_t count, uint32_t size) {
+  return count && (static_cast<uint32_t>(address) + count <= size);
+}
+
+// Constructor
+ModbusRegisterBank::ModbusRegisterBank(uint16_t coils, uint16_t discreteInputs, uint16_t holdingRegisters, uint16_t inputRegisters) :
+  RB_coils((coils + 7) >> 3, 0),
+  RB_discreteInputs((discreteInputs + 7) >> 3, 0),
+  RB_holding(holdingRegisters, 0),
+  RB_input(inputRegisters, 0),
+  RB_numCoils(coils),
+  RB_numDiscreteInputs(discreteInputs) { }
+
+// Set functions
+bool ModbusRegisterBank::setCoil(uint16_t address, bool value) {
+  if (address >= RB_numCoils) return false;
+  LOCK_GUARD(lockGuard, RB_lock);
+  setBit(RB_coils, address, value);
+  return true;
+}
+
+bool ModbusRegisterBank::setDiscreteInput(uint16_t address, bool value) {
+  if (address >= RB_numDiscreteInputs) return false;
+  LOCK_GUARD(lockGuard, RB_lock);
+  setBit(RB_discreteInputs, address, value);
+  return true;
+}
+
+bool ModbusRegisterBank::setHoldingRegister(uint16_t address, uint16_t value) {
+  return setHoldingRegisters(address, 1, &value);
+}
+
+bool ModbusRegisterBank::setInputRegister(uint16_t address, uint16_t value) {
+  return setInputRegisters(address, 1, &value);
+}
+
+bool ModbusRegisterBank::setHoldingRegisters(uint16_t address, uint16_t count, const uint16_t *values) {
+  if (!inRange(address, count, RB_holding.size())) return false;
+  LOCK_GUARD(lockGuard, RB_lock);
+  for (uint16_t i = 0; i < count; ++i) {
+    RB_holding[address + i] = values[i];
+  }
+  return true;
+}
+
+bool ModbusRegisterBank::setInputRegisters(uint16_t address, uint16_t count, const uint16_t *values) {
+  if (!inRange(address, count, RB_input.size())) return false;
+  LOCK_GUARD(lockGuard, RB_lock);
+  for (uint16_t i = 0; i < count; ++i) {
+    RB_input[address + i] = values[i];
+  }
+  return true;
+}
+
+// Get functions
+bool ModbusRegisterBank::getCoil(uint16_t address) {
+  if (address >= RB_numCoils) return false;
+  LOCK_GUARD(lockGuard, RB_lock);
+  return getBit(RB_coils, address);
+}
+
+bool ModbusRegisterBank::getDiscreteInput(uint16_t address) {
+  if (address >= RB_numDiscreteInputs) return false;
+  LOCK_GUARD(lockGuard, RB_lock);
+  return getBit(RB_discreteInputs, address);
+}
+
+uint16_t ModbusRegisterBank::getHoldingRegister(uint16_t address) {
+  uint16_t value = 0;
+  getHoldingRegisters(address, 1, &value);
+  return value;
+}
+
+uint16_t ModbusRegisterBank::getInputRegister(uint16_t address) {
+  uint16_t value = 0;
+  getInputRegisters(address, 1, &value);
+  return value;
+}
+
+bool ModbusRegisterBank::getHoldingRegisters(uint16_t address, uint16_t count, uint16_t *values) {
+  if (!inRange(address, count, RB_holding.size())) return false;
+  LOCK_GUARD(lockGuard, RB_lock);
+  for (uint16_t i = 0; i < count; ++i) {
+    values[i] = RB_holding[address + i];
+  }
+  return true;
+}
+
+bool ModbusRegisterBank::getInputRegisters(uint16_t address, uint16_t count, uint16_t *values) {
+  if (!inRange(address, count, RB_input.size())) return false;
+  LOCK_GUARD(lockGuard, RB_lock);
+  for (uint16_t i = 0; i < count; ++i) {
+    values[i] = RB_input[address + i];
+  }
+  return true;
+}
+
+// readBits: add byte count and count bits starting at address to the response. Range is checked already.
+void ModbusRegisterBank::readBits(const std::vector<uint8_t>& bits, uint16_t address, uint16_t count, ModbusMessage& response) {
+  uint8_t bytes = (count + 7) >> 3;
+  response.add(bytes);
+  // Every response byte is put together from the (at most) two bank bytes its bits are in
+  for (uint8_t j = 0; j < bytes; ++j) {
+    uint32_t first = address + (j << 3);
+    uint16_t idx = first >> 3;
+    uint16_t w = bits[idx];
+    if (idx + 1U < bits.size()) w |= bits[idx + 1] << 8;
+    w >>= (first & 7);
+    // Last byte may be incomplete - unused bits shall be 0
+    uint16_t n = count - (j << 3);
+    if (n < 8) w &= (1 << n) - 1;
+    response.add(static_cast<uint8_t>(w & 0xFF));
+  }
+}
+
+// readWords: add byte count and count registers starting at address to the response. Range is checked already.
+void ModbusRegisterBank::readWords(const std::vector<uint16_t>& words, uint16_t address, uint16_t count, ModbusMessage& response) {
+  response.add(static_cast<uint8_t>(count * 2));
+  for (uint16_t i = 0; i < count; ++i) {
+    response.add(words[address + i]);
+  }
+}
+
+// respond: process a request for one of the served function codes and return the response
+ModbusMessage ModbusRegisterBank::respond(const ModbusMessageView& request) {
+  uint8_t serverID = request.getServerID();
+  uint8_t functionCode = request.getFunctionCode();
+  uint16_t address = 0;
+  uint16_t count = 0;         // Number of values, or the value for single writes
+  Error e = SUCCESS;
+
+  // All function codes served have the address and a count or value first
+  if (request.size() < 6) {
+    ModbusMessage response;
+    response.setError(serverID, functionCode, ILLEGAL_DATA_VALUE);
+    return response;
+  }
+  request.get(2, address, count);
+
+  switch (functionCode) {
+  case READ_COIL:
+  case READ_DISCR_INPUT:
+    {
+      bool coils = (functionCode == READ_COIL);
+      if (count < 1 || count > 2000) {
+        e = ILLEGAL_DATA_VALUE;
+      } else if (!inRange(address, count, coils ? RB_numCoils : RB_numDiscreteInputs)) {
+        e = ILLEGAL_DATA_ADDRESS;
+      } else {
+        // Checked - build the response right in its final size
+        ModbusMessage response(3 + ((count + 7) >> 3));
+        response.add(serverID, functionCode);
+        LOCK_GUARD(lockGuard, RB_lock);
+        readBits(coils ? RB_coils : RB_discreteInputs, address, count, response);
+        return response;
+      }
+    }
+    break;
+  case READ_HOLD_REGISTER:
+  case READ_INPUT_REGISTER:
+    {
+      const std::vector<uint16_t>& words = (functionCode == READ_HOLD_REGISTER) ? RB_holding : RB_input;
+      if (count < 1 || count > 125) {
+        e = ILLEGAL_DATA_VALUE;
+      } else if (!inRange(address, count, words.size())) {
+        e = ILLEGAL_DATA_ADDRESS;
+      } else {
+        ModbusMessage response(3 + count * 2);
+        response.add(serverID, functionCode);
+        LOCK_GUARD(lockGuard, RB_lock);
+        readWords(words, address, count, response);
+        return response;
+      }
+    }
+    break;
+  case WRITE_COIL:
+    if (count != 0xFF00 && count != 0x0000) {
+      e = ILLEGAL_DATA_VALUE;
+    } else if (address >= RB_numCoils) {
+      e = ILLEGAL_DATA_ADDRESS;
+    } else {
+      {
+        LOCK_GUARD(lockGuard, RB_lock);
+        setBit(RB_coils, address, count == 0xFF00);
+      }
+      // The response is the echo of the request
+      ModbusMessage response(6);
+      response.add(request.data(), 6);
+      return response;
+    }
+    break;
+  case WRITE_HOLD_REGISTER:
+    if (address >= RB_holding.size()) {
+      e = ILLEGAL_DATA_ADDRESS;
+    } else {
+      {
+        LOCK_GUARD(lockGuard, RB_lock);
+        RB_holding[address] = count;
+      }
+      ModbusMessage response(6);
+      response.add(request.data(), 6);
+      return response;
+    }
+    break;
+  case WRITE_MULT_COILS:
+    {
+      uint8_t bytes = request[6];
+      if (count < 1 || count > 1968 || bytes != ((count + 7) >> 3) || request.size() < 7 + bytes) {
+        e = ILLEGAL_DATA_VALUE;
+      } else if (!inRange(address, count, RB_numCoils)) {
+        e = ILLEGAL_DATA_ADDRESS;
+      } else {
+        {
+          LOCK_GUARD(lockGuard, RB_lock);
+          const uint8_t *data = request.data() + 7;
+          for (uint16_t i = 0; i < count; ++i) {
+            setBit(RB_coils, address + i, data[i >> 3] & (1 << (i & 7)));
+          }
+        }
+        // Response is the first 6 bytes of the request
+        ModbusMessage response(6);
+        response.add(request.data(), 6);
+        return response;
+      }
+    }
+    break;
+  case WRITE_MULT_REGISTERS:
+    {
+      uint8_t bytes = request[6];
+      if (count < 1 || count > 123 || bytes != count * 2 || request.size() < 7 + bytes) {
+        e = ILLEGAL_DATA_VALUE;
+      } else if (!inRange(address, count, RB_holding.size())) {
+        e = ILLEGAL_DATA_ADDRESS;
+      } else {
+        {
+          LOCK_GUARD(lockGuard, RB_lock);
+          const uint8_t *data = request.data() + 7;
+          for (uint16_t i = 0; i < count; ++i) {
+            RB_holding[address + i] = (data[i * 2] << 8) | data[i * 2 + 1];
+          }
+        }
+        ModbusMessage response(6);
+        response.add(request.data(), 6);
+        return response;
+      }
+    }
+    break;
+  default:
+    e = ILLEGAL_FUNCTION;
+    break;
+  }
+  LOG_D("Register bank error %02X for %02X/%02X\n", e, serverID, functionCode);
+  ModbusMessage response;
+  response.setError(serverID, functionCode, e);
+  return response;
+}
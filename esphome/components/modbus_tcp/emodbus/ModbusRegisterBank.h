@@ -0,0 +1,82 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_REGISTER_BANK_H
+#define _MODBUS_REGISTER_BANK_H
+
+#include "options.h"
+
+#include <vector>
+#if USE_MUTEX
+#include <mutex>      // NOLINT
+#endif
+#include "ModbusTypeDefs.h"
+#include "ModbusMessage.h"
+#include "ModbusMessageView.h"
+
+#if USE_MUTEX
+using std::mutex;
+using std::lock_guard;
+#endif
+
+// ModbusRegisterBank: coils, discrete inputs, holding and input registers held in memory.
+// Registered with a server by ModbusServer::registerBank(), it answers the function codes
+// READ_COIL, READ_DISCR_INPUT, READ_HOLD_REGISTER, READ_INPUT_REGISTER, WRITE_COIL,
+// WRITE_HOLD_REGISTER, WRITE_MULT_COILS and WRITE_MULT_REGISTERS without any worker function.
+// The application may read and change the values at any time, also while requests are served.
+class ModbusRegisterBank {
+public:
+  // Constructor: number of coils, discrete inputs, holding and input registers. All are addressed
+  // starting at 0 and initially set to 0.
+  ModbusRegisterBank(uint16_t coils, uint16_t discreteInputs, uint16_t holdingRegisters, uint16_t inputRegisters);
+
+  // Set functions for the application. Return false, if the address (range) is not in the bank
+  bool setCoil(uint16_t address, bool value);
+  bool setDiscreteInput(uint16_t address, bool value);
+  bool setHoldingRegister(uint16_t address, uint16_t value);
+  bool setInputRegister(uint16_t address, uint16_t value);
+  bool setHoldingRegisters(uint16_t address, uint16_t count, const uint16_t *values);
+  bool setInputRegisters(uint16_t address, uint16_t count, const uint16_t *values);
+
+  // Get functions for the application. Single values are false/0, if the address is not in the bank
+  bool getCoil(uint16_t address);
+  bool getDiscreteInput(uint16_t address);
+  uint16_t getHoldingRegister(uint16_t address);
+  uint16_t getInputRegister(uint16_t address);
+  bool getHoldingRegisters(uint16_t address, uint16_t count, uint16_t *values);
+  bool getInputRegisters(uint16_t address, uint16_t count, uint16_t *values);
+
+  // respond: process a request for one of the served function codes and return the response
+  ModbusMessage respond(const ModbusMessageView& request);
+
+protected:
+  // Prevent copy construction or assignment
+  ModbusRegisterBank(ModbusRegisterBank& other) = delete;
+  ModbusRegisterBank& operator=(ModbusRegisterBank& other) = delete;
+
+  // Read requests: put the values into the response, that has the header set already
+  void readBits(const std::vector<uint8_t>& bits, uint16_t address, uint16_t count, ModbusMessage& response);
+  void readWords(const std::vector<uint16_t>& words, uint16_t address, uint16_t count, ModbusMessage& response);
+
+  // Bit access in the packed bit arrays, LSB first like in the Modbus messages
+  inline static bool getBit(const std::vector<uint8_t>& bits, uint16_t index) {
+    return bits[index >> 3] & (1 << (index & 7));
+  }
+  inline static void setBit(std::vector<uint8_t>& bits, uint16_t index, bool value) {
+    if (value) bits[index >> 3] |= (1 << (index & 7));
+    else       bits[index >> 3] &= ~(1 << (index & 7));
+  }
+
+  std::vector<uint8_t> RB_coils;            // Coils, 8 per byte
+  std::vector<uint8_t> RB_discreteInputs;   // Discrete inputs, 8 per byte
+  std::vector<uint16_t> RB_holding;         // Holding registers
+  std::vector<uint16_t> RB_input;           // Input registers
+  uint16_t RB_numCoils;                     // Number of coils
+  uint16_t RB_numDiscreteInputs;            // Number of discrete inputs
+  #if USE_MUTEX
+  mutex RB_lock;                            // Covers all values
+  #endif
+};
+
+#endif
@@ -4,61 +4,325 @@
 // =================================================================================================
 #include <Arduino.h>
 #include "ModbusServer.h"
+#include "ModbusRegisterBank.h"
+#include "WorkerSignal.h"
 
 #undef LOCAL_LOG_LEVEL
 // #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
 #include "Logging.h"
 
+// Returned by getWorker() if there is no worker
+static const MBSworker NO_WORKER = nullptr;
+
+// deliver: send the response to the request identified by tag, unless the sink was closed
+bool ModbusResponseSink::deliver(uint32_t tag, const ModbusMessage& response) {
+  LOCK_GUARD(sinkLock, RS_lock);
+  if (!RS_open) return false;
+  send(tag, response);
+  return true;
+}
+
+// close: no more deliveries
+void ModbusResponseSink::close() {
+  LOCK_GUARD(sinkLock, RS_lock);
+  RS_open = false;
+}
+
+// isOpen: true until close() was called
+bool ModbusResponseSink::isOpen() {
+  LOCK_GUARD(sinkLock, RS_lock);
+  return RS_open;
+}
+
+// WaitSink: takes the response of an async worker for callers that need it right away.
+// Must be created by the task that will wait for the response.
+class WaitSink : public ModbusResponseSink {
+public:
+  WaitSink() : received(false) {
+#if HAS_FREERTOS || IS_LINUX
+    arrived.attach();
+#endif
+  }
+  ModbusMessage response;
+
+  // wait: sleep until the response is there, timeout ms at most. Returns true if it has arrived
+  bool wait(uint32_t timeout) {
+    uint32_t start = millis();
+    while (!received) {
+      uint32_t waited = millis() - start;
+      if (waited >= timeout) return false;
+#if HAS_FREERTOS || IS_LINUX
+      arrived.wait(timeout - waited);
+#else
+      delay(1);
+#endif
+    }
+    return true;
+  }
+
+protected:
+  std::atomic<bool> received;
+#if HAS_FREERTOS || IS_LINUX
+  WorkerSignal arrived;           // Wakes the waiting task
+#endif
+
+  void send(uint32_t tag, const ModbusMessage& r) override {
+    response = r;
+    received = true;
+#if HAS_FREERTOS || IS_LINUX
+    arrived.notify();
+#endif
+  }
+};
+
+// State: what a ModbusResponder needs to answer the request
+struct ModbusResponder::State {
+  State(const ModbusMessageView& r, const std::shared_ptr<ModbusResponseSink>& s, uint32_t t, ModbusServer *sv) :
+    request(r.toMessage()),
+    sink(s),
+    tag(t),
+    server(sv),
+    answered(false) {}
+  // Nobody will answer any more - let the requester know
+  ~State() {
+    if (!answered) {
+      ModbusMessage response;
+      response.setError(request.getServerID(), request.getFunctionCode(), SERVER_DEVICE_FAILURE);
+      finish(*this, response);
+    }
+  }
+  ModbusMessage request;                    // Copy of the request, for ECHO_RESPONSE
+  std::shared_ptr<ModbusResponseSink> sink; // Where the response goes
+  uint32_t tag;                             // Identifies the request for the sink
+  ModbusServer *server;                     // Server to count errors with, nullptr if the caller does
+  std::atomic<bool> answered;               // Set by the first response
+};
+
+// finish: process and send the first response for the request, ignore all others
+bool ModbusResponder::finish(State& state, const ModbusMessage& response) {
+  // Only the first response counts
+  if (state.answered.exchange(true)) return false;
+  ModbusMessage m;
+  // One of the predefined types?
+  if (response[0] == 0xFF && (response[1] == 0xF0 || response[1] == 0xF1)) {
+    // Yes. NIL leaves m empty, so nothing is sent
+    if (response[1] == 0xF1) {
+      m = state.request;
+      if (m.getFunctionCode() == WRITE_MULT_REGISTERS || m.getFunctionCode() == WRITE_MULT_COILS) {
+        m.resize(6);
+      }
+    }
+  } else {
+    m = response;
+  }
+  if (state.server && m.size() && m.getError() != SUCCESS) {
+    state.server->countError();
+  }
+  return state.sink->deliver(state.tag, m);
+}
+
+// respond: send the response
+bool ModbusResponder::respond(const ModbusMessage& response) {
+  if (!RP_state) return false;
+  return finish(*RP_state, response);
+}
+
+// respondError: send an error response for the request
+bool ModbusResponder::respondError(Error error) {
+  if (!RP_state) return false;
+  ModbusMessage response;
+  response.setError(RP_state->request.getServerID(), RP_state->request.getFunctionCode(), error);
+  return finish(*RP_state, response);
+}
+
+// isPending: true, if a response is still expected and can be sent
+bool ModbusResponder::isPending() const {
+  return RP_state && !RP_state->answered && RP_state->sink->isOpen();
+}
+
 // registerWorker: register a worker function for a certain serverID/FC combination
 // If there is one already, it will be overwritten!
-void ModbusServer::registerWorker(uint8_t serverID, uint8_t functionCode, MBSworker worker) {
-  workerMap[serverID][functionCode] = worker;
+bool ModbusServer::registerWorker(uint8_t serverID, uint8_t functionCode, MBSworker worker) {
+  return setWorker(serverID, functionCode, WorkerFunction(std::move(worker)), ViewWorkerFunction(), AsyncWorkerFunction(), nullptr);
+}
+
+// registerWorker: same for a worker taking a view on the request
+bool ModbusServer::registerWorker(uint8_t serverID, uint8_t functionCode, MBSworkerView worker) {
+  return setWorker(serverID, functionCode, WorkerFunction(), ViewWorkerFunction(std::move(worker)), AsyncWorkerFunction(), nullptr);
+}
+
+// registerWorker: same for a worker answering later through a ModbusResponder
+bool ModbusServer::registerWorker(uint8_t serverID, uint8_t functionCode, MBSasyncWorker worker) {
+  return setWorker(serverID, functionCode, WorkerFunction(), ViewWorkerFunction(), AsyncWorkerFunction(std::move(worker)), nullptr);
+}
+
+// registerBank: have the register bank serve all function codes it knows for serverID
+bool ModbusServer::registerBank(uint8_t serverID, ModbusRegisterBank& bank) {
+  static const uint8_t served[] = { READ_COIL, READ_DISCR_INPUT, READ_HOLD_REGISTER, READ_INPUT_REGISTER,
+                                    WRITE_COIL, WRITE_HOLD_REGISTER, WRITE_MULT_COILS, WRITE_MULT_REGISTERS };
+  bool accepted = true;
+  for (uint8_t fc : served) {
+    accepted &= setWorker(serverID, fc, WorkerFunction(), ViewWorkerFunction(), AsyncWorkerFunction(), &bank);
+  }
+  return accepted;
+}
+
+// setWorker: common part of the worker registrations
+bool ModbusServer::setWorker(uint8_t serverID, uint8_t functionCode, WorkerFunction&& worker, ViewWorkerFunction&& viewWorker,
+                             AsyncWorkerFunction&& asyncWorker, ModbusRegisterBank *bank) {
+  // Function codes with the error bit set will never be requested
+  if (functionCode & 0x80) {
+    LOG_E("Invalid function code %02X for worker\n", functionCode);
+    return false;
+  }
+  std::shared_ptr<WorkerEntry> we = std::make_shared<WorkerEntry>();
+  we->worker = std::move(worker);
+  we->viewWorker = std::move(viewWorker);
+  we->asyncWorker = std::move(asyncWorker);
+  we->bank = bank;
+  // The wrapper lives in the entry, so it can refer to it. Capturing two pointers only,
+  // it fits into the std::function without allocation.
+  WorkerEntry *wp = we.get();
+  we->wrapper = [this, wp](ModbusMessage msg) {
+    return wp->worker ? wp->worker(std::move(msg)) : wp->call(ModbusMessageView(msg), asyncTimeout);
+  };
+  {
+    // Build the successor of the current registry aside
+    LOCK_GUARD(regLock, registryLock);
+    Registry *next = new Registry;
+    next->workers = registry.load()->workers;
+    next->workers[serverID][functionCode] = std::move(we);
+    publish(next);
+  }
   LOG_D("Registered worker for %02X/%02X\n", serverID, functionCode);
+  return true;
 }
 
-// getWorker: if a worker function is registered, return its address, nullptr otherwise
-MBSworker ModbusServer::getWorker(uint8_t serverID, uint8_t functionCode) {
-  bool serverFound = false;
-  LOG_D("Need worker for %02X-%02X : ", serverID, functionCode);
-  // Search the FC map associated with the serverID
-  auto svmap = workerMap.find(serverID);
-  // Is there one?
-  if (svmap != workerMap.end()) {
-    serverFound = true;
-  // No explicit serverID entry found, but we may have one for ANY_SERVER
-  } else {
-    svmap = workerMap.find(ANY_SERVER);
-    if (svmap != workerMap.end()) {
-      serverFound = true;
+// call: have the request processed by the worker. Only a worker taking a ModbusMessage gets a copy
+ModbusMessage ModbusServer::WorkerEntry::call(const ModbusMessageView& request, uint32_t timeout) {
+  if (bank) return bank->respond(request);
+  if (viewWorker) return viewWorker(request);
+  if (asyncWorker) {
+    // Nobody to take the response later - wait for it, but not forever: a worker may hold on to its
+    // responder without ever answering.
+    std::shared_ptr<WaitSink> waitSink = std::make_shared<WaitSink>();
+    callAsync(request, waitSink, 0, nullptr);
+    // Did the response arrive in time?
+    if (!waitSink->wait(timeout)) {
+      // No. Later responses go nowhere
+      waitSink->close();
+      ModbusMessage response;
+      response.setError(request.getServerID(), request.getFunctionCode(), SERVER_DEVICE_FAILURE);
+      return response;
     }
+    return waitSink->response;
   }
-  // Did we find a serverID?
-  if (serverFound) {
-    // Yes. Now look for the function code in the inner map
-    bool functionCodeFound = false;
-    auto fcmap = svmap->second.find(functionCode);;
-    // Found it?
-    if (fcmap != svmap->second.end()) {
-      // Yes. Return the function pointer for it.
-      functionCodeFound = true;
-      // No, no explicit worker found, but may be there is one for ANY_FUNCTION_CODE?
-    } else {
-      fcmap = svmap->second.find(ANY_FUNCTION_CODE);;
-      // Found it?
-      if (fcmap != svmap->second.end()) {
-        // Yes. Return the function pointer for it.
-        functionCodeFound = true;
-      }
+  return worker(request.toMessage());
+}
+
+// callAsync: hand the request to the async worker, with a responder for sink and tag
+void ModbusServer::WorkerEntry::callAsync(const ModbusMessageView& request, const std::shared_ptr<ModbusResponseSink>& sink, uint32_t tag, ModbusServer *server) {
+  ModbusResponder responder(std::make_shared<ModbusResponder::State>(request, sink, tag, server));
+  asyncWorker(request.toMessage(), std::move(responder));
+}
+
+// getWorker: if a worker function is registered, return a reference to it, an empty MBSworker otherwise
+const MBSworker& ModbusServer::getWorker(uint8_t serverID, uint8_t functionCode) {
+  ReadGuard guard(readers);
+  WorkerEntry *we = findWorker(serverID, functionCode);
+  // Did we find one?
+  if (we) {
+    return we->wrapper;
+  }
+  return NO_WORKER;
+}
+
+// callWorker: have the request processed by its worker. false, if no worker is registered for it
+bool ModbusServer::callWorker(const ModbusMessageView& request, ModbusMessage& response,
+                              const std::shared_ptr<ModbusResponseSink>& sink, uint32_t tag) {
+  // The worker is kept while it is busy with the request, even if it is replaced meanwhile
+  std::shared_ptr<WorkerEntry> we = holdWorker(request.getServerID(), request.getFunctionCode());
+  // Did we find one?
+  if (!we) return false;
+  // Yes. Can an async worker answer later?
+  if (we->asyncWorker && sink) {
+    // Yes. Start it, the response will go to the sink
+    we->callAsync(request, sink, tag, this);
+    response = NIL_RESPONSE;
+    return true;
+  }
+  // Have it processed right away
+  response = we->call(request, asyncTimeout);
+  return true;
+}
+
+// countError: count an error response sent
+void ModbusServer::countError() {
+  LOCK_GUARD(cntLock, m);
+  errorCount++;
+}
+
+// findWorker: look up the worker for a serverID/FC combination, nullptr if there is none
+ModbusServer::WorkerEntry *ModbusServer::findWorker(uint8_t serverID, uint8_t functionCode) {
+  // The wildcards were resolved in Registry::build() already
+  Dispatch *d = registry.load()->serverTable[serverID];
+  if (!d) return nullptr;
+  // Function codes with the error bit set can only be served by an ANY_FUNCTION_CODE worker
+  return d->fc[(functionCode & 0x80) ? static_cast<uint8_t>(ANY_FUNCTION_CODE) : functionCode];
+}
+
+// holdWorker: look up the worker and keep it for the caller, nullptr if there is none
+std::shared_ptr<ModbusServer::WorkerEntry> ModbusServer::holdWorker(uint8_t serverID, uint8_t functionCode) {
+  ReadGuard guard(readers);
+  WorkerEntry *we = findWorker(serverID, functionCode);
+  return we ? we->shared_from_this() : nullptr;
+}
+
+// publish: make next the current registry
+void ModbusServer::publish(Registry *next) {
+  next->build();
+  retired.push_back(registry.exchange(next));
+  // Lookups starting from now on will find next. Is there one left that may still see the others?
+  if (readers.load() == 0) {
+    // No. They can go
+    for (Registry *r : retired) {
+      delete r;
     }
-    if (functionCodeFound) {
-      // Yes. Return the function pointer for it.
-      LOGRAW_D("Worker found for %02X/%02X\n", serverID, functionCode);
-      return fcmap->second;
+    retired.clear();
+  }
+}
+
+// build: compile workers into the lookup tables
+void ModbusServer::Registry::build() {
+  dispatchTables.clear();
+  dispatchTables.reserve(workers.size());
+  // One table per server ID
+  for (auto& sv : workers) {
+    Dispatch d;
+    d.serverID = sv.first;
+    // Default for all function codes is the ANY_FUNCTION_CODE worker, if there is one
+    auto any = sv.second.find(ANY_FUNCTION_CODE);
+    WorkerEntry *anyWorker = (any != sv.second.end()) ? any->second.get() : nullptr;
+    for (uint8_t fc = 0; fc < 0x80; ++fc) {
+      d.fc[fc] = anyWorker;
+    }
+    // Now the explicitly registered ones
+    for (auto& w : sv.second) {
+      d.fc[w.first] = w.second.get();
     }
+    dispatchTables.push_back(d);
+  }
+  // Server IDs without a table of their own use that of ANY_SERVER
+  Dispatch *anyServer = nullptr;
+  for (auto& d : dispatchTables) {
+    if (d.serverID == ANY_SERVER) anyServer = &d;
+  }
+  for (uint16_t i = 0; i < 256; ++i) {
+    serverTable[i] = anyServer;
+  }
+  for (auto& d : dispatchTables) {
+    serverTable[d.serverID] = &d;
   }
-  // No matching function pointer found
-  LOGRAW_D("No matching worker found\n");
-  return nullptr;
 }
 
 // unregisterWorker; remove again all or part of the registered workers for a given server ID
@@ -66,19 +330,22 @@ MBSworker ModbusServer::getWorker(uint8_t serverID, uint8_t functionCode) {
 bool ModbusServer::unregisterWorker(uint8_t serverID, uint8_t functionCode) {
   uint16_t numEntries = 0;    // Number of entries removed
 
+  LOCK_GUARD(regLock, registryLock);
+  Registry *current = registry.load();
   // Is there at least one entry for the serverID?
-  auto svmap = workerMap.find(serverID);
-  // Is there one?
-  if (svmap != workerMap.end()) {
-    // Yes. we may proceed with it
+  if (current->workers.find(serverID) != current->workers.end()) {
+    // Yes. we may proceed with it, on a copy
+    Registry *next = new Registry;
+    next->workers = current->workers;
     // Are we to look for a single serverID/FC combination?
     if (functionCode) {
       // Yes. 
-      numEntries = svmap->second.erase(functionCode);
+      numEntries = next->workers[serverID].erase(functionCode);
     } else {
       // No, the serverID shall be removed with all references
-      numEntries = workerMap.erase(serverID);
+      numEntries = next->workers.erase(serverID);
     }
+    publish(next);
   } 
   LOG_D("Removed %d worker entries for %d/%d\n", numEntries, serverID, functionCode);
   return (numEntries ? true : false);
@@ -89,7 +356,8 @@ bool ModbusServer::unregisterWorker(uint8_t serverID, uint8_t functionCode) {
 //              including ANY_FUNCTION_CODE :D
 bool ModbusServer::isServerFor(uint8_t serverID, uint8_t functionCode) {
   // Check if there is a non-nullptr function for the given combination
-  if (getWorker(serverID, functionCode)) {
+  ReadGuard guard(readers);
+  if (findWorker(serverID, functionCode)) {
     return true;
   }
   return false;
@@ -97,10 +365,10 @@ bool ModbusServer::isServerFor(uint8_t serverID, uint8_t functionCode) {
 
 // isServerFor: short version to look up if the server is known at all
 bool ModbusServer::isServerFor(uint8_t serverID) {
-  // Check if there is a non-nullptr function for the given combination
-  auto svmap = workerMap.find(serverID);
-  // Is there one?
-  if (svmap != workerMap.end()) {
+  // Is there a table for exactly this server ID?
+  ReadGuard guard(readers);
+  Dispatch *d = registry.load()->serverTable[serverID];
+  if (d && d->serverID == serverID) {
     return true;
   }
   return false;
@@ -134,13 +402,10 @@ ModbusMessage ModbusServer::localRequest(ModbusMessage msg) {
   LOG_D("Local request for %02X/%02X\n", serverID, functionCode);
   HEXDUMP_V("Request", msg.data(), msg.size());
   messageCount++;
-  // Try to get a worker for the request
-  MBSworker worker = getWorker(serverID, functionCode);
-  // Did we get one?
-  if (worker != nullptr) {
-    // Yes. call it and return the response
-    LOG_D("Call worker\n");
-    m = worker(msg);
+  // Try to get a worker for the request and call it
+  LOG_D("Call worker\n");
+  if (callWorker(ModbusMessageView(msg), m)) {
+    // Got a response
     LOG_D("Worker responded\n");
     HEXDUMP_V("Worker response", m.data(), m.size());
     // Process Response. Is it one of the predefined types?
@@ -185,16 +450,28 @@ ModbusMessage ModbusServer::localRequest(ModbusMessage msg) {
 
 // Constructor
 ModbusServer::ModbusServer() :
+  registry(new Registry),
+  readers(0),
   messageCount(0),
-  errorCount(0) { }
+  errorCount(0),
+  asyncTimeout(20000) {
+  registry.load()->build();
+}
 
 // Destructor
 ModbusServer::~ModbusServer() {
+  for (Registry *r : retired) {
+    delete r;
+  }
+  delete registry.load();
 }
 
 // listServer: Print out all mapped server/FC combinations
 void ModbusServer::listServer() {
-  for (auto it = workerMap.begin(); it != workerMap.end(); ++it) {
+  // No registry is freed while we have the lock
+  LOCK_GUARD(regLock, registryLock);
+  Registry *current = registry.load();
+  for (auto it = current->workers.begin(); it != current->workers.end(); ++it) {
     LOG_N("Server %3d: ", it->first);
     for (auto it2 = it->second.begin(); it2 != it->second.end(); it2++) {
       LOGRAW_N(" %02X", it2->first);
@@ -10,12 +10,16 @@
 #include <map>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <atomic>
 #if USE_MUTEX
 #include <mutex>      // NOLINT
 #endif
 #include "ModbusTypeDefs.h"
 #include "ModbusError.h"
 #include "ModbusMessage.h"
+#include "ModbusMessageView.h"
+#include "InlineFunction.h"
 
 #if USE_MUTEX
 using std::mutex;
@@ -28,15 +32,112 @@ const ModbusMessage ECHO_RESPONSE(std::vector<uint8_t>{0xFF, 0xF1});
 
 // MBSworker: function signature for worker functions to handle single serverID/functionCode combinations
 using MBSworker = std::function<ModbusMessage(ModbusMessage msg)>;
+// MBSworkerView: worker variant getting a view on the request instead of a copy. The view is valid during the call only.
+using MBSworkerView = std::function<ModbusMessage(const ModbusMessageView& msg)>;
+
+class ModbusRegisterBank;
+class ModbusServer;
+
+// ModbusResponseSink: the way back to the requester, for responses that are given later.
+// A server creates one per connection and closes it when the connection is gone.
+class ModbusResponseSink {
+public:
+  ModbusResponseSink() : RS_open(true) {}
+  virtual ~ModbusResponseSink() {}
+
+  // deliver: send the response to the request identified by tag. An empty response means there
+  // is nothing to send (NIL_RESPONSE). false, if the sink was closed already
+  bool deliver(uint32_t tag, const ModbusMessage& response);
+
+  // close: no more deliveries. Waits for a delivery in progress to finish
+  void close();
+
+  // isOpen: true until close() was called
+  bool isOpen();
+
+protected:
+  // send: put the response on the wire, if it is not empty. Called with RS_lock held
+  virtual void send(uint32_t tag, const ModbusMessage& response) = 0;
+
+  bool RS_open;                  // false after close()
+  #if USE_MUTEX
+  std::mutex RS_lock;            // Serializes deliveries and close()
+  #endif
+};
+
+// ModbusResponder: handed to async workers to answer their request whenever they are done, from any task.
+// It may be copied and passed on; only the first respond() counts. If all copies are gone without a
+// response, a SERVER_DEVICE_FAILURE error is sent. The server must outlive pending responders.
+class ModbusResponder {
+public:
+  ModbusResponder() {}
+
+  // respond: send the response. NIL_RESPONSE and ECHO_RESPONSE work like for MBSworker.
+  // false, if there was a response already or the requester is gone
+  bool respond(const ModbusMessage& response);
+
+  // respondError: send an error response for the request
+  bool respondError(Error error);
+
+  // isPending: true, if a response is still expected and can be sent
+  bool isPending() const;
+
+protected:
+  friend class ModbusServer;
+  struct State;
+  explicit ModbusResponder(const std::shared_ptr<State>& state) : RP_state(state) {}
+
+  // finish: process and send the first response for the request, ignore all others
+  static bool finish(State& state, const ModbusMessage& response);
+
+  std::shared_ptr<State> RP_state;   // Shared by all copies
+};
+
+// MBSasyncWorker: worker that may answer later, e.g. after asking another device. It is handed the
+// request and a ModbusResponder to send the response with. It must return quickly; TCP servers read
+// and serve further requests of the same client meanwhile, the responses go out in completion order.
+using MBSasyncWorker = std::function<void(ModbusMessage msg, ModbusResponder responder)>;
 
 class ModbusServer {
 public:
   // registerWorker: register a worker function for a certain serverID/FC combination
-  // If there is one already, it will be overwritten!
-  void registerWorker(uint8_t serverID, uint8_t functionCode, MBSworker worker);
+  // If there is one already, it will be overwritten! Function codes 0x80 and above are not accepted.
+  // Workers may be (un)registered while the server is running. Requests being served keep the worker
+  // they have got, the next ones get the new one. Returns false if the worker was not accepted.
+  bool registerWorker(uint8_t serverID, uint8_t functionCode, MBSworker worker);
+  bool registerWorker(uint8_t serverID, uint8_t functionCode, MBSworkerView worker);
+  bool registerWorker(uint8_t serverID, uint8_t functionCode, MBSasyncWorker worker);
+
+  // registerWorker variants taking a lambda or function pointer directly. It is kept inside the server
+  // without allocating memory and without the std::function layer - see InlineFunction.h
+  template <typename F, typename std::enable_if<IsInlineCallable<F, ModbusMessage(ModbusMessage)>::value, int>::type = 0>
+  bool registerWorker(uint8_t serverID, uint8_t functionCode, F&& worker) {
+    return setWorker(serverID, functionCode, WorkerFunction(std::forward<F>(worker)), ViewWorkerFunction(), AsyncWorkerFunction(), nullptr);
+  }
+  template <typename F, typename std::enable_if<IsInlineCallable<F, ModbusMessage(const ModbusMessageView&)>::value, int>::type = 0>
+  bool registerWorker(uint8_t serverID, uint8_t functionCode, F&& worker) {
+    return setWorker(serverID, functionCode, WorkerFunction(), ViewWorkerFunction(std::forward<F>(worker)), AsyncWorkerFunction(), nullptr);
+  }
+  template <typename F, typename std::enable_if<IsInlineCallable<F, void(ModbusMessage, ModbusResponder)>::value, int>::type = 0>
+  bool registerWorker(uint8_t serverID, uint8_t functionCode, F&& worker) {
+    return setWorker(serverID, functionCode, WorkerFunction(), ViewWorkerFunction(), AsyncWorkerFunction(std::forward<F>(worker)), nullptr);
+  }
+
+  // registerBank: have the register bank serve all function codes it knows for serverID.
+  // These are READ_COIL, READ_DISCR_INPUT, READ_HOLD_REGISTER, READ_INPUT_REGISTER, WRITE_COIL,
+  // WRITE_HOLD_REGISTER, WRITE_MULT_COILS and WRITE_MULT_REGISTERS. Workers registered for these
+  // before are overwritten. The bank must exist as long as it is registered.
+  bool registerBank(uint8_t serverID, ModbusRegisterBank& bank);
   
-  // getWorker: if a worker function is registered, return its address, nullptr otherwise
-  MBSworker getWorker(uint8_t serverID, uint8_t functionCode);
+  // getWorker: if a worker function is registered, return a reference to it, an empty MBSworker otherwise.
+  // For an async worker, the MBSworker returned waits for its response. The reference is valid until
+  // the worker is registered anew or unregistered.
+  const MBSworker& getWorker(uint8_t serverID, uint8_t functionCode);
+
+  // setAsyncTimeout: wait at most timeout ms for an async worker's response where it is needed right
+  // away - in getWorker(), localRequest() and servers without a sink. Then SERVER_DEVICE_FAILURE is
+  // responded. Default is 20000.
+  void setAsyncTimeout(uint32_t timeout) { asyncTimeout = timeout; }
 
   // unregisterWorker; remove again all or part of the registered workers for a given server ID
   // Returns true if the worker was found and removed
@@ -77,11 +178,90 @@ protected:
   // Virtual function to prevent this class being instantiated
   virtual void isInstance() = 0;
 
-  std::map<uint8_t, std::map<uint8_t, MBSworker>> workerMap;      // map on serverID->functionCode->worker function
+  // Worker functions as held by the server
+  typedef InlineFunction<ModbusMessage(ModbusMessage)> WorkerFunction;
+  typedef InlineFunction<ModbusMessage(const ModbusMessageView&)> ViewWorkerFunction;
+  typedef InlineFunction<void(ModbusMessage, ModbusResponder)> AsyncWorkerFunction;
+
+  // A registered worker - only one of worker, viewWorker, asyncWorker and bank is set.
+  // It is shared by the Registry snapshots it is in and by the requests it is serving, so a worker
+  // replaced or unregistered finishes the requests it has got before it goes.
+  struct WorkerEntry : public std::enable_shared_from_this<WorkerEntry> {
+    WorkerFunction worker;        // Worker taking a copy of the request
+    ViewWorkerFunction viewWorker;  // Worker taking a view on the request
+    AsyncWorkerFunction asyncWorker;  // Worker answering through a ModbusResponder
+    ModbusRegisterBank *bank = nullptr;  // Register bank serving the request
+    MBSworker wrapper;            // Handed out by getWorker(): calls whichever of the above is set
+    // call: have the request processed. An async worker is waited for timeout ms at most
+    ModbusMessage call(const ModbusMessageView& request, uint32_t timeout);
+    // callAsync: hand the request to the async worker, with a responder for sink and tag
+    void callAsync(const ModbusMessageView& request, const std::shared_ptr<ModbusResponseSink>& sink, uint32_t tag, ModbusServer *server);
+  };
+
+  // setWorker: common part of the worker registrations
+  bool setWorker(uint8_t serverID, uint8_t functionCode, WorkerFunction&& worker, ViewWorkerFunction&& viewWorker,
+                 AsyncWorkerFunction&& asyncWorker, ModbusRegisterBank *bank);
+
+  // Dispatch: the workers for one registered server ID, indexed by function code.
+  // Function codes without a worker of their own point to the ANY_FUNCTION_CODE worker, if any.
+  struct Dispatch {
+    uint8_t serverID;             // Server ID the table was built for
+    WorkerEntry *fc[0x80];        // Worker per function code, nullptr if there is none
+  };
+
+  // Registry: the registered workers and the lookup tables compiled from them. A Registry is not
+  // changed any more once it is published - (un)registrations build a new one aside and swap it in.
+  // So requests are dispatched without locking, even while workers are registered.
+  struct Registry {
+    std::map<uint8_t, std::map<uint8_t, std::shared_ptr<WorkerEntry>>> workers;  // serverID->functionCode->worker
+    std::vector<Dispatch> dispatchTables;  // One Dispatch per server ID in workers
+    Dispatch *serverTable[256];   // Dispatch to use per server ID: its own, the ANY_SERVER one or nullptr
+    // build: compile workers into the lookup tables
+    void build();
+  };
+
+  // ReadGuard: held while looking into the current Registry. A Registry replaced is freed only
+  // when no ReadGuard is left that may have seen it.
+  class ReadGuard {
+  public:
+    explicit ReadGuard(std::atomic<uint32_t>& r) : RG_readers(r) { RG_readers++; }
+    ~ReadGuard() { RG_readers--; }
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+  protected:
+    std::atomic<uint32_t>& RG_readers;
+  };
+
+  // findWorker: look up the worker for a serverID/FC combination, nullptr if there is none.
+  // The caller must hold a ReadGuard as long as it uses the worker
+  WorkerEntry *findWorker(uint8_t serverID, uint8_t functionCode);
+
+  // holdWorker: same, but the worker is kept for the caller as long as it holds on to the result
+  std::shared_ptr<WorkerEntry> holdWorker(uint8_t serverID, uint8_t functionCode);
+
+  // publish: make next the current Registry. Called with registryLock held
+  void publish(Registry *next);
+
+  // callWorker: have the request processed by its worker. Only workers taking a ModbusMessage
+  // get a copy of the request. false, if no worker is registered for it
+  // Given a sink, an async worker is only started; response is NIL_RESPONSE then and the real
+  // response is delivered to the sink with tag later. Without a sink, the call waits for it.
+  bool callWorker(const ModbusMessageView& request, ModbusMessage& response,
+                  const std::shared_ptr<ModbusResponseSink>& sink = nullptr, uint32_t tag = 0);
+
+  // countError: count an error response sent
+  void countError();
+  friend class ModbusResponder;
+
+  std::atomic<Registry *> registry;  // Workers and lookup tables currently in use
+  std::atomic<uint32_t> readers; // Number of ReadGuards held
+  std::vector<Registry *> retired;  // Registries replaced, but possibly still looked into
   uint32_t messageCount;         // Number of Requests processed
   uint32_t errorCount;           // Number of errors responded
+  uint32_t asyncTimeout;         // Longest wait for an async worker's response in call()
   #if USE_MUTEX
   mutex m;                       // mutex to cover changes to messageCount and errorCount
+  mutex registryLock;            // Serializes the changes of registry
   #endif
 };
 
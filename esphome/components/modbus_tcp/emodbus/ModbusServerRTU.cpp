@@ -47,7 +47,7 @@ ModbusServerRTU::ModbusServerRTU(uint32_t timeout, RTScallback rts) :
   MSRserial(nullptr),
   MSRinterval(2000),     // will be calculated in begin()!
   MSRlastMicros(0),
-  MRTSrts(rts), 
+  MRTSrts(std::move(rts)), 
   MSRuseASCII(false),
   MSRskipLeadingZeroByte(false),
   listener(nullptr),
@@ -202,17 +202,14 @@ void ModbusServerRTU::serve(ModbusServerRTU *myServer) {
       } else {
         // No Broadcast. 
         // Do we have a callback function registered for it?
-        MBSworker callBack = myServer->getWorker(request[0], request[1]);
-        if (callBack) {
-          LOG_D("Callback found.\n");
+        // If so, get the user's response
+        if (myServer->callWorker(ModbusMessageView(request), m)) {
+          LOG_D("Callback called.\n");
           // Yes, we do. Count the message
           {
             LOCK_GUARD(cntLock, myServer->m);
             myServer->messageCount++;
           }
-          // Get the user's response
-          LOG_D("Callback called.\n");
-          m = callBack(request);
           HEXDUMP_V("Callback response", m.data(), m.size());
 
           // Process Response. Is it one of the predefined types?
@@ -265,8 +262,6 @@ void ModbusServerRTU::serve(ModbusServerRTU *myServer) {
         LOG_E("RTU receive: %02X - %s\n", (int)me, (const char *)me);
       }
     }
-    // Give scheduler room to breathe
-    delay(1);
   }
 }
 
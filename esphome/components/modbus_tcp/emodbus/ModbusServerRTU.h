@@ -80,7 +80,7 @@ protected:
   uint32_t MSRinterval;                  // Bus quiet time between messages
   unsigned long MSRlastMicros;           // microsecond time stamp of last bus activity
   int8_t MSRrtsPin;                      // GPIO number of the RS485 module's RE/DE line
-  RTScallback MRTSrts;                   // Callback to set the RTS line to HIGH/LOW
+  RTSfunction MRTSrts;                   // Callback to set the RTS line to HIGH/LOW
   bool MSRuseASCII;                      // true=ModbusASCII, false=ModbusRTU
   bool MSRskipLeadingZeroByte;           // true=first byte ignored if 0x00, false=all bytes accepted
   MSRlistener listener;                  // Broadcast listener 
@@ -11,6 +11,7 @@
 ModbusServerTCPasync::mb_client::mb_client(ModbusServerTCPasync* s, AsyncClient* c) :
   server(s),
   client(c),
+  sink(std::make_shared<OutboxSink>(this)),
   lastActiveTime(millis()),
   message(nullptr),
   error(SUCCESS),
@@ -22,6 +23,9 @@ ModbusServerTCPasync::mb_client::mb_client(ModbusServerTCPasync* s, AsyncClient*
 }
 
 ModbusServerTCPasync::mb_client::~mb_client() {
+  // Async workers still busy may hold on to the sink - no more responses from them
+  sink->close();
+
   // clear outbox, if data is left
   while (!outbox.empty()) {
     outbox.pop();
@@ -82,14 +86,14 @@ void ModbusServerTCPasync::mb_client::onData(uint8_t* data, size_t len) {
     }
 
     // 4. request complete, process
-    ModbusMessage request(messageLength - 6);  // create request without MBAP, with server ID
-    request.add(message->data() + 6, message->size() - 6);
+    ModbusMessageView request(message->data() + 6, message->size() - 6);  // request without MBAP, with server ID
+    uint32_t tag = ((*message)[0] << 24) | ((*message)[1] << 16) | ((*message)[2] << 8) | (*message)[3];
     ModbusMessage userData;
     if (server->isServerFor(request.getServerID())) {
-      MBSworker callback = server->getWorker(request.getServerID(), request.getFunctionCode());
-      if (callback) {
-        // request is well formed and is being served by user API
-        userData = callback(request);
+      // Is the request served by user API? An async worker will respond through the sink later
+      // and leaves a NIL response here.
+      if (server->callWorker(request, userData, sink, tag)) {
+        // Yes, the request is well formed and the worker has responded
         // Process Response
         // One of the predefined types?
         if (userData[0] == 0xFF && (userData[1] == 0xF0 || userData[1] == 0xF1)) {
@@ -100,7 +104,7 @@ void ModbusServerTCPasync::mb_client::onData(uint8_t* data, size_t len) {
             LOG_D("NIL response\n");
             break;
           case 0xF1: // ECHO
-            userData = request;
+            userData = request.toMessage();
             if (request.getFunctionCode() == WRITE_MULT_REGISTERS ||
                 request.getFunctionCode() == WRITE_MULT_COILS) {
               userData.resize(6);
@@ -124,6 +128,13 @@ void ModbusServerTCPasync::mb_client::onData(uint8_t* data, size_t len) {
     if (error != SUCCESS) {
       userData.setError(request.getServerID(), request.getFunctionCode(), error);
     }
+    // Nothing to send now?
+    if (userData.size() == 0) {
+      // No. Drop the request and go for the next
+      delete message;
+      message = nullptr;
+      continue;
+    }
     // Keep transaction id and protocol id
     message->resize(4);
     // Add new payload length
@@ -159,6 +170,15 @@ void ModbusServerTCPasync::mb_client::addResponseToOutbox(ModbusMessage* respons
   }
 }
 
+// send: frame the response like onData() does and put it into the outbox
+void ModbusServerTCPasync::mb_client::OutboxSink::send(uint32_t tag, const ModbusMessage& response) {
+  if (response.size() < 3) return;
+  ModbusMessage* m = new ModbusMessage(6 + response.size());
+  m->add(static_cast<uint16_t>(tag >> 16), static_cast<uint16_t>(tag & 0xFFFF), static_cast<uint16_t>(response.size()));
+  m->add(response.data(), response.size());
+  owner->addResponseToOutbox(m);
+}
+
 void ModbusServerTCPasync::mb_client::handleOutbox() {
   while (!outbox.empty()) {
     ModbusMessage* m = outbox.front();
@@ -44,8 +44,20 @@ class ModbusServerTCPasync : public ModbusServer {
     void onDisconnect();
     void addResponseToOutbox(ModbusMessage* response);
     void handleOutbox();
+
+    // OutboxSink: puts responses into the outbox - for async workers answering later.
+    // The tag is the MBAP transaction and protocol ID.
+    class OutboxSink : public ModbusResponseSink {
+     public:
+      explicit OutboxSink(mb_client* c) : owner(c) {}
+     protected:
+      void send(uint32_t tag, const ModbusMessage& response) override;
+      mb_client* owner;
+    };
+
     ModbusServerTCPasync* server;
     AsyncClient* client;
+    std::shared_ptr<ModbusResponseSink> sink;
     uint32_t lastActiveTime;
     ModbusMessage* message;
     Modbus::Error error;
@@ -15,6 +15,7 @@
 extern "C" {
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <lwip/sockets.h>
 }
 
 using std::vector;
@@ -53,11 +54,41 @@ protected:
   bool serverGoDown;
   mutex clientLock;
 
+  // ClientSink: writes the responses for one connection - those of the client task as well as
+  // those async workers give later from other tasks. The tag is the MBAP transaction and protocol ID.
+  class ClientSink : public ModbusResponseSink {
+  public:
+    explicit ClientSink(CT& c) : client(c) {
+      frame.reserve(260);   // MBAP header plus the largest possible response
+    }
+  protected:
+    void send(uint32_t tag, const ModbusMessage& response) override {
+      if (response.size() < 3) return;
+      // Transaction and protocol ID from the request, the new length, then the response
+      frame.clear();
+      frame.push_back((tag >> 24) & 0xFF);
+      frame.push_back((tag >> 16) & 0xFF);
+      frame.push_back((tag >> 8) & 0xFF);
+      frame.push_back(tag & 0xFF);
+      frame.push_back((response.size() >> 8) & 0xFF);
+      frame.push_back(response.size() & 0xFF);
+      frame.insert(frame.end(), response.begin(), response.end());
+      client.write(frame.data(), frame.size());
+      HEXDUMP_V("Response", frame.data(), frame.size());
+    }
+    CT& client;                        // The connection, held by the ClientData
+    ModbusMessage::MessageData frame;  // Kept for the connection, so sending a response needs no allocation
+  };
+
   struct ClientData {
     ClientData() : task(nullptr), client(0), timeout(0), parent(nullptr) {}
     ClientData(TaskHandle_t t, CT& c, uint32_t to, ModbusServerTCP<ST, CT> *p) : 
-      task(t), client(c), timeout(to), parent(p) {}
+      task(t), client(c), timeout(to), parent(p), sink(std::make_shared<ClientSink>(client)) {}
     ~ClientData() {
+      // Async workers still busy may hold on to the sink - no more writes to the client
+      if (sink) {
+        sink->close();
+      }
       if (client) {
         client.stop();
       }
@@ -70,6 +101,7 @@ protected:
     CT client;
     uint32_t timeout;
     ModbusServerTCP<ST, CT> *parent;
+    std::shared_ptr<ModbusResponseSink> sink;   // All responses to the client go out here
   };
   ClientData **clients;
 
@@ -82,6 +114,27 @@ protected:
   // receive: read data from TCP
   ModbusMessage receive(CT& client, uint32_t timeWait);
 
+  // waitForData: sleep until data arrives on the client connection or timeWait ms have passed.
+  // Clients exposing their socket (WiFiClient) are waited for with select(), all others are polled.
+  template <typename C>
+  static auto waitForData(C& client, uint32_t timeWait, int) -> decltype(client.fd(), void()) {
+    int fd = client.fd();
+    if (fd < 0) {
+      delay(1);
+      return;
+    }
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(fd, &readable);
+    struct timeval tv;
+    tv.tv_sec = timeWait / 1000;
+    tv.tv_usec = (timeWait % 1000) * 1000;
+    select(fd + 1, &readable, nullptr, nullptr, &tv);
+  }
+  template <typename C>
+  static void waitForData(C& client, uint32_t timeWait, long) { delay(1); }
+  static void waitForData(CT& client, uint32_t timeWait) { waitForData(client, timeWait, 0); }
+
   // accept: start a task to receive requests and respond to a given client
   bool accept(CT& client, uint32_t timeout, int coreID = -1);
 
@@ -257,12 +310,15 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
   // TaskHandle_t myTask = myData->task;
   ModbusServerTCP<ST, CT> *myParent = myData->parent;
   unsigned long myLastMessage = millis();
+  // Responses go out through the sink, that async workers get as well
+  const std::shared_ptr<ModbusResponseSink>& sink = myData->sink;
 
   LOG_D("Worker started, timeout=%d\n", myTimeOut);
 
   // loop forever, if timeout is 0, or until timeout was hit
   while (myClient.connected() && (!myTimeOut || (millis() - myLastMessage < myTimeOut))) {
     ModbusMessage response;               // Data buffer to hold prepared response
+    uint32_t tag = 0;                     // Transaction and protocol ID of the request
     // Get a request
     if (myClient.available()) {
       response.clear();
@@ -274,20 +330,20 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
           LOCK_GUARD(cntLock, myParent->m);
           myParent->messageCount++;
         }
-        // Extract request data
-        ModbusMessage request;
-        request.add(m.data() + 6, m.size() - 6);
+        // Request data follows the TCP header - look at it in place
+        ModbusMessageView request(m.data() + 6, m.size() - 6);
+        tag = (m[0] << 24) | (m[1] << 16) | (m[2] << 8) | m[3];
 
         // Protocol ID shall be 0x0000 - is it?
         if (m[2] == 0 && m[3] == 0) {
           // ServerID shall be at [6], FC at [7]. Check both
           if (myParent->isServerFor(request.getServerID())) {
             // Server is correct - in principle. Do we serve the FC?
-            MBSworker callBack = myParent->getWorker(request.getServerID(), request.getFunctionCode());
-            if (callBack) {
+            // If so, invoke the worker method to get a response. Async workers will respond
+            // through the sink later and leave a NIL response here.
+            ModbusMessage data;
+            if (myParent->callWorker(request, data, sink, tag)) {
               // Yes, we do.
-              // Invoke the worker method to get a response
-              ModbusMessage data = callBack(request);
               // Process Response
               // One of the predefined types?
               if (data[0] == 0xFF && (data[1] == 0xF0 || data[1] == 0xF1)) {
@@ -298,7 +354,7 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
                   LOG_D("NIL response\n");
                   break;
                 case 0xF1: // ECHO
-                  response = request;
+                  response = request.toMessage();
                   if (request.getFunctionCode() == WRITE_MULT_REGISTERS ||
                       request.getFunctionCode() == WRITE_MULT_COILS) {
                     response.resize(6);
@@ -326,17 +382,10 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
           response.setError(request.getServerID(), request.getFunctionCode(), TCP_HEAD_MISMATCH);
         }
       }
-      delay(1);
       // Do we have a response to send?
       if (response.size() >= 3) {
         // Yes. Do it now.
-        // Cut off length and request data, then update TCP header
-        m.resize(4);
-        m.add(static_cast<uint16_t>(response.size()));
-        // Append response
-        m.append(response);
-        myClient.write(m.data(), m.size());
-        HEXDUMP_V("Response", m.data(), m.size());
+        sink->deliver(tag, response);
         // count error responses
         if (response.getError() != SUCCESS) {
           LOCK_GUARD(cntLock, myParent->m);
@@ -345,8 +394,10 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
       }
       // We did something communicationally - rewind timeout timer
       myLastMessage = millis();
+    } else {
+      // Sleep until the next request comes in. Wake up now and then to check the timeout.
+      waitForData(myClient, 100);
     }
-    delay(1);
   }
 
   if (millis() - myLastMessage >= myTimeOut) {
@@ -357,6 +408,9 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
     LOG_D("Worker stopping due to client disconnect.\n");
   }
 
+  // Responses of async workers still busy are dropped from now on
+  sink->close();
+
   // Read away all that may still hang in the buffer
   while (myClient.read() != -1) {}
   // Now stop the client
@@ -398,7 +452,8 @@ ModbusMessage ModbusServerTCP<ST, CT>::receive(CT& client, uint32_t timeWait) {
         // Rewind EOT and timeout timers
         lastMillis = millis();
     } else {
-      delay(1); // Give scheduler room to breathe
+      // Sleep until the remainder arrives
+      waitForData(client, timeWait - (millis() - lastMillis));
     }
   }
   // Did we receive some data?
@@ -113,7 +113,7 @@ uint32_t RTUutils::calculateInterval(uint32_t baudRate) {
 }
 
 // send: send a message via Serial, watching interval times - including CRC!
-void RTUutils::send(Stream& serial, unsigned long& lastMicros, uint32_t interval, RTScallback rts, const uint8_t *data, uint16_t len, bool ASCIImode) {
+void RTUutils::send(Stream& serial, unsigned long& lastMicros, uint32_t interval, const RTSfunction& rts, const uint8_t *data, uint16_t len, bool ASCIImode) {
   // Clear serial buffers
   while (serial.available()) serial.read();
   
@@ -176,7 +176,7 @@ void RTUutils::send(Stream& serial, unsigned long& lastMicros, uint32_t interval
 }
 
 // send: send a message via Serial, watching interval times - including CRC!
-void RTUutils::send(Stream& serial, unsigned long& lastMicros, uint32_t interval, RTScallback rts, ModbusMessage raw, bool ASCIImode) {
+void RTUutils::send(Stream& serial, unsigned long& lastMicros, uint32_t interval, const RTSfunction& rts, ModbusMessage raw, bool ASCIImode) {
   send(serial, lastMicros, interval, rts, raw.data(), raw.size(), ASCIImode);
 }
 
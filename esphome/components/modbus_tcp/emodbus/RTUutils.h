@@ -9,8 +9,11 @@
 #include "Stream.h"
 #include "ModbusTypeDefs.h"
 #include <functional> 
+#include "InlineFunction.h"
 
 typedef std::function<void(bool level)> RTScallback;
+// RTS callback as held by clients and servers. Called without the std::function layer - see InlineFunction.h
+typedef InlineFunction<void(bool level)> RTSfunction;
 
 using namespace Modbus;  // NOLINT
 
@@ -68,8 +71,8 @@ protected:
   static ModbusMessage receive(uint8_t caller, Stream& serial, uint32_t timeout, unsigned long& lastMicros, uint32_t interval, bool ASCIImode, bool skipLeadingZeroBytes = false);
 
 // send: send a Modbus message in either format (ModbusMessage or data/len)
-  static void send(Stream& serial, unsigned long& lastMicros, uint32_t interval, RTScallback r, const uint8_t *data, uint16_t len, bool ASCIImode);
-  static void send(Stream& serial, unsigned long& lastMicros, uint32_t interval, RTScallback r, ModbusMessage raw, bool ASCIImode);
+  static void send(Stream& serial, unsigned long& lastMicros, uint32_t interval, const RTSfunction& r, const uint8_t *data, uint16_t len, bool ASCIImode);
+  static void send(Stream& serial, unsigned long& lastMicros, uint32_t interval, const RTSfunction& r, ModbusMessage raw, bool ASCIImode);
 };
 
 #endif
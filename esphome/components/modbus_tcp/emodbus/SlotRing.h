@@ -0,0 +1,105 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _SLOT_RING_H
+#define _SLOT_RING_H
+
+#include <atomic>
+#include <cstdint>
+
+// SlotRing: bounded lock-free queue of slot numbers.
+// Any number of tasks may push() and pop() concurrently without taking a lock. Each cell carries
+// a sequence number telling whether it is free for the next push() or holds data for the next pop();
+// the head and tail counters are only advanced by compare-and-swap.
+class SlotRing {
+public:
+  // Constructor: capacity is rounded up to the next power of 2
+  explicit SlotRing(uint16_t minCapacity) :
+    mask(0),
+    enqPos(0),
+    deqPos(0) {
+    uint32_t capacity = 1;
+    while (capacity < minCapacity) capacity <<= 1;
+    mask = capacity - 1;
+    cells = new Cell[capacity];
+    for (uint32_t i = 0; i < capacity; ++i) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~SlotRing() { delete[] cells; }
+
+  // push: append a slot number. Returns false if the ring is full.
+  bool push(uint16_t slot) {
+    uint32_t pos = enqPos.load(std::memory_order_relaxed);
+    while (1) {
+      Cell& cell = cells[pos & mask];
+      uint32_t seq = cell.seq.load(std::memory_order_acquire);
+      int32_t diff = static_cast<int32_t>(seq - pos);
+      // Cell free for this position?
+      if (diff == 0) {
+        // Yes. Try to claim it - another task may have been faster
+        if (enqPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.slot = slot;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // Cell still holds data from one round before: ring is full
+        return false;
+      } else {
+        // Another task pushed meanwhile - retry with the current position
+        pos = enqPos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // pop: take the oldest slot number. Returns false if the ring is empty.
+  bool pop(uint16_t& slot) {
+    uint32_t pos = deqPos.load(std::memory_order_relaxed);
+    while (1) {
+      Cell& cell = cells[pos & mask];
+      uint32_t seq = cell.seq.load(std::memory_order_acquire);
+      int32_t diff = static_cast<int32_t>(seq - (pos + 1));
+      // Cell holds data for this position?
+      if (diff == 0) {
+        // Yes. Try to claim it - another task may have been faster
+        if (deqPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          slot = cell.slot;
+          // Free the cell for the push one round later
+          cell.seq.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // Nothing pushed here yet: ring is empty
+        return false;
+      } else {
+        // Another task popped meanwhile - retry with the current position
+        pos = deqPos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // empty: true if there is nothing to pop() at the moment
+  bool empty() const {
+    return enqPos.load(std::memory_order_acquire) == deqPos.load(std::memory_order_acquire);
+  }
+
+protected:
+  struct Cell {
+    std::atomic<uint32_t> seq;    // Sequence number: position it may be pushed at or popped from next
+    uint16_t slot;                // Payload
+  };
+
+  // Prevent copy construction or assignment
+  SlotRing(SlotRing& other) = delete;
+  SlotRing& operator=(SlotRing& other) = delete;
+
+  Cell *cells;                    // Ring buffer, capacity is mask + 1
+  uint32_t mask;                  // Capacity - 1 to wrap positions into cells
+  std::atomic<uint32_t> enqPos;   // Next position to push to
+  std::atomic<uint32_t> deqPos;   // Next position to pop from
+};
+
+#endif  // INCLUDE GUARD
@@ -6,9 +6,10 @@
 #define _MODBUS_CLIENT_H
 
 #include <functional> 
-#include <map>
 #include "options.h"
 #include "ModbusMessage.h"
+#include "ModbusMessageView.h"
+#include "InlineFunction.h"
 
 #if HAS_FREERTOS
 extern "C" {
@@ -17,6 +18,7 @@ extern "C" {
 }
 #elif IS_LINUX
 #include <pthread.h>
+#include <condition_variable>   // NOLINT
 #endif
 
 #if USE_MUTEX
@@ -28,20 +30,80 @@ using std::lock_guard;
 typedef std::function<void(ModbusMessage msg, uint32_t token)> MBOnData;
 typedef std::function<void(Modbus::Error errorCode, uint32_t token)> MBOnError;
 typedef std::function<void(ModbusMessage msg, uint32_t token)> MBOnResponse;
+// Handler variants getting a view on the response instead of a copy. The view is valid during the call only.
+typedef std::function<void(const ModbusMessageView& msg, uint32_t token)> MBOnDataView;
+typedef std::function<void(const ModbusMessageView& msg, uint32_t token)> MBOnResponseView;
+// MBOnDone: completion handler for a single request. It gets the response - data or error alike.
+// It is kept in the client's queue entry of the request, without allocating memory. There is room
+// for 8 pointers - e.g. a lambda capturing this, a few values and a ModbusResponder, or a std::function.
+typedef InlineFunction<void(ModbusMessage response), 8 * sizeof(void *)> MBOnDone;
 
 class ModbusClient {
 public:
   bool onDataHandler(MBOnData handler);   // Accept onData handler 
   bool onErrorHandler(MBOnError handler); // Accept onError handler 
   bool onResponseHandler(MBOnResponse handler); // Accept onResponse handler 
+  bool onDataHandler(MBOnDataView handler);         // Accept onData handler taking a view
+  bool onResponseHandler(MBOnResponseView handler); // Accept onResponse handler taking a view
+
+  // Handler variants taking a lambda or function pointer directly. It is kept inside the client
+  // without allocating memory and without the std::function layer - see InlineFunction.h
+  template <typename F, typename std::enable_if<IsInlineCallable<F, void(ModbusMessage, uint32_t)>::value, int>::type = 0>
+  bool onDataHandler(F&& handler) {
+    if (!claimOnData()) return false;
+    onData = std::forward<F>(handler);
+    onDataV = nullptr;
+    return true;
+  }
+  template <typename F, typename std::enable_if<IsInlineCallable<F, void(const ModbusMessageView&, uint32_t)>::value, int>::type = 0>
+  bool onDataHandler(F&& handler) {
+    if (!claimOnData()) return false;
+    onDataV = std::forward<F>(handler);
+    onData = nullptr;
+    return true;
+  }
+  template <typename F, typename std::enable_if<IsInlineCallable<F, void(Modbus::Error, uint32_t)>::value, int>::type = 0>
+  bool onErrorHandler(F&& handler) {
+    if (!claimOnError()) return false;
+    onError = std::forward<F>(handler);
+    return true;
+  }
+  template <typename F, typename std::enable_if<IsInlineCallable<F, void(ModbusMessage, uint32_t)>::value, int>::type = 0>
+  bool onResponseHandler(F&& handler) {
+    if (!claimOnResponse()) return false;
+    onResponse = std::forward<F>(handler);
+    onResponseV = nullptr;
+    return true;
+  }
+  template <typename F, typename std::enable_if<IsInlineCallable<F, void(const ModbusMessageView&, uint32_t)>::value, int>::type = 0>
+  bool onResponseHandler(F&& handler) {
+    if (!claimOnResponse()) return false;
+    onResponseV = std::forward<F>(handler);
+    onResponse = nullptr;
+    return true;
+  }
+
   uint32_t getMessageCount();             // Informative: return number of messages created
   uint32_t getErrorCount();              // Informative: return number of errors received
   void resetCounts();                    // Set both message and error counts to zero
   inline Error addRequest(const ModbusMessage& m, uint32_t token) { return addRequestM(m, token); }
-  inline ModbusMessage syncRequest(const ModbusMessage& m, uint32_t token) { return syncRequestM(m, token); }
+  inline ModbusMessage syncRequest(const ModbusMessage& m, uint32_t token) { return syncRequestM(m, token, 0); }
+  // syncRequest variant with a timeout in ms for this call only
+  inline ModbusMessage syncRequest(const ModbusMessage& m, uint32_t token, uint32_t timeout) { return syncRequestM(m, token, timeout); }
+  // Variants for a message not needed afterwards: it is moved into the queue without a copy
+  inline Error addRequest(ModbusMessage&& m, uint32_t token) { return addRequestM(std::move(m), token); }
+  inline ModbusMessage syncRequest(ModbusMessage&& m, uint32_t token) { return syncRequestM(std::move(m), token, 0); }
+  inline ModbusMessage syncRequest(ModbusMessage&& m, uint32_t token, uint32_t timeout) { return syncRequestM(std::move(m), token, timeout); }
+  // addRequest variant with a completion handler for this request only. It is called once with the
+  // response, instead of the onData/onError/onResponse handlers, from the task that completes the
+  // request. onDone is taken over only if the request was queued - else it is left to the caller,
+  // see the return code then.
+  Error addRequest(ModbusMessage&& m, uint32_t token, MBOnDone&& onDone);
+  // Set time in ms a syncRequest will wait for its response (default 60000)
+  void setSyncTimeout(uint32_t timeout);
 
   // Template function to generate syncRequest functions as long as there is a 
-  // matching ModbusMessage::setMessage() call
+  // matching ModbusMessage::setMessage() call. The request is built once and moved into the queue.
   template <typename... Args>
   ModbusMessage syncRequest(uint32_t token, Args&&... args) {
     Error rc = SUCCESS;
@@ -51,7 +113,7 @@ public:
 
     // Add it to the queue and wait for a response, if valid
     if (rc == SUCCESS) {
-      return syncRequestM(m, token);
+      return syncRequestM(std::move(m), token, 0);
     } 
     // Else return the error as a message
     return buildErrorMsg(rc, std::forward<Args>(args) ...);
@@ -66,7 +128,7 @@ public:
   }
 
   // Template function to generate addRequest functions as long as there is a 
-  // matching ModbusMessage::setMessage() call
+  // matching ModbusMessage::setMessage() call. The request is built once and moved into the queue.
   template <typename... Args>
   Error addRequest(uint32_t token, Args&&... args) {
     Error rc = SUCCESS;        // Return value
@@ -77,7 +139,7 @@ public:
 
     // Add it to the queue, if valid
     if (rc == SUCCESS) {
-      return addRequestM(m, token);
+      return addRequestM(std::move(m), token);
     }
     // Else return the error
     return rc;
@@ -87,15 +149,58 @@ protected:
   ModbusClient();             // Default constructor
   ~ModbusClient();            // Destructor
   virtual void isInstance() = 0;   // Make class abstract
-  ModbusMessage waitSync(uint8_t serverID, uint8_t functionCode, uint32_t token); // wait for syncRequest response to arrive
+
+  // SyncSlot: a syncRequest waiting for its response. Created on the caller's stack before the
+  // request is queued; it is linked into the client's list of waiting requests while it exists.
+  // The worker puts the response into it and wakes up the caller right away.
+  // The queue entry refers to the slot by its id, not its address: a request may outlive a caller
+  // that gave up, and a later slot on the same stack address must not take the late response.
+  class SyncSlot {
+  public:
+    SyncSlot(ModbusClient *c, uint32_t t);
+    ~SyncSlot();
+    uint32_t token;                // Token of the request
+    uint32_t id;                   // Unique per client, never 0
+    ModbusMessage response;        // Response, once done
+    bool done;                     // Response has been delivered
+    SyncSlot *next;                // Next in the client's list
+  protected:
+    ModbusClient *client;          // Client the slot is registered with
+#if HAS_FREERTOS
+    TaskHandle_t waiter;           // Task to notify
+#elif IS_LINUX
+    std::condition_variable cv;    // Signalled on delivery
+#endif
+    SyncSlot(SyncSlot& other) = delete;
+    SyncSlot& operator=(SyncSlot& other) = delete;
+    friend class ModbusClient;
+  };
+  // waitSync: wait for the response to arrive in the slot, timeout in ms (0: default)
+  ModbusMessage waitSync(SyncSlot& slot, uint8_t serverID, uint8_t functionCode, uint32_t timeout);
+  // deliverSync: hand a response to a waiting syncRequest. false, if it is not waiting any more
+  bool deliverSync(uint32_t syncID, const ModbusMessage& response);
+  // complete: hand a response to the syncRequest waiting in slot syncID or to the completion handler, which
+  // is emptied then. Must be called without holding any lock the handler may need.
+  void complete(uint32_t syncID, MBOnDone& onDone, const ModbusMessage& response);
+  // dropSync: the request was dropped from the queue - complete it with a TIMEOUT error right away
+  void dropSync(uint32_t syncID, MBOnDone& onDone, uint8_t serverID, uint8_t functionCode);
   // Virtual addRequest variant needed internally. All others done by template!
+  // msg is passed by value: implementations move it on into their queue instead of copying it.
   virtual Error addRequestM(ModbusMessage msg, uint32_t token) = 0;
-  // Virtual syncRequest variant following the same pattern
-  virtual ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token) = 0;
+  // Virtual syncRequest variant following the same pattern. timeout in ms, 0 for the default
+  virtual ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token, uint32_t timeout) = 0;
+  // Virtual addRequest variant queueing the request with a completion handler. onDone is moved into
+  // the queue entry only if the request was queued
+  virtual Error addRequestD(ModbusMessage msg, uint32_t token, MBOnDone&& onDone) = 0;
   // Prevent copy construction or assignment
   ModbusClient(ModbusClient& other) = delete;
   ModbusClient& operator=(ModbusClient& other) = delete;
 
+  // claimOn...: check if a handler of that kind may be registered now
+  bool claimOnData();
+  bool claimOnError();
+  bool claimOnResponse();
+
   uint32_t messageCount;           // Number of requests generated. Used for transactionID in TCPhead
   uint32_t errorCount;             // Number of errors received
 #if HAS_FREERTOS
@@ -103,13 +208,17 @@ protected:
 #elif IS_LINUX
   pthread_t worker;
 #endif
-  MBOnData onData;                 // Data response handler
-  MBOnError onError;               // Error response handler
-  MBOnResponse onResponse;         // Uniform response handler
+  InlineFunction<void(ModbusMessage, uint32_t)> onData;                // Data response handler
+  InlineFunction<void(Modbus::Error, uint32_t)> onError;               // Error response handler
+  InlineFunction<void(ModbusMessage, uint32_t)> onResponse;            // Uniform response handler
+  InlineFunction<void(const ModbusMessageView&, uint32_t)> onDataV;      // Data response handler taking a view
+  InlineFunction<void(const ModbusMessageView&, uint32_t)> onResponseV;  // Uniform response handler taking a view
   static uint16_t instanceCounter; // Number of ModbusClients created
-  std::map<uint32_t, ModbusMessage> syncResponse; // Map to hold response messages on synchronous requests
+  SyncSlot *syncSlots;             // List of syncRequests waiting for a response
+  uint32_t syncSequence;           // Last SyncSlot id handed out
+  uint32_t syncTimeout;            // Default time in ms to wait for a syncRequest response
 #if USE_MUTEX
-  std::mutex syncRespM;            // Mutex protecting syncResponse map against race conditions
+  std::mutex syncRespM;            // Mutex protecting the syncSlots list and syncSequence
   std::mutex countAccessM;         // Mutex protecting access to the message and error counts
 #endif
 
@@ -3,6 +3,7 @@
 //               MIT license - see license.md for details
 // =================================================================================================
 #include "ModbusClientTCP.h"
+#include <cstring>
 
 #if HAS_FREERTOS || IS_LINUX
 
@@ -13,24 +14,68 @@
 // Constructor takes reference to Client (EthernetClient or WiFiClient)
 ModbusClientTCP::ModbusClientTCP(Client& client, uint16_t queueLimit) :
   ModbusClient(),
+  MT_slots(queueLimit),
+  MT_freeSlots(queueLimit),
+  MT_requests(queueLimit),
+  MT_pending(0),
+  MT_clearWaiting(false),
+  MT_transactionID(0),
   MT_client(client),
+  MT_current(&client),
   MT_lastTarget(IPAddress(0, 0, 0, 0), 0, DEFAULTTIMEOUT, TARGETHOSTINTERVAL),
   MT_target(IPAddress(0, 0, 0, 0), 0, DEFAULTTIMEOUT, TARGETHOSTINTERVAL),
   MT_defaultTimeout(DEFAULTTIMEOUT),
   MT_defaultInterval(TARGETHOSTINTERVAL),
-  MT_qLimit(queueLimit)
-  { }
+  MT_qLimit(queueLimit),
+  MT_maxInflight(1),
+  MT_rxLen(0),
+  MT_active(0),
+  MT_idleTimeout(0),
+  MT_affinity(0),
+  MT_batchCount(0),
+  MT_coalesce(false) {
+  // The worker's list of queued requests shall never need to grow
+  MT_waiting.reserve(MT_qLimit);
+  // The Client given is the first connection in the pool
+  MT_pool.push_back(PoolEntry(&client));
+  // Initially all slots are free
+  for (uint16_t i = 0; i < MT_qLimit; ++i) {
+    MT_freeSlots.push(i);
+  }
+}
 
 // Alternative Constructor takes reference to Client (EthernetClient or WiFiClient) plus initial target host
 ModbusClientTCP::ModbusClientTCP(Client& client, IPAddress host, uint16_t port, uint16_t queueLimit) :
   ModbusClient(),
+  MT_slots(queueLimit),
+  MT_freeSlots(queueLimit),
+  MT_requests(queueLimit),
+  MT_pending(0),
+  MT_clearWaiting(false),
+  MT_transactionID(0),
   MT_client(client),
+  MT_current(&client),
   MT_lastTarget(IPAddress(0, 0, 0, 0), 0, DEFAULTTIMEOUT, TARGETHOSTINTERVAL),
   MT_target(host, port, DEFAULTTIMEOUT, TARGETHOSTINTERVAL),
   MT_defaultTimeout(DEFAULTTIMEOUT),
   MT_defaultInterval(TARGETHOSTINTERVAL),
-  MT_qLimit(queueLimit)
-  { }
+  MT_qLimit(queueLimit),
+  MT_maxInflight(1),
+  MT_rxLen(0),
+  MT_active(0),
+  MT_idleTimeout(0),
+  MT_affinity(0),
+  MT_batchCount(0),
+  MT_coalesce(false) {
+  // The worker's list of queued requests shall never need to grow
+  MT_waiting.reserve(MT_qLimit);
+  // The Client given is the first connection in the pool
+  MT_pool.push_back(PoolEntry(&client));
+  // Initially all slots are free
+  for (uint16_t i = 0; i < MT_qLimit; ++i) {
+    MT_freeSlots.push(i);
+  }
+}
 
 // Destructor: clean up queue, task etc.
 ModbusClientTCP::~ModbusClientTCP() {
@@ -40,25 +85,31 @@ ModbusClientTCP::~ModbusClientTCP() {
 // end: stop worker task
 void ModbusClientTCP::end() {
   // Clean up queue
-  {
-    // Safely lock access
-    LOCK_GUARD(lockGuard, qLock);
-    // Get all queue entries one by one
-    while (!requests.empty()) {
-      requests.pop();
-    }
-  }
+  clearQueue();
   LOG_D("TCP client worker killed.\n");
   // Kill task
   if (worker) {
 #if IS_LINUX
     pthread_cancel(worker);
+    // Wait for it to be gone - it may still be busy until it gets to a cancellation point
+    pthread_join(worker, NULL);
     worker = NULL;
 #else
     vTaskDelete(worker);
     worker = nullptr;
 #endif
   }
+  // The worker is gone - nobody will wait for responses to the requests in flight any more
+  for (RequestEntry *request : inflight) {
+    releaseSlot(request);
+  }
+  inflight.clear();
+  for (RequestEntry *request : MT_waiting) {
+    releaseSlot(request);
+    MT_pending--;
+  }
+  MT_waiting.clear();
+  MT_clearWaiting = false;
 }
 
 // begin: start worker task
@@ -98,6 +149,38 @@ void ModbusClientTCP::setTimeout(uint32_t timeout, uint32_t interval) {
   MT_defaultInterval = interval;
 }
 
+// Set number of requests to send without waiting for their responses
+void ModbusClientTCP::setMaxInflightRequests(uint8_t maxInflight) {
+  MT_maxInflight = maxInflight ? maxInflight : 1;
+}
+
+// Group queued requests by target
+void ModbusClientTCP::setTargetAffinity(uint8_t maxBatch) {
+  MT_affinity = maxBatch;
+}
+
+// Let identical reads share a request
+void ModbusClientTCP::setReadCoalescing(bool onOff) {
+  MT_coalesce = onOff;
+}
+
+// Add a Client to the connection pool
+bool ModbusClientTCP::addClient(Client& client) {
+  // The pool is the worker's - do not touch it while it is running
+  if (worker) {
+    LOG_E("Clients must be added before begin()!\n");
+    return false;
+  }
+  MT_pool.push_back(PoolEntry(&client));
+  LOG_D("Connection pool size %d\n", (uint32_t)MT_pool.size());
+  return true;
+}
+
+// Set time in ms after which unused pool connections are closed
+void ModbusClientTCP::setIdleTimeout(uint32_t timeout) {
+  MT_idleTimeout = timeout;
+}
+
 // Switch target host (if necessary)
 // Return true, if host/port is different from last host/port used
 bool ModbusClientTCP::setTarget(IPAddress host, uint16_t port, uint32_t timeout, uint32_t interval) {
@@ -112,14 +195,127 @@ bool ModbusClientTCP::setTarget(IPAddress host, uint16_t port, uint32_t timeout,
 
 // Return number of unprocessed requests in queue
 uint32_t ModbusClientTCP::pendingRequests() {
-  return requests.size();
+  return MT_pending;
 }
 
 // Remove all pending request from queue
 void ModbusClientTCP::clearQueue() {
-  std::queue<RequestEntry *> empty;
-  LOCK_GUARD(lockGuard, qLock);
-  std::swap(requests, empty);
+  uint16_t slot;
+  // The ring may be popped from any task, so we can empty it right here
+  while (MT_requests.pop(slot)) {
+    releaseSlot(&MT_slots[slot]);
+    MT_pending--;
+  }
+  // Requests the worker has taken over already have to be dropped by the worker itself
+  MT_clearWaiting = true;
+  MT_wakeup.notify();
+}
+
+// nextRequest: choose the request to be sent next. nullptr if there is none
+ModbusClientTCP::RequestEntry *ModbusClientTCP::nextRequest() {
+  uint16_t slot;
+  // Has clearQueue() been called?
+  if (MT_clearWaiting.exchange(false)) {
+    // Yes. Drop all we have taken over
+    for (RequestEntry *request : MT_waiting) {
+      releaseSlot(request);
+      MT_pending--;
+    }
+    MT_waiting.clear();
+  }
+  // Take over all newly queued requests
+  while (MT_requests.pop(slot)) {
+    // An identical read on its way already will answer this one as well
+    if (MT_coalesce && coalesce(&MT_slots[slot])) {
+      MT_pending--;
+      continue;
+    }
+    MT_waiting.push_back(&MT_slots[slot]);
+  }
+  if (MT_waiting.empty()) return nullptr;
+
+  // Strict FIFO order?
+  if (!MT_affinity) return MT_waiting.front();
+
+  // No. Find the oldest requests for the current target and for any other
+  RequestEntry *same = nullptr;
+  RequestEntry *other = nullptr;
+  for (RequestEntry *request : MT_waiting) {
+    if (MT_lastTarget == request->target) {
+      if (!same) same = request;
+    } else {
+      if (!other) other = request;
+    }
+    if (same && other) break;
+  }
+  // Stay with the current target - unless it had its share and another one is waiting
+  if (same && (!other || MT_batchCount < MT_affinity)) return same;
+  return other;
+}
+
+// coalesce: attach a newly queued read to an identical one waiting or in flight
+bool ModbusClientTCP::coalesce(RequestEntry *request) {
+  uint8_t functionCode = request->getFunctionCode();
+  if (functionCode < READ_COIL || functionCode > READ_INPUT_REGISTER) return false;
+
+  // Look for it from the newest request on: waiting ones first, then those in flight.
+  // A request for the target that is not a read ends the search, it may change the data.
+  RequestEntry *leader = nullptr;
+  for (uint8_t list = 0; list < 2 && !leader; ++list) {
+    std::vector<RequestEntry *>& requests = list ? inflight : MT_waiting;
+    auto it = requests.rbegin();
+    for (; it != requests.rend(); ++it) {
+      RequestEntry *r = *it;
+      if (r->target != request->target) continue;
+      if (r->frame.size() == request->frame.size()
+       && memcmp(r->frame.data() + MT_HEADROOM, request->frame.data() + MT_HEADROOM, r->frame.size() - MT_HEADROOM) == 0) {
+        leader = r;
+        break;
+      }
+      uint8_t fc = r->getFunctionCode();
+      if (fc < READ_COIL || fc > READ_INPUT_REGISTER) return false;
+    }
+  }
+  if (!leader) return false;
+
+  // Found one. Append the request to its followers
+  while (leader->follower) leader = leader->follower;
+  leader->follower = request;
+  LOG_D("Request coalesced.\n");
+  return true;
+}
+
+// takeRequest: remove the request chosen by nextRequest() from the queue
+void ModbusClientTCP::takeRequest(RequestEntry *request) {
+  // Count the requests sent in a row to the same target
+  if (MT_lastTarget != request->target) {
+    MT_batchCount = 0;
+  }
+  MT_batchCount++;
+  // Keep the order of the remaining ones
+  for (auto it = MT_waiting.begin(); it != MT_waiting.end(); ++it) {
+    if (*it == request) {
+      MT_waiting.erase(it);
+      break;
+    }
+  }
+  MT_pending--;
+}
+
+// releaseSlot: return the slot of a finished request to the pool
+void ModbusClientTCP::releaseSlot(RequestEntry *request) {
+  // Still someone waiting? Then the request is dropped without a response
+  if (request->syncID || request->onDone) {
+    dropSync(request->syncID, request->onDone, request->getServerID(), request->getFunctionCode());
+    request->syncID = 0;
+  }
+  // Keep the frame buffer - the next request will likely fit in without allocation
+  request->frame.clear();
+  RequestEntry *follower = request->follower;
+  request->follower = nullptr;
+  MT_freeSlots.push(request - MT_slots.data());
+  // Reads attached to it are done as well
+  if (follower) releaseSlot(follower);
 }
 
 // Base addRequest for preformatted ModbusMessage and last set target
@@ -129,7 +325,7 @@ Error ModbusClientTCP::addRequestM(ModbusMessage msg, uint32_t token) {
   // Add it to the queue, if valid
   if (msg) {
     // Queue add successful?
-    if (!addToQueue(token, msg, MT_target)) {
+    if (!addToQueue(token, std::move(msg), MT_target)) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -148,7 +344,7 @@ Error ModbusClientTCP::addRequestMT(ModbusMessage msg, uint32_t token, IPAddress
     // Set up adhoc target 
     TargetHost adhocTarget(targetHost, targetPort, MT_defaultTimeout, MT_defaultInterval);
     // Queue add successful?
-    if (!addToQueue(token, msg, adhocTarget, true)) {
+    if (!addToQueue(token, std::move(msg), adhocTarget)) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -158,18 +354,45 @@ Error ModbusClientTCP::addRequestMT(ModbusMessage msg, uint32_t token, IPAddress
   return rc;
 }
 
+// TCP addRequest for preformatted ModbusMessage and adhoc target, with a completion handler
+Error ModbusClientTCP::addRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort, MBOnDone&& onDone) {
+  if (!msg) return EMPTY_MESSAGE;
+  // Set up adhoc target 
+  TargetHost adhocTarget(targetHost, targetPort, MT_defaultTimeout, MT_defaultInterval);
+  // Queue add successful?
+  if (!addToQueue(token, std::move(msg), adhocTarget, 0, std::move(onDone))) {
+    // No. onDone is left to the caller
+    return REQUEST_QUEUE_FULL;
+  }
+  return SUCCESS;
+}
+
+// addRequestD: queue the request for the last set target with a completion handler
+Error ModbusClientTCP::addRequestD(ModbusMessage msg, uint32_t token, MBOnDone&& onDone) {
+  if (!msg) return EMPTY_MESSAGE;
+  if (!addToQueue(token, std::move(msg), MT_target, 0, std::move(onDone))) {
+    return REQUEST_QUEUE_FULL;
+  }
+  return SUCCESS;
+}
+
 // Base syncRequest follows the same pattern
-ModbusMessage ModbusClientTCP::syncRequestM(ModbusMessage msg, uint32_t token) {
+ModbusMessage ModbusClientTCP::syncRequestM(ModbusMessage msg, uint32_t token, uint32_t timeout) {
   ModbusMessage response;
 
   if (msg) {
+    // msg is moved into the queue - keep what is needed for error responses
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    // Set up the slot to receive the response before the worker can see the request
+    SyncSlot slot(this, token);
     // Queue add successful?
-    if (!addToQueue(token, msg, MT_target, true)) {
+    if (!addToQueue(token, std::move(msg), MT_target, slot.id)) {
       // No. Return error after deleting the allocated request.
-      response.setError(msg.getServerID(), msg.getFunctionCode(), REQUEST_QUEUE_FULL);
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
     } else {
       // Request is queued - wait for the result.
-      response = waitSync(msg.getServerID(), msg.getFunctionCode(), token);
+      response = waitSync(slot, serverID, functionCode, timeout);
     }
   } else {
     response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
@@ -178,19 +401,24 @@ ModbusMessage ModbusClientTCP::syncRequestM(ModbusMessage msg, uint32_t token) {
 }
 
 // TCP syncRequest with adhoc target parameters
-ModbusMessage ModbusClientTCP::syncRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort) {
+ModbusMessage ModbusClientTCP::syncRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort, uint32_t timeout) {
   ModbusMessage response;
 
   if (msg) {
     // Set up adhoc target 
     TargetHost adhocTarget(targetHost, targetPort, MT_defaultTimeout, MT_defaultInterval);
+    // msg is moved into the queue - keep what is needed for error responses
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    // Set up the slot to receive the response before the worker can see the request
+    SyncSlot slot(this, token);
     // Queue add successful?
-    if (!addToQueue(token, msg, adhocTarget, true)) {
+    if (!addToQueue(token, std::move(msg), adhocTarget, slot.id)) {
       // No. Return error after deleting the allocated request.
-      response.setError(msg.getServerID(), msg.getFunctionCode(), REQUEST_QUEUE_FULL);
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
     } else {
       // Request is queued - wait for the result.
-      response = waitSync(msg.getServerID(), msg.getFunctionCode(), token);
+      response = waitSync(slot, serverID, functionCode, timeout);
     }
   } else {
     response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
@@ -199,21 +427,33 @@ ModbusMessage ModbusClientTCP::syncRequestMT(ModbusMessage msg, uint32_t token,
 }
 
 // addToQueue: send freshly created request to queue
-bool ModbusClientTCP::addToQueue(uint32_t token, ModbusMessage request, TargetHost target, bool syncReq) {
+bool ModbusClientTCP::addToQueue(uint32_t token, ModbusMessage&& request, TargetHost target, uint32_t syncID, MBOnDone&& onDone) {
   bool rc = false;
+  uint16_t slot;
   // Did we get one?
-  LOG_D("Queue size: %d\n", (uint32_t)requests.size());
+  LOG_D("Queue size: %d\n", (uint32_t)MT_pending);
   HEXDUMP_D("Enqueue", request.data(), request.size());
   if (request) {
-    if (requests.size()<MT_qLimit) {
-      RequestEntry *re = new RequestEntry(token, request, target, syncReq);
-      // inject proper transactionID
-      re->head.transactionID = messageCount++;
-      re->head.len = request.size();
-      // Safely lock queue and push request to queue
+    // Get a free slot - if there is none, the queue is full
+    if (MT_freeSlots.pop(slot)) {
+      RequestEntry& re = MT_slots[slot];
+      re.token = token;
+      re.head.len = request.size();
+      // Copy the request behind the room for the MBAP header, that is filled in when it is sent.
+      // The slot's buffer is reused, so this needs no allocation once it has grown to size.
+      re.frame.resize(MT_HEADROOM);
+      re.frame.insert(re.frame.end(), request.begin(), request.end());
+      re.target = target;
+      re.syncID = syncID;
+      re.onDone = std::move(onDone);
+      messageCount++;
+      // Count it before the worker can see it, so pendingRequests() will never wrap below 0.
+      MT_pending++;
+      // Hand it over to the worker. There is room for every slot in the ring, so this cannot fail.
+      MT_requests.push(slot);
       rc = true;
-      LOCK_GUARD(lockGuard, qLock);
-      requests.push(re);
+      // Wake up the worker, if it is sleeping
+      MT_wakeup.notify();
     }
   }
 
@@ -223,204 +463,329 @@ bool ModbusClientTCP::addToQueue(uint32_t token, ModbusMessage request, TargetHo
 // handleConnection: worker task
 // This was created in begin() to handle the queue entries
 void ModbusClientTCP::handleConnection(ModbusClientTCP *instance) {
-  bool doNotPop;
-  unsigned long lastRequest = millis();
+  // Let addToQueue() wake us up
+  instance->MT_wakeup.attach();
 
   // Loop forever - or until task is killed
   while (1) {
-    // Do we have a request in queue?
-    if (!instance->requests.empty()) {
+    bool busy = false;        // Set if anything was sent or received in this pass
+
+    // Send requests as long as there are some in queue and the pipeline has room for them
+    while (instance->inflight.size() < instance->MT_maxInflight) {
+      // Do we have a request in queue?
+      RequestEntry *request = instance->nextRequest();
+      if (!request) break;
       // Yes. pull it.
-      RequestEntry *request = instance->requests.front();
-      doNotPop = false;
       LOG_D("Got request from queue\n");
 
-      // Do we have a connection open?
-      if (instance->MT_client.connected()) {
-        // Empty the RX buffer in case there is a stray response left
-        while (instance->MT_client.read() != -1) {}
+      // A request to another target has to wait until all responses from the current one are in
+      if (!instance->inflight.empty() && instance->MT_lastTarget != request->target) break;
+
+      // Nothing in flight?
+      if (instance->inflight.empty()) {
         // check if lastHost/lastPort!=host/port off the queued request
         if (instance->MT_lastTarget != request->target) {
-          // It is different. Disconnect it.
-          instance->MT_client.stop();
-          LOG_D("Target different, disconnect\n");
-          delay(1);  // Give scheduler room to breathe
-        } else {
-          // it is the same host/port.
+          // It is different. Switch to the pool connection for it
+          instance->selectConnection(request->target);
+        }
+        // Do we have a connection open?
+        if (instance->MT_current->connected()) {
+          // Empty the RX buffer in case there is a stray response left
+          while (instance->MT_current->read() != -1) {}
+          instance->MT_rxLen = 0;
           // Give it some slack to get ready again
-          while (millis() - lastRequest < request->target.interval) { delay(1); }
+          while (millis() - instance->MT_pool[instance->MT_active].lastUsed < request->target.interval) { delay(1); }
         }
       }
       // if client is disconnected (we will have to switch hosts)
-      if (!instance->MT_client.connected()) {
-        // Serial.println("Client reconnecting");
+      if (!instance->MT_current->connected()) {
         // It is disconnected. connect to host/port from queue
-        instance->MT_client.connect(request->target.host, request->target.port);
+        instance->MT_current->connect(request->target.host, request->target.port);
+        instance->MT_pool[instance->MT_active].target = request->target;
+        instance->MT_rxLen = 0;
         LOG_D("Target connect (%d.%d.%d.%d:%d).\n", request->target.host[0], request->target.host[1], request->target.host[2], request->target.host[3], request->target.port);
 
         delay(1);  // Give scheduler room to breathe
       }
-      ModbusMessage response;
+
+      // The request is ours now - take it off the queue
+      instance->takeRequest(request);
+      LOG_D("Request popped from queue.\n");
+      busy = true;
+
       // Are we connected (again)?
-      if (instance->MT_client.connected()) {
+      if (instance->MT_current->connected()) {
         LOG_D("Is connected. Send request.\n");
-        // Yes. Send the request via IP
+        // Yes. inject proper transactionID
+        request->head.transactionID = instance->MT_transactionID++;
+        // Send the request via IP and wait for its response in the pipeline
         instance->send(request);
-
-        // Get the response - if any
-        response = instance->receive(request);
-
-        // Did we get a normal response?
-        if (response.getError()==SUCCESS) {
-          LOG_D("Data response.\n");
-          // Yes. Is it a synchronous request?
-          if (request->isSyncRequest) {
-            // Yes. Put the response into the response map
-            {
-              LOCK_GUARD(sL, instance->syncRespM);
-              instance->syncResponse[request->token] = response;
-            }
-          // No, async request. Do we have an onResponse handler?
-          } else if (instance->onResponse) {
-            // Yes. Call it.
-            instance->onResponse(response, request->token);
-          // No, but do we have an onData handler registered?
-          } else if (instance->onData) {
-            // Yes. call it
-            instance->onData(response, request->token);
-          } else {
-            LOG_D("No handler for response!\n");
-          }
-        } else {
-          // No, something went wrong. All we have is an error
-          LOG_D("Error response.\n");
-          // Count it
-          {
-            LOCK_GUARD(responseCnt, instance->countAccessM);
-            instance->errorCount++;
-          }
-          // Is it a synchronous request?
-          if (request->isSyncRequest) {
-            // Yes. Put the response into the response map
-            {
-              LOCK_GUARD(sL, instance->syncRespM);
-              instance->syncResponse[request->token] = response;
-            }
-          // No, but do we have an onResponse handler?
-          } else if (instance->onResponse) {
-            // Yes, call it.
-            instance->onResponse(response, request->token);
-          // No, but do we have an onError handler?
-          } else if (instance->onError) {
-            // Yes. Forward the error code to it
-            instance->onError(response.getError(), request->token);
-          } else {
-            LOG_D("No onError handler\n");
-          }
-        }
+        request->sentAt = millis();
+        instance->inflight.push_back(request);
         //   set lastHost/lastPort tp host/port
         instance->MT_lastTarget = request->target;
       } else {
         // Oops. Connection failed
-        response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), IP_CONNECTION_FAILED);
-        // Is it a synchronous request?
-        if (request->isSyncRequest) {
-          // Yes. Put the response into the response map
-          {
-            LOCK_GUARD(sL, instance->syncRespM);
-            instance->syncResponse[request->token] = response;
-          }
-        // No, but do we have an onResponse handler?
-        } else if (instance->onResponse) {
-          // Yes, call it.
-          instance->onResponse(response, request->token);
-        // Finally, do we have an onError handler?
-        } else if (instance->onError) {
-          // Yes. Forward the error code to it
-          instance->onError(IP_CONNECTION_FAILED, request->token);
+        ModbusMessage response;
+        response.setError(request->getServerID(), request->getFunctionCode(), IP_CONNECTION_FAILED);
+        instance->respond(request, response);
+        instance->releaseSlot(request);
+        instance->MT_pool[instance->MT_active].lastUsed = millis();
+      }
+    }
+
+    // Anything in flight?
+    if (!instance->inflight.empty()) {
+      // Yes. Collect all complete responses and match them by transaction ID
+      while (instance->receive()) {
+        busy = true;
+        uint16_t tid = (instance->MT_rxBuf[0] << 8) | instance->MT_rxBuf[1];
+        auto it = instance->inflight.begin();
+        while (it != instance->inflight.end() && (*it)->head.transactionID != tid) { ++it; }
+        // Found the request?
+        if (it != instance->inflight.end()) {
+          // Yes. Check and deliver the response
+          RequestEntry *request = *it;
+          instance->inflight.erase(it);
+          ModbusMessage response = instance->checkResponse(request);
+          instance->respond(request, response);
+          instance->releaseSlot(request);
+          instance->MT_pool[instance->MT_active].lastUsed = millis();
+        } else {
+          // No. Late answer to a request we already gave up on
+          LOG_W("Response with unknown transaction ID %04X dropped\n", tid);
         }
+        instance->MT_rxLen = 0;
+      }
+
+      // Give up on requests not answered in time
+      auto it = instance->inflight.begin();
+      while (it != instance->inflight.end()) {
+        RequestEntry *request = *it;
+        if (millis() - request->sentAt >= request->target.timeout) {
+          ModbusMessage response;
+          response.setError(request->getServerID(), request->getFunctionCode(), TIMEOUT);
+          instance->respond(request, response);
+          instance->releaseSlot(request);
+          it = instance->inflight.erase(it);
+          instance->MT_pool[instance->MT_active].lastUsed = millis();
+        } else {
+          ++it;
+        }
+      }
+
+      // Connection lost? The remaining responses will never arrive then.
+      if (!instance->inflight.empty() && !instance->MT_current->connected()) {
+        LOG_D("Connection lost with %d requests in flight.\n", (uint32_t)instance->inflight.size());
+        for (RequestEntry *request : instance->inflight) {
+          ModbusMessage response;
+          response.setError(request->getServerID(), request->getFunctionCode(), IP_CONNECTION_FAILED);
+          instance->respond(request, response);
+          instance->releaseSlot(request);
+        }
+        instance->inflight.clear();
+        instance->MT_pool[instance->MT_active].lastUsed = millis();
+      }
+    }
+
+    // Nothing done in this pass? Sleep until the next request is queued.
+    // The Client interface has no way to signal incoming data, so while responses are
+    // outstanding we still have to look for them in short intervals.
+    if (!busy) {
+      // Close pooled connections not used for a while. Wake up again when the next one is due.
+      uint32_t sleep = instance->closeIdleConnections();
+      instance->MT_wakeup.wait(instance->inflight.empty() ? sleep : 1);
+    }
+  }
+}
+
+// selectConnection: make the pool connection to the target the current one.
+// If there is none, take an unused client or close the least recently used connection.
+void ModbusClientTCP::selectConnection(const TargetHost& target) {
+  uint8_t use = 0;
+  bool found = false;
+  // Is there a connection to the target open already?
+  for (uint8_t i = 0; i < MT_pool.size() && !found; ++i) {
+    if (MT_pool[i].target == target && MT_pool[i].client->connected()) {
+      use = i;
+      found = true;
+      LOG_D("Reusing pool connection %d\n", use);
+    }
+  }
+  // No. Is there an unused client?
+  for (uint8_t i = 0; i < MT_pool.size() && !found; ++i) {
+    if (!MT_pool[i].client->connected()) {
+      use = i;
+      found = true;
+    }
+  }
+  // No. Close the connection that was unused for the longest time
+  if (!found) {
+    unsigned long now = millis();
+    for (uint8_t i = 1; i < MT_pool.size(); ++i) {
+      if (now - MT_pool[i].lastUsed > now - MT_pool[use].lastUsed) {
+        use = i;
       }
-      // Clean-up time. 
-      if (!doNotPop)
-      {
-        // Safely lock the queue
-        LOCK_GUARD(lockGuard, instance->qLock);
-        // Remove the front queue entry
-        instance->requests.pop();
-        // Delete request
-        delete request;
-        LOG_D("Request popped from queue.\n");
+    }
+    MT_pool[use].client->stop();
+    LOG_D("Target different, disconnect pool connection %d\n", use);
+    delay(1);  // Give scheduler room to breathe
+  }
+  MT_active = use;
+  MT_current = MT_pool[use].client;
+}
+
+// closeIdleConnections: stop pool connections unused for longer than the idle timeout.
+// Returns the time in ms until the next one will be due, or WAIT_FOREVER if there is none.
+uint32_t ModbusClientTCP::closeIdleConnections() {
+  uint32_t next = WAIT_FOREVER;
+  // Do we have an idle timeout at all?
+  if (MT_idleTimeout) {
+    // Yes. Check all open connections, except the one with requests in flight
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < MT_pool.size(); ++i) {
+      if ((i == MT_active && !inflight.empty()) || !MT_pool[i].client->connected()) continue;
+      uint32_t idle = now - MT_pool[i].lastUsed;
+      if (idle >= MT_idleTimeout) {
+        MT_pool[i].client->stop();
+        LOG_D("Pool connection %d idle, disconnect\n", i);
+      } else if (MT_idleTimeout - idle < next) {
+        next = MT_idleTimeout - idle;
       }
-      lastRequest = millis();
+    }
+  }
+  return next;
+}
+
+// respond: deliver the response to a request to the waiting syncRequest or the handlers
+void ModbusClientTCP::respond(RequestEntry *request, ModbusMessage& response) {
+  // Did we get a normal response?
+  if (response.getError()==SUCCESS) {
+    LOG_D("Data response.\n");
+    // Yes. Is someone waiting for this very request?
+    if (request->syncID || request->onDone) {
+      // Yes. Hand the response over to the waiting caller or completion handler
+      complete(request->syncID, request->onDone, response);
+      request->syncID = 0;
+    // No, async request. Do we have an onResponse handler?
+    } else if (onResponse) {
+      // Yes. Call it.
+      onResponse(response, request->token);
+    } else if (onResponseV) {
+      onResponseV(ModbusMessageView(response), request->token);
+    // No, but do we have an onData handler registered?
+    } else if (onData) {
+      // Yes. call it
+      onData(response, request->token);
+    } else if (onDataV) {
+      onDataV(ModbusMessageView(response), request->token);
     } else {
-      delay(1);  // Give scheduler room to breathe
+      LOG_D("No handler for response!\n");
+    }
+  } else {
+    // No, something went wrong. All we have is an error
+    LOG_D("Error response.\n");
+    // Count it
+    {
+      LOCK_GUARD(responseCnt, countAccessM);
+      errorCount++;
+    }
+    // Is someone waiting for this very request?
+    if (request->syncID || request->onDone) {
+      // Yes. Hand the response over to the waiting caller or completion handler
+      complete(request->syncID, request->onDone, response);
+      request->syncID = 0;
+    // No, but do we have an onResponse handler?
+    } else if (onResponse) {
+      // Yes, call it.
+      onResponse(response, request->token);
+    } else if (onResponseV) {
+      onResponseV(ModbusMessageView(response), request->token);
+    // No, but do we have an onError handler?
+    } else if (onError) {
+      // Yes. Forward the error code to it
+      onError(response.getError(), request->token);
+    } else {
+      LOG_D("No onError handler\n");
     }
   }
+  // Identical reads attached to the request get the same response
+  if (request->follower) {
+    respond(request->follower, response);
+  }
 }
 
 // send: send request via Client connection
 void ModbusClientTCP::send(RequestEntry *request) {
   // We have a established connection here, so we can write right away.
-  // Move tcpHead and request into one continuous buffer, since the very first request tends to 
-  // take too long to be sent to be recognized.
-  ModbusMessage m;
-  m.add((const uint8_t *)request->head, 6);
-  m.append(request->msg);
+  // tcpHead and request go out in one write, since the very first request tends to 
+  // take too long to be sent to be recognized. The header is put into the room left in front of
+  // the request, so the frame can be sent as it is.
+  request->head.writeTo(request->frame.data());
 
-  MT_client.write(m.data(), m.size());
+  MT_current->write(request->frame.data(), request->frame.size());
   // Done. Are we?
-  MT_client.flush();
-  HEXDUMP_V("Request packet", m.data(), m.size());
+  MT_current->flush();
+  HEXDUMP_V("Request packet", request->frame.data(), request->frame.size());
 }
 
-// receive: get response via Client connection
-ModbusMessage ModbusClientTCP::receive(RequestEntry *request) {
-  unsigned long lastMillis = millis();     // Timer to check for timeout
-  bool hadData = false;               // flag data received
-  const uint16_t dataLen(300);        // Modbus Packet supposedly will fit (260<300)
-  uint8_t data[dataLen];              // Local buffer to collect received data
-  uint16_t dataPtr = 0;               // Pointer into data
-  ModbusMessage response;             // Response structure to be returned
-
-  // wait for packet data, overflow or timeout
-  while (millis() - lastMillis < request->target.timeout && dataPtr < dataLen && !hadData) {
-    // Is there data waiting?
-    if (MT_client.available()) {
-      // Yes. catch as much as is there and fits into buffer
-      while (MT_client.available() && dataPtr < dataLen) {
-        data[dataPtr++] = MT_client.read();
+// receive: collect response data from the Client connection.
+// Returns true if a complete packet (MBAP header plus the length it announces) is in MT_rxBuf.
+// The data is read in blocks: first the header, then exactly the remainder of the packet, so a
+// packet split over several TCP segments is put together again, and one directly following it
+// is left untouched for the next call.
+bool ModbusClientTCP::receive() {
+  while (1) {
+    // We need the header first
+    uint16_t need = 6;
+    // Do we have it already?
+    if (MT_rxLen >= 6) {
+      // Yes. Its length field tells how much is to follow.
+      uint16_t len = (MT_rxBuf[4] << 8) | MT_rxBuf[5];
+      // A length no Modbus packet can have means we lost track of the packet boundaries.
+      if (len < 2 || len > MT_RXBUFSIZE - 6) {
+        // Drop all we have and start over with the next packet.
+        LOG_W("Invalid TCP head length %d, dropping received data\n", len);
+        while (MT_current->read() != -1) {}
+        MT_rxLen = 0;
+        return false;
+      }
+      need = len + 6;
+      // Complete?
+      if (MT_rxLen == need) {
+        LOG_D("Received response.\n");
+        HEXDUMP_V("Response packet", MT_rxBuf, MT_rxLen);
+        return true;
       }
-      // Register data received
-      hadData = true;
-      // Rewind EOT and timeout timers
-      lastMillis = millis();
     }
-    delay(1); // Give scheduler room to breathe
+    // Read as much of the missing part as has arrived
+    int avail = MT_current->available();
+    if (avail <= 0) return false;
+    uint16_t chunk = need - MT_rxLen;
+    if (avail < chunk) chunk = avail;
+    int got = MT_current->read(MT_rxBuf + MT_rxLen, chunk);
+    if (got <= 0) return false;
+    MT_rxLen += got;
   }
-  // Did we get some data?
-  if (hadData) {
-    LOG_D("Received response.\n");
-    HEXDUMP_V("Response packet", data, dataPtr);
-    // Yes. check it for validity
-    // First transactionID and protocolID shall be identical, length has to match the remainder.
-    ModbusTCPhead head(request->head.transactionID, request->head.protocolID, dataPtr - 6);
-    // Matching head?
-    if (memcmp((const uint8_t *)head, data, 6)) {
-      // No. return Error response
-      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), TCP_HEAD_MISMATCH);
-      // If the server id does not match that of the request, report error
-    } else if (data[6] != request->msg.getServerID()) {
-      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), SERVER_ID_MISMATCH);
-      // If the function code does not match that of the request, report error
-    } else if ((data[7] & 0x7F) != request->msg.getFunctionCode()) {
-      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), FC_MISMATCH);
-    } else {
-      // Looks good.
-      response.add(data + 6, dataPtr - 6);
-    }
+}
+
+// checkResponse: validate the packet in MT_rxBuf against the request it answers
+ModbusMessage ModbusClientTCP::checkResponse(RequestEntry *request) {
+  ModbusMessage response;             // Response structure to be returned
+
+  // The transactionID has been matched already. protocolID shall be identical.
+  if (MT_rxBuf[2] != ((request->head.protocolID >> 8) & 0xFF) || MT_rxBuf[3] != (request->head.protocolID & 0xFF)) {
+    // No. return Error response
+    response.setError(request->getServerID(), request->getFunctionCode(), TCP_HEAD_MISMATCH);
+    // If the server id does not match that of the request, report error
+  } else if (MT_rxBuf[6] != request->getServerID()) {
+    response.setError(request->getServerID(), request->getFunctionCode(), SERVER_ID_MISMATCH);
+    // If the function code does not match that of the request, report error
+  } else if ((MT_rxBuf[7] & 0x7F) != request->getFunctionCode()) {
+    response.setError(request->getServerID(), request->getFunctionCode(), FC_MISMATCH);
   } else {
-    // No, timeout must have struck
-    response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), TIMEOUT);
+    // Looks good.
+    response.add(MT_rxBuf + 6, MT_rxLen - 6);
   }
   return response;
 }
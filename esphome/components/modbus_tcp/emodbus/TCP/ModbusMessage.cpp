@@ -78,8 +78,8 @@ ModbusMessage::operator bool() {
 }
 
 // Exposed methods of std::vector
-const uint8_t *ModbusMessage::data() { return MM_data.data(); }
-uint16_t       ModbusMessage::size() { return MM_data.size(); }
+const uint8_t *ModbusMessage::data() const { return MM_data.data(); }
+uint16_t       ModbusMessage::size() const { return MM_data.size(); }
 void           ModbusMessage::push_back(const uint8_t& val) { MM_data.push_back(val); }
 void           ModbusMessage::clear() { MM_data.clear(); }
 // provide restricted operator[] interface
@@ -160,8 +160,8 @@ void    ModbusMessage::setFunctionCode(uint8_t FC) {
 uint16_t ModbusMessage::add(const uint8_t *arrayOfBytes, uint16_t count) {
   uint16_t originalSize = MM_data.size();
   MM_data.resize(originalSize + count);
-  // Copy it
-  std::copy(arrayOfBytes, arrayOfBytes + count, MM_data.begin() + originalSize);
+  // Copy it - as much as did fit
+  std::copy(arrayOfBytes, arrayOfBytes + (MM_data.size() - originalSize), MM_data.begin() + originalSize);
   // Return updated size (logical length of message so far)
   return MM_data.size();
 }
@@ -373,15 +373,24 @@ uint16_t ModbusMessage::add(double v, int swapRule) {
 // get() variants for float and double values
 // values will be read in IEEE754 byte sequence (MSB first)
 uint16_t ModbusMessage::get(uint16_t index, float& v, int swapRule) const {
+  return getFloat(MM_data.data(), MM_data.size(), index, v, swapRule);
+}
+
+uint16_t ModbusMessage::get(uint16_t index, double& v, int swapRule) const {
+  return getDouble(MM_data.data(), MM_data.size(), index, v, swapRule);
+}
+
+// getFloat() and getDouble() do the work for the above on any byte buffer
+uint16_t ModbusMessage::getFloat(const uint8_t *data, uint16_t size, uint16_t index, float& v, int swapRule) {
   // First check if we need to determine byte order
   if (determineFloatOrder()) {
     // If we get here, the floatOrder is known
     // Will it fit?
-    if (index <= MM_data.size() - sizeof(float)) {
+    if (index + sizeof(float) <= size) {
       // Yes. Get the bytes of v in normalized sequence
       uint8_t *bytes = (uint8_t *)&v;
       for (uint8_t i = 0; i < sizeof(float); ++i) {
-        bytes[i] = MM_data[index + floatOrder[i]];
+        bytes[i] = data[index + floatOrder[i]];
       }
       HEXDUMP_V("got float", (uint8_t *)&v, sizeof(float));
       // Do we need to apply a swap rule?
@@ -397,16 +406,16 @@ uint16_t ModbusMessage::get(uint16_t index, float& v, int swapRule) const {
   return index;
 }
 
-uint16_t ModbusMessage::get(uint16_t index, double& v, int swapRule) const {
+uint16_t ModbusMessage::getDouble(const uint8_t *data, uint16_t size, uint16_t index, double& v, int swapRule) {
   // First check if we need to determine byte order
   if (determineDoubleOrder()) {
     // If we get here, the doubleOrder is known
     // Will it fit?
-    if (index <= MM_data.size() - sizeof(double)) {
+    if (index + sizeof(double) <= size) {
       // Yes. Get the bytes of v in normalized sequence
       uint8_t *bytes = (uint8_t *)&v;
       for (uint8_t i = 0; i < sizeof(double); ++i) {
-        bytes[i] = MM_data[index + doubleOrder[i]];
+        bytes[i] = data[index + doubleOrder[i]];
       }
       HEXDUMP_V("got double", (uint8_t *)&v, sizeof(double));
       // Do we need to apply a swap rule?
@@ -0,0 +1,104 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_MESSAGE_VIEW_H
+#define _MODBUS_MESSAGE_VIEW_H
+#include "ModbusMessage.h"
+
+// ModbusMessageView: read-only look at a Modbus message held elsewhere, e.g. in a receive buffer.
+// Nothing is copied or allocated. The bytes must stay valid as long as the view is used - for a
+// view handed to a callback this is the duration of the call. Use toMessage() to keep a copy.
+class ModbusMessageView {
+public:
+  // Empty view
+  ModbusMessageView() :
+    MV_data(nullptr),
+    MV_size(0) {}
+
+  // View on a buffer of given length, starting with the server ID
+  ModbusMessageView(const uint8_t *data, uint16_t size) :
+    MV_data(data),
+    MV_size(size) {}
+
+  // View on the data of a ModbusMessage. Invalidated if the message is changed!
+  explicit ModbusMessageView(ModbusMessage& m) :
+    MV_data(m.data()),
+    MV_size(m.size()) {}
+
+  // Exposed methods like in ModbusMessage
+  inline const uint8_t *data() const { return MV_data; }
+  inline uint16_t size() const { return MV_size; }
+  inline uint8_t operator[](uint16_t index) const { return index < MV_size ? MV_data[index] : 0; }
+  inline explicit operator bool() const { return MV_size >= 2; }
+
+  // provide iterator interface
+  typedef const uint8_t *const_iterator;
+  const_iterator begin() const { return MV_data; }
+  const_iterator end() const   { return MV_data + MV_size; }
+
+  // Modbus data extraction - same rules as in ModbusMessage
+  inline uint8_t getServerID() const { return MV_size >= 2 ? MV_data[0] : 0; }
+  inline uint8_t getFunctionCode() const { return MV_size >= 2 ? MV_data[1] : 0; }
+  inline Error getError() const {
+    if (MV_size > 2 && (MV_data[1] & 0x80)) return static_cast<Modbus::Error>(MV_data[2]);
+    return SUCCESS;
+  }
+
+  // get() - read MSB-first values starting at byte index, like ModbusMessage::get(). Returns updated index
+  inline uint16_t get(uint16_t index) const { return index; }
+
+  template <class T, class... Args>
+  typename std::enable_if<!std::is_pointer<T>::value, uint16_t>::type
+  get(uint16_t index, T& v, Args&... args) const {
+    uint16_t pos = getOne(index, v);
+    return get(pos, args...);
+  }
+
+  // get() - read a byte array of a given size into a vector<uint8_t>. Returns updated index
+  inline uint16_t get(uint16_t index, vector<uint8_t>& v, uint8_t count) const {
+    v.clear();
+    while (index < MV_size && count--) {
+      v.push_back(MV_data[index++]);
+    }
+    return index;
+  }
+
+  // get() variants for float and double values
+  inline uint16_t get(uint16_t index, float& v, int swapRules = 0) const {
+    return ModbusMessage::getFloat(MV_data, MV_size, index, v, swapRules);
+  }
+  inline uint16_t get(uint16_t index, double& v, int swapRules = 0) const {
+    return ModbusMessage::getDouble(MV_data, MV_size, index, v, swapRules);
+  }
+
+  // toMessage: get an owning copy of the viewed bytes
+  inline ModbusMessage toMessage() const {
+    ModbusMessage m(MV_size);
+    m.add(MV_data, MV_size);
+    return m;
+  }
+
+protected:
+  // getOne() - read a MSB-first value starting at byte index. Returns updated index
+  template <typename T> uint16_t getOne(uint16_t index, T& retval) const {
+    uint16_t sz = sizeof(retval);
+
+    retval = 0;
+    // Will it fit?
+    if (index + sz <= MV_size) {
+      // Yes. Copy it MSB first
+      while (sz) {
+        sz--;
+        retval <<= 8;
+        retval |= MV_data[index++];
+      }
+    }
+    return index;
+  }
+
+  const uint8_t *MV_data;   // First byte of the message
+  uint16_t MV_size;         // Length of the message
+};
+
+#endif
@@ -0,0 +1,124 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _WORKER_SIGNAL_H
+#define _WORKER_SIGNAL_H
+
+#include "options.h"
+
+#if HAS_FREERTOS
+extern "C" {
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+}
+#elif IS_LINUX
+#include <pthread.h>
+#include <ctime>
+#include <cerrno>
+#endif
+
+#if HAS_FREERTOS || IS_LINUX
+
+#define WAIT_FOREVER 0xFFFFFFFF
+
+// WorkerSignal: lets other tasks wake up a worker task that is sleeping for lack of work.
+// A notify() while the worker is busy is not lost - the next wait() will return at once.
+// FreeRTOS uses the worker's task notification, Linux a condition variable.
+class WorkerSignal {
+public:
+#if HAS_FREERTOS
+  WorkerSignal() : task(nullptr) {}
+
+  // attach: must be called by the worker task itself, before it checks for work the first time
+  inline void attach() { task = xTaskGetCurrentTaskHandle(); }
+
+  // notify: wake up the worker
+  inline void notify() {
+    TaskHandle_t t = task;
+    if (t) xTaskNotifyGive(t);
+  }
+
+  // wait: sleep until notified or timeout ms have passed. Returns true if notified.
+  inline bool wait(uint32_t timeout) {
+    TickType_t ticks = portMAX_DELAY;
+    if (timeout != WAIT_FOREVER) {
+      ticks = pdMS_TO_TICKS(timeout);
+      // Sleep at least one tick, else we would be spinning
+      if (ticks == 0) ticks = 1;
+    }
+    return ulTaskNotifyTake(pdTRUE, ticks) > 0;
+  }
+
+protected:
+  volatile TaskHandle_t task;     // Worker task to notify, set by attach()
+
+#elif IS_LINUX
+  WorkerSignal() : pending(false) {
+    pthread_mutex_init(&lock, nullptr);
+    // Timeouts shall not be affected by changes to the wall clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+  }
+
+  ~WorkerSignal() {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+  }
+
+  // attach: nothing to remember for a condition variable
+  inline void attach() { }
+
+  // notify: wake up the worker
+  inline void notify() {
+    pthread_mutex_lock(&lock);
+    pending = true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+  }
+
+  // wait: sleep until notified or timeout ms have passed. Returns true if notified.
+  // pthread primitives are used, as the worker thread may be cancelled while waiting here.
+  inline bool wait(uint32_t timeout) {
+    bool rc = false;
+    pthread_mutex_lock(&lock);
+    // Release the mutex again if we get cancelled
+    pthread_cleanup_push(unlock, &lock);
+    if (timeout == WAIT_FOREVER) {
+      while (!pending) pthread_cond_wait(&cond, &lock);
+    } else {
+      struct timespec until;
+      clock_gettime(CLOCK_MONOTONIC, &until);
+      until.tv_sec += timeout / 1000;
+      until.tv_nsec += (timeout % 1000) * 1000000L;
+      if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+      }
+      while (!pending && pthread_cond_timedwait(&cond, &lock, &until) != ETIMEDOUT) {}
+    }
+    rc = pending;
+    pending = false;
+    pthread_cleanup_pop(1);
+    return rc;
+  }
+
+protected:
+  static void unlock(void *m) { pthread_mutex_unlock(static_cast<pthread_mutex_t *>(m)); }
+
+  pthread_mutex_t lock;           // Protects pending
+  pthread_cond_t cond;            // Signalled by notify()
+  bool pending;                   // notify() was called since the last wait()
+#endif
+
+  // Prevent copy construction or assignment
+  WorkerSignal(WorkerSignal& other) = delete;
+  WorkerSignal& operator=(WorkerSignal& other) = delete;
+};
+
+#endif  // HAS_FREERTOS || IS_LINUX
+
+#endif  // INCLUDE GUARD
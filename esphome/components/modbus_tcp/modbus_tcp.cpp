@@ -1,4 +1,4 @@
-#include "modbus_tcp_component.h"
+#include "modbus_tcp.h"
 #include "esphome/core/log.h"
 
 static const char *TAG = "modbus_tcp";
@@ -6,6 +6,16 @@ static const char *TAG = "modbus_tcp";
 namespace esphome {
 namespace modbus_tcp {
 
+void ModbusTCPComponent::add_item(RegisterItem *item) {
+  // A value must fit into the 16-bit address space
+  if (item->get_end() > 0x10000) {
+    ESP_LOGE(TAG, "Address 0x%X: value does not fit below 0xFFFF, ignored", item->get_address());
+    return;
+  }
+  items_.push_back(item);
+  items_changed_ = true;
+}
+
 void ModbusTCPComponent::setup() {
   ESP_LOGCONFIG(TAG, "Setting up Modbus TCP...");
 
@@ -13,69 +23,192 @@ void ModbusTCPComponent::setup() {
   IPAddress ip;
   if (!ip.fromString(ip_address_.c_str())) {
     ESP_LOGE(TAG, "Invalid IP address: %s", ip_address_.c_str());
+    this->mark_failed();
     return;
   }
 
-  // Initialize the Modbus client with the WiFiClient, IP, port, and queue limit
+  // One client - and thus one socket and one worker task - serves all children
   modbus_client_ = new ModbusClientTCP(client_, ip, port_, 100);  // Adjust queueLimit as needed
+  modbus_client_->setMaxInflightRequests(max_inflight_);
 
-  // Define the callback for receiving data
-  modbus_client_->onData([this](ModbusMessage response, uint32_t token) {
-    ESP_LOGD(TAG, "Received Modbus response for token %u", token);
+  // Data and error responses both arrive here, on the client's worker task.
+  // Hand them over to loop() so children are only ever touched from the main loop.
+  modbus_client_->onResponseHandler([this](ModbusMessage response, uint32_t token) {
+    std::lock_guard<std::mutex> lock(responses_lock_);
+    responses_.emplace_back(token, std::move(response));
+  });
 
-    // Check if the response is valid and corresponds to a read holding register
-    if (response.size() >= 4) {
-      uint8_t function_code = response.getServerFunction();
-      if (function_code == READ_HOLD_REGISTER) {
-        // Extract the 16-bit register value (big-endian)
-        uint16_t reg_value = (static_cast<uint16_t>(response.getData(2)) << 8) | response.getData(3);
-        float sensor_value = static_cast<float>(reg_value);
+  // Start the worker task; it connects to the target on the first request
+  modbus_client_->begin();
+  ESP_LOGI(TAG, "Polling %s:%u", ip_address_.c_str(), port_);
+}
 
-        // Publish the sensor value to Home Assistant
-        this->publish_state(sensor_value);
-      }
-    }
-  });
+void ModbusTCPComponent::plan_() {
+  // Regroup the items by update interval; cached batches refer to the old groups
+  scheduler_.build(items_, update_interval_, millis());
+  batches_.clear();
+  generation_ = (generation_ + 1) & 0x7F;
+  items_changed_ = false;
+  ESP_LOGD(TAG, "Scheduled %u item(s) in %u scan group(s)", items_.size(), scheduler_.get_group_count());
+}
 
-  // Define the callback for handling errors
-  modbus_client_->onError([](Error error, uint32_t token) {
-    ESP_LOGE(TAG, "Modbus error: %d", static_cast<int>(error));
-  });
+uint8_t ModbusTCPComponent::get_batch_(uint32_t mask) {
+  for (size_t index = 0; index < batches_.size(); index++) {
+    if (batches_[index].mask == mask)
+      return index;
+  }
 
-  // Attempt to connect to the Modbus TCP server
-  if (!modbus_client_->connect()) {
-    ESP_LOGE(TAG, "Failed to connect to %s:%u", ip_address_.c_str(), port_);
-  } else {
-    ESP_LOGI(TAG, "Connected to %s:%u", ip_address_.c_str(), port_);
+  // Not planned yet. Keep the cache bounded; a full reset only drops responses in flight.
+  if (batches_.size() > 0xFF) {
+    batches_.clear();
+    generation_ = (generation_ + 1) & 0x7F;
   }
+
+  // Merge all due registers into as few requests as possible
+  Batch batch;
+  batch.mask = mask;
+  batch.items = scheduler_.items(mask);
+  batch.ranges = planner_.plan(batch.items);
+  ESP_LOGD(TAG, "Planned %u request(s) for scan groups %08X", batch.ranges.size(), mask);
+  batches_.push_back(std::move(batch));
+  return batches_.size() - 1;
 }
 
-void ModbusTCPComponent::loop() {
-  static unsigned long last_request_time = 0;
-  unsigned long current_time = millis();
+void ModbusTCPComponent::poll_() {
+  if (items_changed_)
+    plan_();
 
-  // Send a request every 5000 ms (5 seconds)
-  if (current_time - last_request_time >= 5000) {
-    last_request_time = current_time;
+  // All groups falling due in this tick share one batch
+  uint32_t mask = scheduler_.due(millis());
+  if (mask == 0)
+    return;
 
-    // Create a request to read a holding register
-    ModbusMessage request;
-    // Parameters: function code (READ_HOLD_REGISTER), slave ID (1), register address, number of registers (1)
-    request.addRequest(READ_HOLD_REGISTER, 1, register_address_, 1);
+  uint8_t batch_index = this->get_batch_(mask);
+  const Batch &batch = batches_[batch_index];
+  for (uint16_t index = 0; index < batch.ranges.size(); index++) {
+    const ReadRange &range = batch.ranges[index];
+    uint32_t token = (static_cast<uint32_t>(generation_) << 24) | (static_cast<uint32_t>(batch_index) << 16) | index;
 
-    // Send the request asynchronously
-    Error error = modbus_client_->addRequest(request, token_);
+    // Parameters: token, slave ID, function code, first register, number of registers
+    Error error = modbus_client_->addRequest(token, server_id_, range.function_code(), range.start, range.count);
     if (error != SUCCESS) {
       ESP_LOGE(TAG, "Failed to send Modbus request (Error: %d)", static_cast<int>(error));
     }
   }
 }
 
+bool ModbusTCPComponent::write_item(RegisterItem *item, float value) {
+  if (modbus_client_ == nullptr)
+    return false;
+
+  // Find the item's index to build the token from
+  uint32_t index = 0;
+  while (index < items_.size() && items_[index] != item)
+    index++;
+  if (index == items_.size()) {
+    ESP_LOGE(TAG, "Address 0x%X: item not registered, write refused", item->get_address());
+    return false;
+  }
+  uint32_t token = WRITE_TOKEN | index;
+
+  Error error = SUCCESS;
+  switch (item->get_register_type()) {
+    case RegisterType::COIL:
+      error = modbus_client_->addRequest(token, server_id_, WRITE_COIL, item->get_address(),
+                                         static_cast<uint16_t>(value != 0 ? 0xFF00 : 0x0000));
+      break;
+    case RegisterType::HOLDING: {
+      uint16_t words[2];
+      uint8_t count = ReadPlanner::encode(item->get_value_type(), value, words);
+      if (count == 1) {
+        error = modbus_client_->addRequest(token, server_id_, WRITE_HOLD_REGISTER, item->get_address(), words[0]);
+      } else {
+        error = modbus_client_->addRequest(token, server_id_, WRITE_MULT_REGISTERS, item->get_address(),
+                                           static_cast<uint16_t>(count), static_cast<uint8_t>(count * 2), words);
+      }
+      break;
+    }
+    default:
+      ESP_LOGE(TAG, "Address 0x%X is read-only", item->get_address());
+      return false;
+  }
+  if (error != SUCCESS) {
+    ESP_LOGE(TAG, "Failed to send Modbus write (Error: %d)", static_cast<int>(error));
+    return false;
+  }
+  return true;
+}
+
+void ModbusTCPComponent::handle_response_(uint32_t token, ModbusMessage &response) {
+  if (response.getError() != SUCCESS) {
+    ESP_LOGE(TAG, "Modbus error: %d (token %08X)", static_cast<int>(response.getError()), token);
+    this->status_set_warning();
+    return;
+  }
+  this->status_clear_warning();
+
+  // Nothing to fan out for write acknowledgements
+  if (token & WRITE_TOKEN)
+    return;
+
+  // Drop responses to a previous plan
+  uint8_t batch_index = (token >> 16) & 0xFF;
+  uint16_t index = token & 0xFFFF;
+  if ((token >> 24) != generation_ || batch_index >= batches_.size() || index >= batches_[batch_index].ranges.size()) {
+    ESP_LOGV(TAG, "Stale response for token %08X", token);
+    return;
+  }
+  const Batch &batch = batches_[batch_index];
+  const ReadRange &range = batch.ranges[index];
+
+  // Check if the response is valid and corresponds to the request
+  if (response.getFunctionCode() != range.function_code() || response[2] != range.byte_count()) {
+    ESP_LOGW(TAG, "Unexpected response for FC%02X 0x%X..0x%X", range.function_code(), range.start,
+             range.start + range.count - 1);
+    return;
+  }
+
+  // Fan the block out to every child covered by the range
+  for (uint16_t item_index : range.items) {
+    RegisterItem *item = batch.items[item_index];
+    uint32_t raw;
+    if (ReadPlanner::decode_raw(response, range, *item, raw)) {
+      item->on_raw(raw);
+    }
+  }
+}
+
+void ModbusTCPComponent::loop() {
+  if (modbus_client_ == nullptr)
+    return;
+
+  // Deliver what the worker task received since the last pass
+  std::vector<std::pair<uint32_t, ModbusMessage>> responses;
+  {
+    std::lock_guard<std::mutex> lock(responses_lock_);
+    responses.swap(responses_);
+  }
+  for (auto &response : responses) {
+    this->handle_response_(response.first, response.second);
+  }
+
+  // Send the requests for whatever is due
+  this->poll_();
+}
+
 void ModbusTCPComponent::dump_config() {
   ESP_LOGCONFIG(TAG, "Modbus TCP:");
   ESP_LOGCONFIG(TAG, "  IP Address: %s", ip_address_.c_str());
   ESP_LOGCONFIG(TAG, "  Port: %u", port_);
-  ESP_LOGCONFIG(TAG, "  Register Address: 0x%X", register_address_);
+  ESP_LOGCONFIG(TAG, "  Server ID: %u", server_id_);
+  ESP_LOGCONFIG(TAG, "  Update Interval: %u ms", update_interval_);
+  ESP_LOGCONFIG(TAG, "  Max In-flight Requests: %u", max_inflight_);
+  ESP_LOGCONFIG(TAG, "  Max Registers per Request: %u", planner_.get_max_registers());
+  ESP_LOGCONFIG(TAG, "  Max Register Gap: %u", planner_.get_max_gap());
+  ESP_LOGCONFIG(TAG, "  Items: %u", items_.size());
+  for (uint8_t group = 0; group < scheduler_.get_group_count(); group++) {
+    ESP_LOGCONFIG(TAG, "  Scan Group %u: every %u ms", group, scheduler_.get_group_interval(group));
+  }
 }
 
 }  // namespace modbus_tcp
@@ -1,33 +1,83 @@
 #pragma once
 
+#include <mutex>
+#include <utility>
+#include <vector>
 #include "esphome/core/component.h"
-#include "esphome/components/sensor/sensor.h"
 #include "ModbusClientTCP.h" // from eModbus
+#include "read_planner.h"
+#include "scan_scheduler.h"
 #include <WiFiClient.h>
 #include <IPAddress.h>
 
 namespace esphome {
 namespace modbus_tcp {
 
-class ModbusTCPComponent : public sensor::Sensor, public Component {
+// ModbusTCPComponent: hub for one Modbus TCP device. It owns the single connection and
+// worker to the device; sensor, binary_sensor and number children register their
+// addresses with it and are served from one shared poll cycle.
+class ModbusTCPComponent : public Component {
  public:
   void set_ip_address(const std::string &ip_address) { ip_address_ = ip_address; }
   void set_port(uint16_t port) { port_ = port; }
-  void set_register_address(uint16_t register_address) { register_address_ = register_address; }
+  void set_server_id(uint8_t server_id) { server_id_ = server_id; }
+  // Poll period in ms for items without an update interval of their own
+  void set_update_interval(uint32_t update_interval) { update_interval_ = update_interval; }
+  // Requests sent ahead without waiting for responses; >1 only for devices handling concurrent transactions
+  void set_max_inflight_requests(uint8_t max_inflight) { max_inflight_ = max_inflight; }
+
+  // Read planner tuning: registers per request and tolerated gap between registers
+  void set_max_registers_per_request(uint16_t max_registers) { planner_.set_max_registers(max_registers); }
+  void set_max_register_gap(uint16_t max_gap) { planner_.set_max_gap(max_gap); }
+
+  // Register a child to be polled with the device
+  void add_item(RegisterItem *item);
+
+  // Write a value to the register (or coil) of an item. Returns false if it could not be queued.
+  bool write_item(RegisterItem *item, float value);
 
   // ESPHome component interface
   void setup() override;
   void loop() override;
   void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::AFTER_WIFI; }
 
  protected:
+  // Token layout: write flag (bit 31), plan generation (bits 24-30), batch (bits 16-23)
+  // and range index (bits 0-15). Writes carry the item index instead.
+  static const uint32_t WRITE_TOKEN = 0x80000000;
+
+  // Batch: the requests planned for one combination of scan groups falling due together
+  struct Batch {
+    uint32_t mask;
+    std::vector<RegisterItem *> items;
+    std::vector<ReadRange> ranges;
+  };
+
+  void plan_();
+  void poll_();
+  uint8_t get_batch_(uint32_t mask);
+  void handle_response_(uint32_t token, ModbusMessage &response);
+
   std::string ip_address_;
   uint16_t port_{502};
-  uint16_t register_address_{0x200};
+  uint8_t server_id_{1};
+  uint32_t update_interval_{5000};
+  uint8_t max_inflight_{1};
+
+  std::vector<RegisterItem *> items_;  // Registered children
+  ReadPlanner planner_;                // Merges due items into contiguous requests
+  ScanScheduler scheduler_;            // Decides which items are due
+  std::vector<Batch> batches_;         // Planned batches, cached by scan group mask
+  uint8_t generation_{0};              // Bumped on every re-plan to drop stale responses
+  bool items_changed_{false};          // Re-plan before the next poll
+
+  // Responses arrive on the eModbus worker task and are handed to loop()
+  std::vector<std::pair<uint32_t, ModbusMessage>> responses_;
+  std::mutex responses_lock_;
 
   WiFiClient client_;                // WiFi client for TCP connections
   ModbusClientTCP* modbus_client_{nullptr};  // Pointer to eModbus client instance
-  uint32_t token_{0};                // Token for async requests
 };
 
 }  // namespace modbus_tcp
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#include "read_planner.h"
+
+namespace esphome {
+namespace modbus_tcp {
+
+// ModbusTCPBinarySensor: coil, discrete input or masked register bits of the hub's device
+class ModbusTCPBinarySensor : public binary_sensor::BinarySensor, public RegisterItem {
+ public:
+  // Bits of a register value that make the sensor "on". Ignored for coils and discrete inputs.
+  void set_bitmask(uint32_t bitmask) { bitmask_ = bitmask; }
+
+  // The mask is tested against the register bits, not the decoded value: a float loses the low bits
+  // of large 32-bit values, and negative values can not be converted to uint32_t.
+  void on_raw(uint32_t raw) override {
+    if (is_bit_type(register_type_)) {
+      this->publish_state(raw != 0);
+    } else {
+      this->publish_state((raw & bitmask_) != 0);
+    }
+  }
+  void on_value(float value) override { this->publish_state(value != 0); }
+
+ protected:
+  uint32_t bitmask_{0xFFFFFFFF};
+};
+
+}  // namespace modbus_tcp
+}  // namespace esphome
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "esphome/components/number/number.h"
+#include "modbus_tcp.h"
+
+namespace esphome {
+namespace modbus_tcp {
+
+// ModbusTCPNumber: writable holding register (or coil) of the hub's device.
+// The register is read back with the hub's poll cycle.
+class ModbusTCPNumber : public number::Number, public RegisterItem {
+ public:
+  void set_parent(ModbusTCPComponent *parent) { parent_ = parent; }
+
+  void on_value(float value) override { this->publish_state(value); }
+
+ protected:
+  void control(float value) override {
+    if (parent_ != nullptr && parent_->write_item(this, value)) {
+      // Optimistic; the next poll corrects it should the device refuse the value
+      this->publish_state(value);
+    }
+  }
+
+  ModbusTCPComponent *parent_{nullptr};
+};
+
+}  // namespace modbus_tcp
+}  // namespace esphome
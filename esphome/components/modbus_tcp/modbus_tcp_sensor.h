@@ -0,0 +1,16 @@
+#pragma once
+
+#include "esphome/components/sensor/sensor.h"
+#include "read_planner.h"
+
+namespace esphome {
+namespace modbus_tcp {
+
+// ModbusTCPSensor: numeric value read from a register (or register pair) of the hub's device
+class ModbusTCPSensor : public sensor::Sensor, public RegisterItem {
+ public:
+  void on_value(float value) override { this->publish_state(value); }
+};
+
+}  // namespace modbus_tcp
+}  // namespace esphome
@@ -0,0 +1,184 @@
+#include "read_planner.h"
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace modbus_tcp {
+
+uint8_t register_count(ValueType value_type) {
+  switch (value_type) {
+    case ValueType::U_WORD:
+    case ValueType::S_WORD:
+      return 1;
+    default:
+      return 2;
+  }
+}
+
+uint8_t ReadRange::function_code() const {
+  switch (type) {
+    case RegisterType::COIL:
+      return READ_COIL;
+    case RegisterType::DISCRETE_INPUT:
+      return READ_DISCR_INPUT;
+    case RegisterType::INPUT:
+      return READ_INPUT_REGISTER;
+    default:
+      return READ_HOLD_REGISTER;
+  }
+}
+
+void ReadPlanner::set_max_registers(uint16_t max_registers) {
+  // A request must at least hold the widest value, and never more than FC03/FC04 permit
+  max_registers_ = std::max<uint16_t>(2, std::min<uint16_t>(125, max_registers));
+}
+
+std::vector<ReadRange> ReadPlanner::plan(const std::vector<RegisterItem *> &items) const {
+  std::vector<ReadRange> ranges;
+
+  // Walk the items ordered by register table and address
+  std::vector<uint16_t> order(items.size());
+  for (uint16_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&items](uint16_t a, uint16_t b) {
+    if (items[a]->get_register_type() != items[b]->get_register_type())
+      return items[a]->get_register_type() < items[b]->get_register_type();
+    return items[a]->get_address() < items[b]->get_address();
+  });
+
+  // Greedy: extend the open range as long as the next item is close enough and the
+  // request does not outgrow the table's limit. This yields the minimal number of ranges.
+  for (uint16_t index : order) {
+    const RegisterItem &item = *items[index];
+    if (!ranges.empty()) {
+      ReadRange &range = ranges.back();
+      uint32_t range_end = range.start + range.count;
+      uint32_t new_end = std::max<uint32_t>(range_end, item.get_end());
+      uint16_t limit = max_registers_;
+      if (is_bit_type(range.type))
+        limit = MAX_BITS;
+      if (range.type == item.get_register_type() && item.get_address() <= range_end + max_gap_ &&
+          new_end - range.start <= limit) {
+        range.count = new_end - range.start;
+        range.items.push_back(index);
+        continue;
+      }
+    }
+    ReadRange range;
+    range.type = item.get_register_type();
+    range.start = item.get_address();
+    range.count = item.get_width();
+    range.items.push_back(index);
+    ranges.push_back(std::move(range));
+  }
+  return ranges;
+}
+
+void RegisterItem::on_raw(uint32_t raw) {
+  this->on_value(is_bit_type(register_type_) ? raw : ReadPlanner::to_value(value_type_, raw));
+}
+
+bool ReadPlanner::decode(ModbusMessage &response, const ReadRange &range, const RegisterItem &item, float &value) {
+  uint32_t raw;
+  if (!decode_raw(response, range, item, raw))
+    return false;
+  value = is_bit_type(range.type) ? raw : to_value(item.get_value_type(), raw);
+  return true;
+}
+
+bool ReadPlanner::decode_raw(ModbusMessage &response, const ReadRange &range, const RegisterItem &item,
+                             uint32_t &raw) {
+  // Response layout: server ID, function code, byte count, data
+  uint16_t offset = item.get_address() - range.start;
+
+  // Coils and discrete inputs are packed LSB first, eight to a byte
+  if (is_bit_type(range.type)) {
+    uint16_t index = 3 + offset / 8;
+    if (index >= response.size())
+      return false;
+    raw = (response[index] >> (offset % 8)) & 0x01;
+    return true;
+  }
+
+  uint16_t index = 3 + offset * 2;
+  if (index + item.get_width() * 2 > response.size())
+    return false;
+
+  uint16_t hi = 0;
+  uint16_t lo = 0;
+  switch (item.get_value_type()) {
+    case ValueType::U_WORD:
+    case ValueType::S_WORD:
+      response.get(index, lo);
+      break;
+    case ValueType::U_DWORD:
+    case ValueType::S_DWORD:
+    case ValueType::FP32:
+      response.get(index, hi, lo);
+      break;
+    case ValueType::U_DWORD_R:
+    case ValueType::S_DWORD_R:
+    case ValueType::FP32_R:
+      response.get(index, lo, hi);
+      break;
+  }
+  raw = (static_cast<uint32_t>(hi) << 16) | lo;
+  return true;
+}
+
+float ReadPlanner::to_value(ValueType value_type, uint32_t raw) {
+  float value = 0;
+  switch (value_type) {
+    case ValueType::U_WORD:
+      value = static_cast<uint16_t>(raw);
+      break;
+    case ValueType::S_WORD:
+      value = static_cast<int16_t>(raw);
+      break;
+    case ValueType::U_DWORD:
+    case ValueType::U_DWORD_R:
+      value = raw;
+      break;
+    case ValueType::S_DWORD:
+    case ValueType::S_DWORD_R:
+      value = static_cast<int32_t>(raw);
+      break;
+    case ValueType::FP32:
+    case ValueType::FP32_R:
+      memcpy(&value, &raw, sizeof(value));
+      break;
+  }
+  return value;
+}
+
+uint8_t ReadPlanner::encode(ValueType value_type, float value, uint16_t *words) {
+  uint32_t raw = 0;
+  switch (value_type) {
+    case ValueType::U_WORD:
+      words[0] = static_cast<uint16_t>(value);
+      return 1;
+    case ValueType::S_WORD:
+      words[0] = static_cast<uint16_t>(static_cast<int16_t>(value));
+      return 1;
+    case ValueType::U_DWORD:
+    case ValueType::U_DWORD_R:
+      raw = static_cast<uint32_t>(value);
+      break;
+    case ValueType::S_DWORD:
+    case ValueType::S_DWORD_R:
+      raw = static_cast<uint32_t>(static_cast<int32_t>(value));
+      break;
+    case ValueType::FP32:
+    case ValueType::FP32_R:
+      memcpy(&raw, &value, sizeof(raw));
+      break;
+  }
+  bool low_first = value_type == ValueType::U_DWORD_R || value_type == ValueType::S_DWORD_R ||
+                   value_type == ValueType::FP32_R;
+  words[low_first ? 1 : 0] = raw >> 16;
+  words[low_first ? 0 : 1] = raw & 0xFFFF;
+  return 2;
+}
+
+}  // namespace modbus_tcp
+}  // namespace esphome
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "ModbusMessage.h" // from eModbus
+
+namespace esphome {
+namespace modbus_tcp {
+
+// Modbus table a value is read from
+enum class RegisterType : uint8_t {
+  COIL,            // READ_COIL
+  DISCRETE_INPUT,  // READ_DISCR_INPUT
+  HOLDING,         // READ_HOLD_REGISTER
+  INPUT,           // READ_INPUT_REGISTER
+};
+
+// Encoding of a value inside the register block. *_R variants have the low word first.
+// Ignored for coils and discrete inputs, which are always single bits.
+enum class ValueType : uint8_t {
+  U_WORD,
+  S_WORD,
+  U_DWORD,
+  S_DWORD,
+  U_DWORD_R,
+  S_DWORD_R,
+  FP32,
+  FP32_R,
+};
+
+// Number of 16-bit registers occupied by a value of the given type
+uint8_t register_count(ValueType value_type);
+
+// true for the single-bit tables (coils, discrete inputs)
+inline bool is_bit_type(RegisterType type) { return type == RegisterType::COIL || type == RegisterType::DISCRETE_INPUT; }
+
+// RegisterItem: one polled value. Sensors, binary sensors and numbers derive from it
+// and register themselves with the hub.
+class RegisterItem {
+ public:
+  virtual ~RegisterItem() = default;
+
+  void set_register_type(RegisterType register_type) { register_type_ = register_type; }
+  void set_address(uint16_t address) { address_ = address; }
+  void set_value_type(ValueType value_type) { value_type_ = value_type; }
+  // Poll period in ms; 0 uses the hub's update interval
+  void set_update_interval(uint32_t update_interval) { update_interval_ = update_interval; }
+
+  RegisterType get_register_type() const { return register_type_; }
+  uint16_t get_address() const { return address_; }
+  ValueType get_value_type() const { return value_type_; }
+  uint32_t get_update_interval() const { return update_interval_; }
+
+  // Number of addresses (registers or bits) the item occupies
+  uint16_t get_width() const { return is_bit_type(register_type_) ? 1 : register_count(value_type_); }
+  // First address behind the item. 32 bits, an item at the top of the table ends at 0x10000
+  uint32_t get_end() const { return static_cast<uint32_t>(address_) + get_width(); }
+
+  // Called with the raw bits whenever a response covering the item arrives (see ReadPlanner::decode_raw).
+  // Decodes them and hands the value on to on_value().
+  virtual void on_raw(uint32_t raw);
+  // Called with the decoded value whenever a response covering the item arrives
+  virtual void on_value(float value) = 0;
+
+ protected:
+  RegisterType register_type_{RegisterType::HOLDING};
+  uint16_t address_{0};
+  ValueType value_type_{ValueType::U_WORD};
+  uint32_t update_interval_{0};
+};
+
+// One contiguous read request covering one or more items
+struct ReadRange {
+  RegisterType type;
+  uint16_t start;
+  uint16_t count;
+  std::vector<uint16_t> items;  // indices into the item list the range was planned from
+
+  uint8_t function_code() const;
+  // Number of data bytes a valid response carries
+  uint16_t byte_count() const { return is_bit_type(type) ? (count + 7) / 8 : count * 2; }
+};
+
+// ReadPlanner: merges configured registers into the smallest set of contiguous read requests
+class ReadPlanner {
+ public:
+  // Upper bound of registers in one request (Modbus allows 125 for FC03/FC04)
+  void set_max_registers(uint16_t max_registers);
+  // Number of unused addresses allowed between two items to still share a request
+  void set_max_gap(uint16_t max_gap) { max_gap_ = max_gap; }
+
+  uint16_t get_max_registers() const { return max_registers_; }
+  uint16_t get_max_gap() const { return max_gap_; }
+
+  // plan: build the request list for the given items
+  std::vector<ReadRange> plan(const std::vector<RegisterItem *> &items) const;
+
+  // decode: extract the value of an item from the response to the range containing it.
+  // Returns false if the response is too short for the item.
+  static bool decode(ModbusMessage &response, const ReadRange &range, const RegisterItem &item, float &value);
+
+  // decode_raw: like decode, but return the item's bits as they are: 0 or 1 for coils and discrete
+  // inputs, the register word for 16-bit types, both words high word first for 32-bit types.
+  static bool decode_raw(ModbusMessage &response, const ReadRange &range, const RegisterItem &item, uint32_t &raw);
+
+  // to_value: convert the raw register bits of a value of the given type
+  static float to_value(ValueType value_type, uint32_t raw);
+
+  // encode: convert a value into the register words of the given type. Returns the number of words.
+  static uint8_t encode(ValueType value_type, float value, uint16_t *words);
+
+ protected:
+  // Upper bound for coils and discrete inputs (FC01/FC02)
+  static const uint16_t MAX_BITS = 2000;
+
+  uint16_t max_registers_{125};
+  uint16_t max_gap_{0};
+};
+
+}  // namespace modbus_tcp
+}  // namespace esphome
@@ -0,0 +1,66 @@
+#include "scan_scheduler.h"
+#include "esphome/core/log.h"
+
+static const char *TAG = "modbus_tcp.scheduler";
+
+namespace esphome {
+namespace modbus_tcp {
+
+void ScanScheduler::build(const std::vector<RegisterItem *> &items, uint32_t default_interval, uint32_t now) {
+  groups_.clear();
+  deadlines_ = std::priority_queue<Deadline>();
+
+  for (RegisterItem *item : items) {
+    uint32_t interval = item->get_update_interval();
+    if (interval == 0)
+      interval = default_interval;
+
+    // Find the group for the interval, or open a new one
+    uint8_t group = 0;
+    while (group < groups_.size() && groups_[group].interval != interval)
+      group++;
+    if (group == groups_.size()) {
+      if (groups_.size() == MAX_GROUPS) {
+        // Out of groups: poll with the fastest existing group rather than not at all
+        ESP_LOGW(TAG, "More than %u update intervals, %u ms polled faster", MAX_GROUPS, interval);
+        group = 0;
+        for (uint8_t g = 1; g < groups_.size(); g++) {
+          if (groups_[g].interval < groups_[group].interval)
+            group = g;
+        }
+      } else {
+        groups_.push_back(Group{interval, {}});
+        deadlines_.push(Deadline{now, group});
+      }
+    }
+    groups_[group].items.push_back(item);
+  }
+}
+
+uint32_t ScanScheduler::due(uint32_t now) {
+  uint32_t mask = 0;
+  while (!deadlines_.empty() && static_cast<int32_t>(now - deadlines_.top().time) >= 0) {
+    Deadline deadline = deadlines_.top();
+    deadlines_.pop();
+    mask |= 1UL << deadline.group;
+
+    // Keep the cadence, but do not try to catch up on missed runs
+    deadline.time += groups_[deadline.group].interval;
+    if (static_cast<int32_t>(now - deadline.time) >= 0)
+      deadline.time = now + groups_[deadline.group].interval;
+    deadlines_.push(deadline);
+  }
+  return mask;
+}
+
+std::vector<RegisterItem *> ScanScheduler::items(uint32_t mask) const {
+  std::vector<RegisterItem *> result;
+  for (uint8_t group = 0; group < groups_.size(); group++) {
+    if (mask & (1UL << group))
+      result.insert(result.end(), groups_[group].items.begin(), groups_[group].items.end());
+  }
+  return result;
+}
+
+}  // namespace modbus_tcp
+}  // namespace esphome
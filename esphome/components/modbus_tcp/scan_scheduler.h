@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <queue>
+#include <vector>
+#include "read_planner.h"
+
+namespace esphome {
+namespace modbus_tcp {
+
+// ScanScheduler: groups items by update interval and keeps the groups ordered by
+// their next deadline. Groups falling due in the same tick are reported together,
+// so the hub can merge them into one batch of requests.
+class ScanScheduler {
+ public:
+  // At most this many distinct update intervals; due() reports groups as a bit mask
+  static const uint8_t MAX_GROUPS = 32;
+
+  // build: (re-)create the groups from the items; every group is due immediately
+  void build(const std::vector<RegisterItem *> &items, uint32_t default_interval, uint32_t now);
+
+  // due: return the mask of groups whose deadline has passed and schedule their next run
+  uint32_t due(uint32_t now);
+
+  // items: collect the items of all groups in the mask
+  std::vector<RegisterItem *> items(uint32_t mask) const;
+
+  uint8_t get_group_count() const { return groups_.size(); }
+  uint32_t get_group_interval(uint8_t group) const { return groups_[group].interval; }
+
+ protected:
+  struct Group {
+    uint32_t interval;
+    std::vector<RegisterItem *> items;
+  };
+
+  struct Deadline {
+    uint32_t time;
+    uint8_t group;
+    // Earliest deadline on top; the signed difference keeps the order across millis() wrap-around
+    bool operator<(const Deadline &other) const { return static_cast<int32_t>(time - other.time) > 0; }
+  };
+
+  std::vector<Group> groups_;
+  std::priority_queue<Deadline> deadlines_;
+};
+
+}  // namespace modbus_tcp
+}  // namespace esphome
@@ -0,0 +1,108 @@
+// =================================================================================================
+// eModbus host tests: heap allocations per request and response in ModbusClientTCPasync
+// =================================================================================================
+#include <cstdlib>
+#include <new>
+#include "ModbusClientTCPasync.h"
+#include "Logging.h"
+#include "TestUtils.h"
+
+// Count all allocations made through operator new
+static long allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+class TestClient : public ModbusClientTCPasync {
+public:
+  using ModbusClientTCPasync::ModbusClientTCPasync;
+  using ModbusClientTCPasync::onConnected;
+  using ModbusClientTCPasync::onPacket;
+  using ModbusClientTCPasync::MTA_client;
+};
+
+// Allocations counted for a number of transactions
+struct Counts {
+  double request;       // Per addRequest() call
+  double response;      // Per response received
+};
+
+// Allocations expected. Built with MODBUS_INLINE_MESSAGES=1, no message touches the heap.
+// Else building a request message takes 5: its parameter check and the growing vector.
+// Queueing it adds 1 for the copy, none if the message is moved or built by addRequest().
+constexpr double builtRequest = MODBUS_INLINE_MESSAGES ? 0 : 5;
+constexpr double copiedRequest = MODBUS_INLINE_MESSAGES ? 0 : 6;
+constexpr double messageResponse = MODBUS_INLINE_MESSAGES ? 0 : 1;   // Message built for the handler
+
+// How the request is handed to addRequest()
+enum RequestKind { COPIED, MOVED, BUILT };
+
+// run: add a READ_HOLD_REGISTER request and feed its response split across two packets, n times
+static Counts run(TestClient& client, int n, RequestKind kind = COPIED) {
+  long inRequest = 0;
+  long inResponse = 0;
+  for (int i = 0; i < n; ++i) {
+    long a0 = allocations;
+    if (kind == COPIED) {
+      ModbusMessage request(1, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)1);
+      client.addRequest(request, (uint32_t)i);
+    } else if (kind == MOVED) {
+      ModbusMessage request(1, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)1);
+      client.addRequest(std::move(request), (uint32_t)i);
+    } else {
+      client.addRequest((uint32_t)i, 1, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)1);
+    }
+    long a1 = allocations;
+    // Answer with the transaction ID of the request just sent
+    const uint8_t *sent = client.MTA_client.segment.data();
+    uint8_t response[] = { sent[0], sent[1], 0, 0, 0, 5, 1, READ_HOLD_REGISTER, 2, 0, (uint8_t)i };
+    client.onPacket(response, 5);
+    client.onPacket(response + 5, 6);
+    inRequest += a1 - a0;
+    inResponse += allocations - a1;
+  }
+  return { static_cast<double>(inRequest) / n, static_cast<double>(inResponse) / n };
+}
+
+int main() {
+  MBUlogLvl = LOG_LEVEL_NONE;
+  int answered = 0;
+
+  TestClient viewClient(IPAddress(192, 168, 1, 10), 502, 8);
+  viewClient.onDataHandler([&answered](const ModbusMessageView& response, uint32_t token) {
+    if (response[4] == (token & 0xFF)) answered++;
+  });
+  viewClient.onConnected();
+  // First requests may allocate what is kept for all later ones
+  run(viewClient, 10);
+  Counts view = run(viewClient, 1000);
+  printf("View handler:    %.2f allocations per request, %.2f per response\n", view.request, view.response);
+  CHECK(view.response == 0);
+
+  TestClient messageClient(IPAddress(192, 168, 1, 10), 502, 8);
+  messageClient.onDataHandler([&answered](ModbusMessage response, uint32_t token) {
+    if (response[4] == (token & 0xFF)) answered++;
+  });
+  messageClient.onConnected();
+  run(messageClient, 10);
+  Counts message = run(messageClient, 1000);
+  printf("Message handler: %.2f allocations per request, %.2f per response\n", message.request, message.response);
+  CHECK(message.response == messageResponse);
+  CHECK(answered == 2020);
+
+  Counts moved = run(viewClient, 1000, MOVED);
+  Counts built = run(viewClient, 1000, BUILT);
+  printf("Moved request:   %.2f allocations per request\n", moved.request);
+  printf("Built request:   %.2f allocations per request\n", built.request);
+  CHECK(view.request == copiedRequest);
+  CHECK(moved.request == builtRequest);
+  CHECK(built.request == builtRequest);
+
+  return testResult("AsyncAllocationTest");
+}
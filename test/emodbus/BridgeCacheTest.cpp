@@ -0,0 +1,148 @@
+// =================================================================================================
+// eModbus host tests: read response cache of ModbusBridge
+// =================================================================================================
+#include "BridgeTestUtils.h"
+#include "TestUtils.h"
+
+static ModbusMessage read(uint8_t functionCode, uint16_t address, uint16_t count) {
+  return ModbusMessage(4, functionCode, address, count);
+}
+
+static ModbusMessage write(uint16_t address, uint16_t value) {
+  return ModbusMessage(4, WRITE_HOLD_REGISTER, address, value);
+}
+
+static void testSyncForwarding() {
+  ModbusBridge<TestServer> bridge;
+  // Declared after the bridge, to be gone first
+  FakeClient client;
+  bridge.attachServer(4, 1, READ_HOLD_REGISTER, &client);
+  bridge.addFunctionCode(4, READ_COIL);
+  bridge.addFunctionCode(4, READ_INPUT_REGISTER);
+  bridge.addFunctionCode(4, WRITE_HOLD_REGISTER);
+
+  // No cache: every read goes to the server
+  bridge.localRequest(read(READ_HOLD_REGISTER, 100, 10));
+  bridge.localRequest(read(READ_HOLD_REGISTER, 100, 10));
+  CHECK(client.requests == 2);
+
+  bridge.setCacheTTL(4, 10000);
+  client.requests = 0;
+  ModbusMessage response = bridge.localRequest(read(READ_HOLD_REGISTER, 100, 10));
+  CHECK(response == client.respondTo(read(READ_HOLD_REGISTER, 100, 10)));
+  CHECK(client.requests == 1);
+  // Same range and all parts of it come from the cache
+  for (uint16_t start = 100; start < 110; ++start) {
+    for (uint16_t count = 1; start + count <= 110; ++count) {
+      CHECK(bridge.localRequest(read(READ_HOLD_REGISTER, start, count)) == client.respondTo(read(READ_HOLD_REGISTER, start, count)));
+    }
+  }
+  CHECK(client.requests == 1);
+  // Partly outside, other function code
+  bridge.localRequest(read(READ_HOLD_REGISTER, 108, 4));
+  CHECK(client.requests == 2);
+  bridge.localRequest(read(READ_INPUT_REGISTER, 100, 2));
+  CHECK(client.requests == 3);
+
+  // Coils: the bits of parts must be shifted down to bit 0
+  client.requests = 0;
+  CHECK(bridge.localRequest(read(READ_COIL, 5, 20)) == client.respondTo(read(READ_COIL, 5, 20)));
+  for (uint16_t start = 5; start < 25; ++start) {
+    for (uint16_t count = 1; start + count <= 25; ++count) {
+      CHECK(bridge.localRequest(read(READ_COIL, start, count)) == client.respondTo(read(READ_COIL, start, count)));
+    }
+  }
+  CHECK(client.requests == 1);
+
+  // A write empties the cache, the new values are read
+  CHECK(bridge.localRequest(write(100, 0x4242)) == write(100, 0x4242));
+  CHECK(client.requests == 2);
+  CHECK(bridge.localRequest(read(READ_HOLD_REGISTER, 103, 4)) == client.respondTo(read(READ_HOLD_REGISTER, 103, 4)));
+  CHECK(bridge.localRequest(read(READ_COIL, 9, 11)) == client.respondTo(read(READ_COIL, 9, 11)));
+  CHECK(client.requests == 4);
+
+  // Error responses are not cached
+  client.requests = 0;
+  CHECK(bridge.localRequest(read(READ_HOLD_REGISTER, 995, 10)).getError() == ILLEGAL_DATA_ADDRESS);
+  CHECK(bridge.localRequest(read(READ_HOLD_REGISTER, 995, 10)).getError() == ILLEGAL_DATA_ADDRESS);
+  CHECK(client.requests == 2);
+
+  // Entries expire after the TTL
+  bridge.setCacheTTL(4, 100);
+  client.requests = 0;
+  bridge.localRequest(read(READ_HOLD_REGISTER, 0, 2));
+  bridge.localRequest(read(READ_HOLD_REGISTER, 0, 2));
+  CHECK(client.requests == 1);
+  delay(150);
+  bridge.localRequest(read(READ_HOLD_REGISTER, 0, 2));
+  CHECK(client.requests == 2);
+
+  // Full cache: the oldest entry is replaced
+  bridge.setCacheTTL(4, 10000, 2);
+  client.requests = 0;
+  bridge.localRequest(read(READ_HOLD_REGISTER, 0, 2));
+  delay(2);
+  bridge.localRequest(read(READ_HOLD_REGISTER, 10, 2));
+  delay(2);
+  bridge.localRequest(read(READ_HOLD_REGISTER, 20, 2));
+  CHECK(client.requests == 3);
+  bridge.localRequest(read(READ_HOLD_REGISTER, 10, 2));
+  bridge.localRequest(read(READ_HOLD_REGISTER, 20, 2));
+  CHECK(client.requests == 3);
+  bridge.localRequest(read(READ_HOLD_REGISTER, 0, 2));
+  CHECK(client.requests == 4);
+
+  // TTL 0 switches the cache off
+  bridge.setCacheTTL(4, 0);
+  client.requests = 0;
+  bridge.localRequest(read(READ_HOLD_REGISTER, 0, 2));
+  bridge.localRequest(read(READ_HOLD_REGISTER, 0, 2));
+  CHECK(client.requests == 2);
+}
+
+static void testAsyncForwarding() {
+  AsyncBridge bridge;
+  FakeClient client;
+  bridge.attachServer(4, 1, READ_HOLD_REGISTER, &client);
+  bridge.addFunctionCode(4, WRITE_HOLD_REGISTER);
+  bridge.setAsyncForwarding();
+  bridge.setCacheTTL(4, 10000);
+  ModbusMessage response;
+
+  // A miss waits for the server, then the read is served from the cache right away
+  bridge.request(1, read(READ_HOLD_REGISTER, 50, 2));
+  CHECK(!bridge.answered(1));
+  CHECK(client.queue.size() == 1);
+  client.answer(0);
+  CHECK(bridge.answered(1, &response) && response == client.respondTo(read(READ_HOLD_REGISTER, 50, 2)));
+  bridge.request(2, read(READ_HOLD_REGISTER, 51, 1));
+  CHECK(bridge.answered(2, &response) && response == client.respondTo(read(READ_HOLD_REGISTER, 51, 1)));
+  CHECK(client.queue.size() == 1);
+
+  // A response arriving after a write was sent is not cached - it may be stale already
+  bridge.request(3, read(READ_HOLD_REGISTER, 60, 2));
+  bridge.request(4, write(60, 1));
+  client.answer(1);
+  client.answer(2);
+  CHECK(bridge.answered(3) && bridge.answered(4));
+  bridge.request(5, read(READ_HOLD_REGISTER, 60, 2));
+  CHECK(!bridge.answered(5));
+  CHECK(client.queue.size() == 4);
+  client.answer(3);
+  CHECK(bridge.answered(5, &response) && response == client.respondTo(read(READ_HOLD_REGISTER, 60, 2)));
+
+  // Failed requests are answered with the error and not cached
+  bridge.request(6, read(READ_HOLD_REGISTER, 70, 2));
+  client.fail(4, TIMEOUT);
+  CHECK(bridge.answered(6, &response) && response.getError() == TIMEOUT);
+  client.full = true;
+  bridge.request(7, read(READ_HOLD_REGISTER, 70, 2));
+  CHECK(bridge.answered(7, &response) && response.getError() == REQUEST_QUEUE_FULL);
+}
+
+int main() {
+  testSyncForwarding();
+  testAsyncForwarding();
+
+  return testResult("BridgeCacheTest");
+}
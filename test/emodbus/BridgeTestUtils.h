@@ -0,0 +1,149 @@
+// =================================================================================================
+// eModbus host tests: a server without connections and a client answering like a device would,
+// to test ModbusBridge
+// =================================================================================================
+#ifndef _BRIDGE_TEST_UTILS_H
+#define _BRIDGE_TEST_UTILS_H
+
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "ModbusBridgeTemp.h"
+
+// TestServer: requests are handed in directly by localRequest() or callWorker()
+class TestServer : public ModbusServer {
+public:
+  using ModbusServer::callWorker;
+
+protected:
+  void isInstance() override { }
+};
+
+// Collector: keeps the responses delivered by async workers, by tag
+class Collector : public ModbusResponseSink {
+public:
+  std::map<uint32_t, ModbusMessage> responses;
+
+protected:
+  void send(uint32_t tag, const ModbusMessage& response) override { responses[tag] = response; }
+};
+
+// FakeClient: answers like a device with 1000 coils, discrete inputs, holding and input registers.
+// Register n holds n + 0x100 * version, coil n is set if (n + version) % 3 == 0. Each write
+// increments version, so stale data is recognized. syncRequests are answered right away,
+// addRequests with a completion handler are queued until answer() is called for them.
+class FakeClient : public ModbusClient {
+public:
+  FakeClient() : requests(0), version(0), full(false) { }
+
+  // respondTo: the device's response to msg, without counting it as a request
+  ModbusMessage respondTo(const ModbusMessage& msg) {
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    uint16_t address = 0;
+    uint16_t count = 0;
+    msg.get(2, address, count);
+    ModbusMessage response;
+    switch (functionCode) {
+    case READ_COIL:
+    case READ_DISCR_INPUT:
+    case READ_HOLD_REGISTER:
+    case READ_INPUT_REGISTER:
+      if (count < 1 || address + count > 1000) {
+        response.setError(serverID, functionCode, ILLEGAL_DATA_ADDRESS);
+      } else if (functionCode <= READ_DISCR_INPUT) {
+        uint8_t bytes = (count + 7) >> 3;
+        response.add(serverID, functionCode, bytes);
+        for (uint8_t i = 0; i < bytes; ++i) {
+          uint8_t b = 0;
+          for (uint8_t j = 0; j < 8 && i * 8 + j < count; ++j) {
+            if ((address + i * 8 + j + version) % 3 == 0) b |= (1 << j);
+          }
+          response.add(b);
+        }
+      } else {
+        response.add(serverID, functionCode, static_cast<uint8_t>(count * 2));
+        for (uint16_t i = 0; i < count; ++i) {
+          response.add(static_cast<uint16_t>(address + i + 0x100 * version));
+        }
+      }
+      break;
+    case WRITE_HOLD_REGISTER:
+      version++;
+      response = msg;
+      break;
+    default:
+      response.setError(serverID, functionCode, ILLEGAL_FUNCTION);
+      break;
+    }
+    return response;
+  }
+
+  // answer: complete the queued request i with the device's response. A request not queued
+  // is ignored - the response the test waits for is missing then.
+  void answer(size_t i) {
+    if (i >= queue.size()) return;
+    complete(0, queue[i].second, respondTo(queue[i].first));
+  }
+
+  // fail: complete the queued request i with an error
+  void fail(size_t i, Error error) {
+    if (i >= queue.size()) return;
+    ModbusMessage response;
+    response.setError(queue[i].first.getServerID(), queue[i].first.getFunctionCode(), error);
+    complete(0, queue[i].second, response);
+  }
+
+  int requests;                   // Number of requests sent to the device
+  uint16_t version;               // Number of writes to the device
+  bool full;                      // Queue is full, addRequests are refused
+  std::vector<std::pair<ModbusMessage, MBOnDone>> queue;   // Requests with completion handler
+
+protected:
+  void isInstance() override { }
+
+  Error addRequestM(ModbusMessage, uint32_t) override { return SUCCESS; }
+
+  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t, uint32_t) override {
+    requests++;
+    return respondTo(msg);
+  }
+
+  Error addRequestD(ModbusMessage msg, uint32_t, MBOnDone&& onDone) override {
+    if (full) return REQUEST_QUEUE_FULL;
+    requests++;
+    queue.emplace_back(std::move(msg), std::move(onDone));
+    return SUCCESS;
+  }
+};
+
+// AsyncBridge: bridge forwarding asynchronously, with the responses collected
+struct AsyncBridge : public ModbusBridge<TestServer> {
+  AsyncBridge() : sink(std::make_shared<Collector>()) { }
+
+  // request: hand in msg, the response will be found under tag in sink->responses
+  void request(uint32_t tag, ModbusMessage msg) {
+    ModbusMessage response;
+    if (!callWorker(ModbusMessageView(msg), response, sink, tag)) {
+      response.setError(msg.getServerID(), msg.getFunctionCode(), ILLEGAL_FUNCTION);
+    }
+    // Answered right away?
+    if (response.size() && !(response[0] == 0xFF && response[1] == 0xF0)) {
+      sink->responses[tag] = response;
+    }
+  }
+
+  // answered: true if there is a response for tag, that is taken then
+  bool answered(uint32_t tag, ModbusMessage *response = nullptr) {
+    auto it = sink->responses.find(tag);
+    if (it == sink->responses.end()) return false;
+    if (response) *response = it->second;
+    sink->responses.erase(it);
+    return true;
+  }
+
+  std::shared_ptr<Collector> sink;
+};
+
+#endif
@@ -0,0 +1,111 @@
+// =================================================================================================
+// eModbus host tests: a Client connected to a Modbus TCP device, for the Linux target
+// =================================================================================================
+#ifndef _MOCK_CONNECTION_H
+#define _MOCK_CONNECTION_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>      // NOLINT
+#include <utility>
+#include <vector>
+#include "options.h"
+#include "Client.h"
+
+// MockConnection: every request is answered after latency ms, unless the device is silent.
+// The response to a READ_HOLD_REGISTER request holds the address requested as value.
+// All requests written are recorded with the port of the target they were sent to.
+class MockConnection : public Client {
+public:
+  MockConnection() : connects(0), latency(0), silent(false), isConnected(false), port(0) { }
+
+  int connect(IPAddress ip, uint16_t p) override {
+    std::lock_guard<std::mutex> lock(m);
+    connects++;
+    isConnected = true;
+    port = p;
+    return 1;
+  }
+
+  size_t write(const uint8_t *buffer, size_t size) override {
+    std::lock_guard<std::mutex> lock(m);
+    if (size < 12) return size;
+    uint16_t address = (buffer[8] << 8) | buffer[9];
+    sent.push_back({ port, address });
+    if (!silent) {
+      // MBAP header with the transaction ID, server ID, function code, 2 bytes, the address
+      std::vector<uint8_t> response = { buffer[0], buffer[1], 0, 0, 0, 5, buffer[6], buffer[7], 2, buffer[8], buffer[9] };
+      pending.push_back({ static_cast<uint64_t>(millis()) + latency, response });
+    }
+    return size;
+  }
+
+  int available() override {
+    std::lock_guard<std::mutex> lock(m);
+    deliver();
+    return rx.size();
+  }
+
+  int read() override {
+    std::lock_guard<std::mutex> lock(m);
+    deliver();
+    if (rx.empty()) return -1;
+    int c = rx.front();
+    rx.pop_front();
+    return c;
+  }
+
+  int read(uint8_t *buffer, size_t size) override {
+    std::lock_guard<std::mutex> lock(m);
+    deliver();
+    size_t n = 0;
+    while (n < size && !rx.empty()) {
+      buffer[n++] = rx.front();
+      rx.pop_front();
+    }
+    return n ? n : -1;
+  }
+
+  void flush() override { }
+
+  void stop() override {
+    std::lock_guard<std::mutex> lock(m);
+    isConnected = false;
+    pending.clear();
+    rx.clear();
+  }
+
+  uint8_t connected() override {
+    std::lock_guard<std::mutex> lock(m);
+    return isConnected;
+  }
+
+  // requestsSent: the (port, address) pairs of all requests written so far
+  std::vector<std::pair<uint16_t, uint16_t>> requestsSent() {
+    std::lock_guard<std::mutex> lock(m);
+    return sent;
+  }
+
+  std::atomic<int> connects;      // Number of connect() calls
+  std::atomic<uint32_t> latency;  // Time in ms the device takes to respond
+  std::atomic<bool> silent;       // The device does not respond at all
+
+protected:
+  // deliver: move the responses that are due into the receive buffer. Called with m held
+  void deliver() {
+    uint64_t now = millis();
+    while (!pending.empty() && pending.front().first <= now) {
+      rx.insert(rx.end(), pending.front().second.begin(), pending.front().second.end());
+      pending.pop_front();
+    }
+  }
+
+  std::mutex m;                   // Covers all below - the client's worker and the test access them
+  bool isConnected;
+  uint16_t port;                  // Port of the target connected to
+  std::vector<std::pair<uint16_t, uint16_t>> sent;
+  std::deque<std::pair<uint64_t, std::vector<uint8_t>>> pending;   // Responses, with time they are due
+  std::deque<uint8_t> rx;         // Response bytes ready to be read
+};
+
+#endif
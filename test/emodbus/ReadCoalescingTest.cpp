@@ -0,0 +1,236 @@
+// =================================================================================================
+// eModbus host tests: identical reads sharing a request, in ModbusBridge, ModbusClientTCP and
+// ModbusClientRTU
+// =================================================================================================
+#include <algorithm>
+#include <vector>
+#include "BridgeTestUtils.h"
+#include "ModbusClientRTU.h"
+#include "TestUtils.h"
+
+static ModbusMessage read(uint8_t functionCode, uint16_t address, uint16_t count) {
+  return ModbusMessage(4, functionCode, address, count);
+}
+
+// Bridge: reads arriving while the same read is on its way get its response
+static void testBridge() {
+  AsyncBridge bridge;
+  FakeClient client;
+  bridge.attachServer(4, 1, READ_HOLD_REGISTER, &client);
+  bridge.addFunctionCode(4, READ_INPUT_REGISTER);
+  bridge.addFunctionCode(4, WRITE_HOLD_REGISTER);
+  bridge.setAsyncForwarding();
+  bridge.setReadCoalescing(4);
+  ModbusMessage response;
+
+  // Tags 1..3 share a request, the other range and function code do not
+  bridge.request(1, read(READ_HOLD_REGISTER, 10, 2));
+  bridge.request(2, read(READ_HOLD_REGISTER, 10, 2));
+  bridge.request(3, read(READ_HOLD_REGISTER, 10, 2));
+  bridge.request(4, read(READ_HOLD_REGISTER, 10, 3));
+  bridge.request(5, read(READ_INPUT_REGISTER, 10, 2));
+  CHECK(client.queue.size() == 3);
+  client.answer(0);
+  for (uint32_t tag = 1; tag <= 3; ++tag) {
+    CHECK(bridge.answered(tag, &response) && response == client.respondTo(read(READ_HOLD_REGISTER, 10, 2)));
+  }
+  CHECK(!bridge.answered(4) && !bridge.answered(5));
+  client.answer(1);
+  client.answer(2);
+  CHECK(bridge.answered(4) && bridge.answered(5));
+
+  // The request is done - the next read goes out again
+  bridge.request(6, read(READ_HOLD_REGISTER, 10, 2));
+  CHECK(client.queue.size() == 4);
+  client.answer(3);
+  CHECK(bridge.answered(6));
+
+  // A read after a write does not join one sent before it
+  bridge.request(7, read(READ_HOLD_REGISTER, 20, 2));
+  bridge.request(8, ModbusMessage(4, WRITE_HOLD_REGISTER, (uint16_t)20, (uint16_t)1));
+  bridge.request(9, read(READ_HOLD_REGISTER, 20, 2));
+  CHECK(client.queue.size() == 7);
+  client.answer(4);
+  client.answer(5);
+  CHECK(bridge.answered(7) && bridge.answered(8) && !bridge.answered(9));
+  client.answer(6);
+  CHECK(bridge.answered(9, &response) && response == client.respondTo(read(READ_HOLD_REGISTER, 20, 2)));
+
+  // Errors are shared as well
+  bridge.request(10, read(READ_HOLD_REGISTER, 30, 2));
+  bridge.request(11, read(READ_HOLD_REGISTER, 30, 2));
+  CHECK(client.queue.size() == 8);
+  client.fail(7, TIMEOUT);
+  CHECK(bridge.answered(10, &response) && response.getError() == TIMEOUT);
+  CHECK(bridge.answered(11, &response) && response.getError() == TIMEOUT);
+
+  // Switched off, every read goes out
+  bridge.setReadCoalescing(4, false);
+  bridge.request(12, read(READ_HOLD_REGISTER, 40, 2));
+  bridge.request(13, read(READ_HOLD_REGISTER, 40, 2));
+  CHECK(client.queue.size() == 10);
+  client.answer(8);
+  client.answer(9);
+  CHECK(bridge.answered(12) && bridge.answered(13));
+}
+
+// NullClient: a connection that is never used
+class NullClient : public Client {
+public:
+  int connect(IPAddress, uint16_t) override { return 1; }
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t *, size_t size) override { return size; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int read(uint8_t *, size_t) override { return 0; }
+  int peek() override { return -1; }
+  void flush() override { }
+  void stop() override { }
+  uint8_t connected() override { return 1; }
+  operator bool() override { return true; }
+};
+
+// TestClientTCP: the steps the worker task takes to send requests and process their responses
+class TestClientTCP : public ModbusClientTCP {
+public:
+  explicit TestClientTCP(Client& client) : ModbusClientTCP(client, 20) { }
+  using ModbusClientTCP::RequestEntry;
+  using ModbusClientTCP::nextRequest;
+
+  // sendNext: take the next request as if it was sent. nullptr if there is none
+  RequestEntry *sendNext() {
+    RequestEntry *request = nextRequest();
+    if (request) {
+      takeRequest(request);
+      inflight.push_back(request);
+    }
+    return request;
+  }
+
+  // receive: the response to request has come in
+  void receive(RequestEntry *request, ModbusMessage response) {
+    inflight.erase(std::find(inflight.begin(), inflight.end(), request));
+    respond(request, response);
+    releaseSlot(request);
+  }
+
+  // freeSlots: number of request slots not in use
+  int freeSlots() {
+    std::vector<uint16_t> slots;
+    uint16_t slot;
+    while (MT_freeSlots.pop(slot)) slots.push_back(slot);
+    for (uint16_t s : slots) MT_freeSlots.push(s);
+    return slots.size();
+  }
+};
+
+static void testClientTCP() {
+  NullClient connection;
+  TestClientTCP client(connection);
+  std::vector<uint32_t> answered;
+  client.onResponseHandler([&answered](ModbusMessage msg, uint32_t token) { answered.push_back(token); });
+  client.setTarget(IPAddress(192, 168, 1, 10), 502);
+  client.setReadCoalescing();
+  ModbusMessage response;
+  response.add((uint8_t)1, (uint8_t)READ_HOLD_REGISTER, (uint8_t)4, (uint16_t)1, (uint16_t)2);
+
+  client.addRequest(1, 1, READ_HOLD_REGISTER, 0, 2);
+  client.addRequest(2, 1, READ_HOLD_REGISTER, 0, 2);   // Joins 1
+  client.addRequest(3, 1, READ_HOLD_REGISTER, 0, 3);   // Another range
+  client.addRequest(4, 1, WRITE_HOLD_REGISTER, 0, 3);
+  client.addRequest(5, 1, READ_HOLD_REGISTER, 0, 2);   // Behind the write
+  TestClientTCP::RequestEntry *first = client.sendNext();
+  CHECK(first && first->token == 1);
+  CHECK(client.pendingRequests() == 3);
+
+  // While 1 is in flight: 6 is kept apart from 3 by the write, 7 joins 5 waiting
+  client.addRequest(6, 1, READ_HOLD_REGISTER, 0, 3);
+  client.addRequest(7, 1, READ_HOLD_REGISTER, 0, 2);
+  TestClientTCP::RequestEntry *next = client.nextRequest();
+  CHECK(next && next->token == 3);
+  CHECK(client.pendingRequests() == 4);
+  client.receive(first, response);
+  CHECK((answered == std::vector<uint32_t>{ 1, 2 }));
+
+  // Send and answer the rest, one by one
+  answered.clear();
+  while (TestClientTCP::RequestEntry *request = client.sendNext()) {
+    client.receive(request, response);
+  }
+  CHECK((answered == std::vector<uint32_t>{ 3, 4, 5, 7, 6 }));
+
+  // A read joins one in flight, but not one for another target
+  answered.clear();
+  client.addRequest(8, 1, READ_HOLD_REGISTER, 0, 2);
+  TestClientTCP::RequestEntry *inFlight = client.sendNext();
+  client.addRequest(9, 1, READ_HOLD_REGISTER, 0, 2);
+  client.setTarget(IPAddress(192, 168, 1, 11), 502);
+  client.addRequest(10, 1, READ_HOLD_REGISTER, 0, 2);
+  CHECK(client.nextRequest() && client.pendingRequests() == 1);
+  client.receive(inFlight, response);
+  CHECK((answered == std::vector<uint32_t>{ 8, 9 }));
+  client.receive(client.sendNext(), response);
+  CHECK((answered == std::vector<uint32_t>{ 8, 9, 10 }));
+
+  // Switched off, identical reads are sent each
+  client.setReadCoalescing(false);
+  client.addRequest(11, 1, READ_HOLD_REGISTER, 0, 2);
+  client.addRequest(12, 1, READ_HOLD_REGISTER, 0, 2);
+  TestClientTCP::RequestEntry *eleven = client.sendNext();
+  CHECK(client.pendingRequests() == 1);
+  client.clearQueue();
+  CHECK(!client.nextRequest());
+  client.receive(eleven, response);
+
+  // Followers have their slots back as well
+  CHECK(client.freeSlots() == 20);
+}
+
+// TestClientRTU: the queue as the worker task sees it
+class TestClientRTU : public ModbusClientRTU {
+public:
+  using ModbusClientRTU::RequestEntry;
+  using ModbusClientRTU::requests;
+  using ModbusClientRTU::respondIdentical;
+};
+
+static void testClientRTU() {
+  TestClientRTU client;
+  std::vector<uint32_t> answered;
+  client.onResponseHandler([&answered](ModbusMessage msg, uint32_t token) { answered.push_back(token); });
+  client.setReadCoalescing();
+  ModbusMessage request(1, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)2);
+  ModbusMessage response;
+  response.add((uint8_t)1, (uint8_t)READ_HOLD_REGISTER, (uint8_t)4, (uint16_t)1, (uint16_t)2);
+
+  // The front entry is the request just done
+  client.requests.emplace_back(10, ModbusMessage(request));
+  client.requests.emplace_back(11, ModbusMessage(request));
+  client.requests.emplace_back(12, ModbusMessage(2, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)2));
+  client.requests.emplace_back(13, ModbusMessage(request));
+  client.requests.emplace_back(14, ModbusMessage(1, WRITE_HOLD_REGISTER, (uint16_t)0, (uint16_t)2));
+  client.requests.emplace_back(15, ModbusMessage(request));
+  client.respondIdentical(request, response);
+  CHECK((answered == std::vector<uint32_t>{ 11, 13 }));
+  std::vector<uint32_t> left;
+  for (auto& r : client.requests) left.push_back(r.token);
+  CHECK((left == std::vector<uint32_t>{ 10, 12, 14, 15 }));
+
+  // Writes are never answered from another request
+  answered.clear();
+  client.requests.clear();
+  ModbusMessage write(1, WRITE_HOLD_REGISTER, (uint16_t)0, (uint16_t)2);
+  client.requests.emplace_back(20, ModbusMessage(write));
+  client.requests.emplace_back(21, ModbusMessage(write));
+  client.respondIdentical(write, write);
+  CHECK(answered.empty() && client.requests.size() == 2);
+  client.requests.clear();
+}
+
+int main() {
+  testBridge();
+  testClientTCP();
+  testClientRTU();
+
+  return testResult("ReadCoalescingTest");
+}
@@ -0,0 +1,158 @@
+// =================================================================================================
+// eModbus host tests: ModbusRegisterBank served by a ModbusServer
+// =================================================================================================
+#include <stdlib.h>
+#include <atomic>
+#include <thread>   // NOLINT
+#include "ModbusServer.h"
+#include "ModbusRegisterBank.h"
+#include "TestUtils.h"
+
+class TestServer : public ModbusServer {
+protected:
+  void isInstance() override { }
+};
+
+// Read requests of every possible range must give the same bits as getCoil()/getDiscreteInput()
+static void testReadBits(TestServer& server, ModbusRegisterBank& bank) {
+  srand(1);
+  for (uint16_t i = 0; i < 20; ++i) bank.setCoil(i, rand() & 1);
+  for (uint16_t i = 0; i < 10; ++i) bank.setDiscreteInput(i, rand() & 1);
+  for (uint8_t fc : { READ_COIL, READ_DISCR_INPUT }) {
+    uint16_t size = (fc == READ_COIL) ? 20 : 10;
+    for (uint16_t start = 0; start < size; ++start) {
+      for (uint16_t count = 1; start + count <= size; ++count) {
+        ModbusMessage response = server.localRequest(ModbusMessage(1, fc, start, count));
+        uint8_t bytes = (count + 7) >> 3;
+        CHECK(response.getError() == SUCCESS);
+        CHECK(response.size() == 3U + bytes);
+        CHECK(response[2] == bytes);
+        if (response.size() != 3U + bytes) continue;
+        for (uint16_t i = 0; i < bytes * 8; ++i) {
+          bool bit = response[3 + (i >> 3)] & (1 << (i & 7));
+          // Bits after the last one requested must be 0
+          bool expected = (i < count) && (fc == READ_COIL ? bank.getCoil(start + i) : bank.getDiscreteInput(start + i));
+          CHECK(bit == expected);
+        }
+      }
+    }
+  }
+  // Out of range, too many or no coils at all. Invalid requests are built from bytes,
+  // as the ModbusMessage constructors refuse them
+  CHECK(server.localRequest(ModbusMessage(1, READ_COIL, (uint16_t)15, (uint16_t)6)).getError() == ILLEGAL_DATA_ADDRESS);
+  CHECK(server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, READ_COIL, 0, 0, 0x07, 0xD1 })).getError() == ILLEGAL_DATA_VALUE);
+  CHECK(server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, READ_DISCR_INPUT, 0, 0, 0, 0 })).getError() == ILLEGAL_DATA_VALUE);
+}
+
+static void testWriteCoils(TestServer& server, ModbusRegisterBank& bank) {
+  for (uint16_t i = 0; i < 20; ++i) bank.setCoil(i, false);
+  // 10 coils from 3 on: 0xCD, 0x01 sets 3, 5, 6, 9, 10 and 11
+  ModbusMessage response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x0F, 0, 3, 0, 10, 2, 0xCD, 0x01 }));
+  CHECK(sameBytes(response, { 1, 0x0F, 0, 3, 0, 10 }));
+  for (uint16_t i = 0; i < 20; ++i) {
+    bool expected = (i == 3 || i == 5 || i == 6 || i == 9 || i == 10 || i == 11);
+    CHECK(bank.getCoil(i) == expected);
+  }
+  // Byte count not matching the number of coils
+  response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x0F, 0, 3, 0, 10, 1, 0xFF }));
+  CHECK(response.getError() == ILLEGAL_DATA_VALUE);
+  response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x0F, 0, 3, 0, 10, 3, 0xFF, 0xFF, 0xFF }));
+  CHECK(response.getError() == ILLEGAL_DATA_VALUE);
+  // Fewer data bytes than the byte count says, no byte count at all
+  response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x0F, 0, 3, 0, 10, 2, 0xFF }));
+  CHECK(response.getError() == ILLEGAL_DATA_VALUE);
+  response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x0F, 0, 3, 0, 10 }));
+  CHECK(response.getError() == ILLEGAL_DATA_VALUE);
+  // Beyond the last coil
+  response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x0F, 0, 15, 0, 10, 2, 0xFF, 0xFF }));
+  CHECK(response.getError() == ILLEGAL_DATA_ADDRESS);
+  // None of these may have changed a coil
+  CHECK(!bank.getCoil(4) && !bank.getCoil(12) && !bank.getCoil(19));
+
+  // Single coil: only 0xFF00 and 0x0000 are allowed
+  response = server.localRequest(ModbusMessage(1, WRITE_COIL, (uint16_t)19, (uint16_t)0xFF00));
+  CHECK(sameBytes(response, { 1, WRITE_COIL, 0, 19, 0xFF, 0x00 }));
+  CHECK(bank.getCoil(19));
+  CHECK(server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, WRITE_COIL, 0, 19, 0x12, 0x34 })).getError() == ILLEGAL_DATA_VALUE);
+  CHECK(server.localRequest(ModbusMessage(1, WRITE_COIL, (uint16_t)20, (uint16_t)0xFF00)).getError() == ILLEGAL_DATA_ADDRESS);
+  CHECK(bank.getCoil(19));
+}
+
+static void testRegisters(TestServer& server, ModbusRegisterBank& bank) {
+  uint16_t values[3] = { 0x0102, 0x0304, 0x0506 };
+  ModbusMessage response = server.localRequest(ModbusMessage(1, WRITE_MULT_REGISTERS, (uint16_t)2, (uint16_t)3, (uint8_t)6, values));
+  CHECK(sameBytes(response, { 1, WRITE_MULT_REGISTERS, 0, 2, 0, 3 }));
+  CHECK(bank.getHoldingRegister(2) == 0x0102 && bank.getHoldingRegister(3) == 0x0304 && bank.getHoldingRegister(4) == 0x0506);
+  // Byte count not matching the number of registers, missing data, beyond the last register
+  response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x10, 0, 2, 0, 2, 3, 0xFF, 0xFF, 0xFF }));
+  CHECK(response.getError() == ILLEGAL_DATA_VALUE);
+  response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x10, 0, 2, 0, 2, 4, 0xFF, 0xFF }));
+  CHECK(response.getError() == ILLEGAL_DATA_VALUE);
+  response = server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x10, 0, 9, 0, 2, 4, 0xFF, 0xFF, 0xFF, 0xFF }));
+  CHECK(response.getError() == ILLEGAL_DATA_ADDRESS);
+  CHECK(bank.getHoldingRegister(2) == 0x0102 && bank.getHoldingRegister(3) == 0x0304 && bank.getHoldingRegister(9) == 0);
+
+  response = server.localRequest(ModbusMessage(1, WRITE_HOLD_REGISTER, (uint16_t)9, (uint16_t)0xBEEF));
+  CHECK(sameBytes(response, { 1, WRITE_HOLD_REGISTER, 0, 9, 0xBE, 0xEF }));
+  CHECK(bank.getHoldingRegister(9) == 0xBEEF);
+  CHECK(server.localRequest(ModbusMessage(1, WRITE_HOLD_REGISTER, (uint16_t)10, (uint16_t)1)).getError() == ILLEGAL_DATA_ADDRESS);
+
+  response = server.localRequest(ModbusMessage(1, READ_HOLD_REGISTER, (uint16_t)2, (uint16_t)3));
+  CHECK(sameBytes(response, { 1, READ_HOLD_REGISTER, 6, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 }));
+  for (uint16_t i = 0; i < 5; ++i) bank.setInputRegister(i, 0x100 + i);
+  response = server.localRequest(ModbusMessage(1, READ_INPUT_REGISTER, (uint16_t)3, (uint16_t)2));
+  CHECK(sameBytes(response, { 1, READ_INPUT_REGISTER, 4, 0x01, 0x03, 0x01, 0x04 }));
+  CHECK(server.localRequest(ModbusMessage(1, READ_INPUT_REGISTER, (uint16_t)3, (uint16_t)3)).getError() == ILLEGAL_DATA_ADDRESS);
+  CHECK(server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, READ_HOLD_REGISTER, 0, 0, 0, 0 })).getError() == ILLEGAL_DATA_VALUE);
+  CHECK(server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, READ_HOLD_REGISTER, 0, 0, 0, 126 })).getError() == ILLEGAL_DATA_VALUE);
+
+  // Application side range checks
+  CHECK(!bank.setHoldingRegisters(8, 3, values));
+  CHECK(!bank.getInputRegisters(4, 2, values));
+  CHECK(!bank.setCoil(20, true));
+}
+
+static void testRequests(TestServer& server) {
+  // Too short for address and count
+  CHECK(server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, READ_HOLD_REGISTER, 0 })).getError() == ILLEGAL_DATA_VALUE);
+  // Function codes not served by a bank, server IDs not served at all
+  CHECK(server.localRequest(ModbusMessage(std::vector<uint8_t>{ 1, 0x17, 0, 0, 0, 1 })).getError() == ILLEGAL_FUNCTION);
+  CHECK(server.localRequest(ModbusMessage(2, READ_COIL, (uint16_t)0, (uint16_t)1)).getError() == INVALID_SERVER);
+}
+
+// Registers written together by the application must never be read half old, half new
+static void testConcurrentUpdates(TestServer& server, ModbusRegisterBank& bank) {
+  std::atomic<bool> running(true);
+  std::thread writer([&] {
+    for (uint16_t x = 0; running; ++x) {
+      uint16_t pair[2] = { x, x };
+      bank.setHoldingRegisters(0, 2, pair);
+    }
+  });
+  long torn = 0;
+  ModbusMessage request(1, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)2);
+  for (int i = 0; i < 100000; ++i) {
+    ModbusMessage response = server.localRequest(request);
+    uint16_t a = 0;
+    uint16_t b = 1;
+    response.get(3, a, b);
+    if (a != b) torn++;
+  }
+  running = false;
+  writer.join();
+  CHECK(torn == 0);
+}
+
+int main() {
+  TestServer server;
+  ModbusRegisterBank bank(20, 10, 10, 5);
+  server.registerBank(1, bank);
+
+  testReadBits(server, bank);
+  testWriteCoils(server, bank);
+  testRegisters(server, bank);
+  testRequests(server);
+  testConcurrentUpdates(server, bank);
+
+  return testResult("RegisterBankTest");
+}
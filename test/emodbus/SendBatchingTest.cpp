@@ -0,0 +1,82 @@
+// =================================================================================================
+// eModbus host tests: send batching in ModbusClientTCPasync
+// =================================================================================================
+#include <vector>
+#include "ModbusClientTCPasync.h"
+#include "Logging.h"
+#include "TestUtils.h"
+
+class TestClient : public ModbusClientTCPasync {
+public:
+  using ModbusClientTCPasync::ModbusClientTCPasync;
+  using ModbusClientTCPasync::onConnected;
+  using ModbusClientTCPasync::onPacket;
+  using ModbusClientTCPasync::MTA_client;
+};
+
+// Transaction IDs of the requests in the last segment sent, in order
+static std::vector<uint16_t> segmentTIDs(TestClient& client) {
+  std::vector<uint16_t> tids;
+  const std::vector<uint8_t>& s = client.MTA_client.segment;
+  for (size_t i = 0; i + 6 <= s.size(); i += 6 + ((s[i + 4] << 8) | s[i + 5])) {
+    tids.push_back((s[i] << 8) | s[i + 1]);
+  }
+  return tids;
+}
+
+// run: queue 40 requests before the connection is up, then answer them 8 at a time in one packet.
+// Returns the number of requests answered.
+static int run(TestClient& client, std::vector<std::vector<uint16_t>>& segments) {
+  int answered = 0;
+  client.onDataHandler([&answered](const ModbusMessageView& response, uint32_t token) {
+    if (response[4] == token) answered++;
+  });
+  client.setMaxInflightRequests(8);
+  for (uint32_t i = 0; i < 40; ++i) client.addRequest(i, 1, READ_HOLD_REGISTER, (uint16_t)i, (uint16_t)1);
+  client.onConnected();
+  int sends = 0;
+  for (int round = 0; round < 40 && answered < 40; ++round) {
+    if (client.MTA_client.sends != sends) {
+      sends = client.MTA_client.sends;
+      segments.push_back(segmentTIDs(client));
+    }
+    // Answer the 8 requests in flight. Transaction IDs count up from 0 in send order
+    std::vector<uint8_t> packet;
+    for (int k = 0; k < 8; ++k) {
+      uint16_t tid = answered + k;
+      uint8_t response[] = { (uint8_t)(tid >> 8), (uint8_t)tid, 0, 0, 0, 5, 1, READ_HOLD_REGISTER, 2, 0, (uint8_t)tid };
+      packet.insert(packet.end(), response, response + sizeof(response));
+    }
+    client.onPacket(packet.data(), packet.size());
+  }
+  return answered;
+}
+
+int main() {
+  MBUlogLvl = LOG_LEVEL_NONE;
+
+  // Without batching every request is a segment of its own, written with two add() calls
+  TestClient single(IPAddress(192, 168, 1, 10), 502, 100);
+  std::vector<std::vector<uint16_t>> segments;
+  CHECK(run(single, segments) == 40);
+  printf("Batching off: add() %d, send() %d\n", single.MTA_client.adds, single.MTA_client.sends);
+  CHECK(single.MTA_client.adds == 80);
+  CHECK(single.MTA_client.sends == 40);
+
+  // With batching the 8 requests ready at a time go out together, in queue order
+  TestClient batched(IPAddress(192, 168, 1, 10), 502, 100);
+  batched.setSendBatching(true);
+  segments.clear();
+  CHECK(run(batched, segments) == 40);
+  printf("Batching on:  add() %d, send() %d\n", batched.MTA_client.adds, batched.MTA_client.sends);
+  CHECK(batched.MTA_client.adds == 5);
+  CHECK(batched.MTA_client.sends == 5);
+  CHECK(segments.size() == 5);
+  uint16_t next = 0;
+  for (auto& segment : segments) {
+    CHECK(segment.size() == 8);
+    for (uint16_t tid : segment) CHECK(tid == next++);
+  }
+
+  return testResult("SendBatchingTest");
+}
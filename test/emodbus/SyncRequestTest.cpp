@@ -0,0 +1,94 @@
+// =================================================================================================
+// eModbus host tests: ModbusClientTCP syncRequests, for the Linux target
+// =================================================================================================
+#include <chrono>     // NOLINT
+#include <thread>     // NOLINT
+#include <vector>
+#include "ModbusClientTCP.h"
+#include "MockConnection.h"
+#include "TestUtils.h"
+
+// value: the register value in a response of the mock device, which is the address requested
+static uint16_t value(const ModbusMessage& response) {
+  uint16_t v = 0xFFFF;
+  if (response.getError() == SUCCESS) response.get(3, v);
+  return v;
+}
+
+// readRegister: a syncRequest always made from here, so its SyncSlot gets the same stack address
+static __attribute__((noinline)) ModbusMessage readRegister(ModbusClientTCP& client, uint16_t address, uint32_t timeout) {
+  return client.syncRequest(ModbusMessage(1, READ_HOLD_REGISTER, address, (uint16_t)1), (uint32_t)address, timeout);
+}
+
+static long msSince(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main() {
+  MockConnection connection;
+  connection.latency = 1;
+  ModbusClientTCP client(connection);
+  // No interval between requests, so the round trip is all that is measured
+  client.setTimeout(2000, 0);
+  client.setTarget(IPAddress(192, 168, 1, 10), 502);
+  client.begin();
+
+  // The caller is woken up as soon as the response is in - no polling
+  auto t0 = std::chrono::steady_clock::now();
+  int wrong = 0;
+  for (uint16_t i = 0; i < 100; ++i) {
+    if (value(client.syncRequest(i, 1, READ_HOLD_REGISTER, i, 1)) != i) wrong++;
+  }
+  long elapsed = msSince(t0);
+  CHECK(wrong == 0);
+  printf("Sync round trip with a 1 ms device: %.1f ms\n", elapsed / 100.0);
+  CHECK(elapsed < 500);   // was > 1000 while responses were polled every 10 ms
+
+  // Concurrent callers using the same token get their own responses
+  client.setMaxInflightRequests(4);
+  std::vector<std::thread> callers;
+  std::atomic<int> mixedUp(0);
+  for (uint16_t t = 0; t < 4; ++t) {
+    callers.emplace_back([&client, &mixedUp, t] {
+      for (uint16_t i = 0; i < 25; ++i) {
+        uint16_t address = t * 100 + i;
+        if (value(client.syncRequest(42, 1, READ_HOLD_REGISTER, address, 1)) != address) mixedUp++;
+      }
+    });
+  }
+  for (auto& caller : callers) caller.join();
+  CHECK(mixedUp == 0);
+  client.setMaxInflightRequests(1);
+
+  // Timeout for this call only
+  connection.latency = 300;
+  ModbusMessage request(1, READ_HOLD_REGISTER, (uint16_t)7, (uint16_t)1);
+  t0 = std::chrono::steady_clock::now();
+  ModbusMessage response = client.syncRequest(request, (uint32_t)7, (uint32_t)50);
+  elapsed = msSince(t0);
+  CHECK(response.getError() == TIMEOUT);
+  CHECK(elapsed >= 50 && elapsed < 250);
+
+  // The late answer to it must not be taken for the next response
+  connection.latency = 1;
+  CHECK(value(client.syncRequest(8, 1, READ_HOLD_REGISTER, 8, 1)) == 8);
+  delay(400);
+  CHECK(value(client.syncRequest(9, 1, READ_HOLD_REGISTER, 9, 1)) == 9);
+
+  // The next call from the same place is queued while the request given up on is still in flight.
+  // Its slot is on the same stack address, but the late answer must not end up in it.
+  connection.latency = 300;
+  CHECK(readRegister(client, 20, 50).getError() == TIMEOUT);
+  connection.latency = 1;
+  CHECK(value(readRegister(client, 21, 2000)) == 21);
+
+  // No response at all: the default timeout
+  connection.silent = true;
+  client.setSyncTimeout(100);
+  t0 = std::chrono::steady_clock::now();
+  CHECK(client.syncRequest(10, 1, READ_HOLD_REGISTER, 10, 1).getError() == TIMEOUT);
+  CHECK(msSince(t0) < 400);
+
+  client.end();
+  return testResult("SyncRequestTest");
+}
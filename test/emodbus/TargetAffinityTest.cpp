@@ -0,0 +1,53 @@
+// =================================================================================================
+// eModbus host tests: ModbusClientTCP target affinity, for the Linux target
+// =================================================================================================
+#include <atomic>
+#include <map>
+#include "ModbusClientTCP.h"
+#include "MockConnection.h"
+#include "TestUtils.h"
+
+// run: 30 requests round-robin over three targets, sent through a single connection.
+// Returns the number of connects needed.
+static int run(uint8_t maxBatch) {
+  MockConnection connection;
+  ModbusClientTCP client(connection, 100);
+  client.setTargetAffinity(maxBatch);
+  std::atomic<int> answered(0);
+  std::atomic<int> errors(0);
+  client.onResponseHandler([&](ModbusMessage msg, uint32_t token) {
+    if (msg.getError() != SUCCESS) errors++;
+    answered++;
+  });
+  // Queue all before the worker starts, so it has the choice
+  for (uint16_t i = 0; i < 30; ++i) {
+    client.setTarget(IPAddress(192, 168, 1, 10), 502 + i % 3);
+    client.addRequest(i, 1, READ_HOLD_REGISTER, i, 1);
+  }
+  client.begin();
+  for (int wait = 0; answered < 30 && wait < 5000; ++wait) delay(1);
+  client.end();
+  CHECK(answered == 30);
+  CHECK(errors == 0);
+
+  // The requests for each target must have been sent in the order they were queued
+  std::map<uint16_t, int> last;
+  for (auto& request : connection.requestsSent()) {
+    CHECK(request.second % 3 == request.first - 502);
+    CHECK(!last.count(request.first) || last[request.first] < request.second);
+    last[request.first] = request.second;
+  }
+  CHECK(connection.requestsSent().size() == 30);
+  return connection.connects;
+}
+
+int main() {
+  // Strict FIFO: a connect for every request
+  CHECK(run(0) == 30);
+  // 4 in a row per target: 12, 12 and 6 requests, in batches of 4
+  CHECK(run(4) == 9);
+  // All for one target before the next one
+  CHECK(run(255) == 3);
+
+  return testResult("TargetAffinityTest");
+}
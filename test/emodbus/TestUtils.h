@@ -0,0 +1,33 @@
+// =================================================================================================
+// eModbus host tests: common helpers
+// =================================================================================================
+#ifndef _TEST_UTILS_H
+#define _TEST_UTILS_H
+
+#include <stdio.h>
+#include <initializer_list>
+#include "ModbusMessage.h"
+
+// Number of failed checks so far
+inline int testFailures = 0;
+
+// CHECK: count and report a failed condition, but carry on with the test
+#define CHECK(cond) do { if (!(cond)) { testFailures++; printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); } } while (0)
+
+// sameBytes: true if the message consists of exactly the bytes given
+inline bool sameBytes(const ModbusMessage& msg, std::initializer_list<uint8_t> bytes) {
+  if (msg.size() != bytes.size()) return false;
+  size_t i = 0;
+  for (uint8_t b : bytes) {
+    if (msg[i++] != b) return false;
+  }
+  return true;
+}
+
+// testResult: print the summary. To be returned from main()
+inline int testResult(const char *name) {
+  printf("%s: %s (%d failed check%s)\n", name, testFailures ? "FAILED" : "passed", testFailures, testFailures == 1 ? "" : "s");
+  return testFailures ? 1 : 0;
+}
+
+#endif
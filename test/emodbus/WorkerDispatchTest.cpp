@@ -0,0 +1,203 @@
+// =================================================================================================
+// eModbus host tests: worker lookup of ModbusServer through its dispatch tables
+// =================================================================================================
+#include <stdlib.h>
+#include <atomic>
+#include <set>
+#include <thread>     // NOLINT
+#include <utility>
+#include <vector>
+#include "ModbusServer.h"
+#include "Logging.h"
+#include "TestUtils.h"
+
+class TestServer : public ModbusServer {
+public:
+  using ModbusServer::findWorker;
+
+protected:
+  void isInstance() override { }
+};
+
+// Reference model: the workers registered, looked up like the former nested map walk did.
+// A specific server ID comes before ANY_SERVER, a specific function code before ANY_FUNCTION_CODE.
+struct Registrations {
+  std::set<std::pair<uint8_t, uint8_t>> workers;
+  std::set<uint8_t> servers;
+
+  void add(uint8_t serverID, uint8_t functionCode) {
+    workers.insert({ serverID, functionCode });
+    servers.insert(serverID);
+  }
+
+  void remove(uint8_t serverID, uint8_t functionCode) {
+    if (functionCode != ANY_FUNCTION_CODE) {
+      workers.erase({ serverID, functionCode });
+      return;
+    }
+    servers.erase(serverID);
+    for (auto it = workers.begin(); it != workers.end();) {
+      it = (it->first == serverID) ? workers.erase(it) : std::next(it);
+    }
+  }
+
+  // lookup: tag of the worker expected to answer, -1 if there is none
+  int lookup(uint8_t serverID, uint8_t functionCode) {
+    if (!servers.count(serverID)) {
+      if (!servers.count(ANY_SERVER)) return -1;
+      serverID = ANY_SERVER;
+    }
+    if (!(functionCode & 0x80) && workers.count({ serverID, functionCode })) return tag(serverID, functionCode);
+    if (workers.count({ serverID, ANY_FUNCTION_CODE })) return tag(serverID, ANY_FUNCTION_CODE);
+    return -1;
+  }
+
+  static int tag(uint8_t serverID, uint8_t functionCode) { return (serverID << 8) | functionCode; }
+};
+
+// answeredBy: tag of the worker answering serverID/functionCode, -1 if there is none
+static int answeredBy(TestServer& server, uint8_t serverID, uint8_t functionCode) {
+  const MBSworker& worker = server.getWorker(serverID, functionCode);
+  if (!worker) return -1;
+  ModbusMessage response = worker(ModbusMessage());
+  uint16_t tag = 0;
+  response.get(0, tag);
+  return tag;
+}
+
+// Random (un)registrations, after each one all combinations are compared with the reference
+static void testRandomRegistrations() {
+  TestServer server;
+  Registrations expected;
+  // Few server IDs and function codes, to have many collisions, ANY_SERVER and ANY_FUNCTION_CODE
+  const uint8_t serverIDs[] = { ANY_SERVER, 1, 2, 3, 4, 247 };
+  const uint8_t functionCodes[] = { ANY_FUNCTION_CODE, READ_COIL, READ_HOLD_REGISTER, WRITE_HOLD_REGISTER, 0x17, 0x7F };
+  const uint8_t requested[] = { 0x00, 0x01, 0x03, 0x06, 0x10, 0x17, 0x7F, 0x81, 0x83, 0xFF };
+  long mismatches = 0;
+  srand(1);
+  for (int round = 0; round < 2000; ++round) {
+    uint8_t serverID = serverIDs[rand() % 6];
+    uint8_t functionCode = functionCodes[rand() % 6];
+    if (rand() % 4) {
+      int tag = Registrations::tag(serverID, functionCode);
+      server.registerWorker(serverID, functionCode, [tag](ModbusMessage) {
+        ModbusMessage response;
+        response.add(static_cast<uint16_t>(tag));
+        return response;
+      });
+      expected.add(serverID, functionCode);
+    } else {
+      bool removed = server.unregisterWorker(serverID, functionCode);
+      bool known = (functionCode == ANY_FUNCTION_CODE) ? expected.servers.count(serverID) > 0
+                                                       : expected.workers.count({ serverID, functionCode }) > 0;
+      CHECK(removed == known);
+      expected.remove(serverID, functionCode);
+    }
+    for (uint16_t s = 0; s < 256; s += (s < 5 ? 1 : 121)) {
+      uint8_t sid = static_cast<uint8_t>(s);
+      CHECK(server.isServerFor(sid) == (expected.servers.count(sid) > 0));
+      for (uint8_t fc : requested) {
+        int tag = expected.lookup(sid, fc);
+        if (answeredBy(server, sid, fc) != tag) mismatches++;
+        if (server.isServerFor(sid, fc) != (tag >= 0)) mismatches++;
+      }
+    }
+  }
+  CHECK(mismatches == 0);
+}
+
+// Error responses for requests without a worker
+static void testErrors() {
+  TestServer server;
+  server.registerWorker(1, READ_HOLD_REGISTER, [](ModbusMessage msg) { return ECHO_RESPONSE; });
+  CHECK(server.localRequest(ModbusMessage(1, READ_INPUT_REGISTER, (uint16_t)0, (uint16_t)1)).getError() == ILLEGAL_FUNCTION);
+  CHECK(server.localRequest(ModbusMessage(2, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)1)).getError() == INVALID_SERVER);
+  // Function codes with the error bit set are not accepted for registration
+  CHECK(!server.registerWorker(1, 0x83, [](ModbusMessage msg) { return ECHO_RESPONSE; }));
+  CHECK(!server.isServerFor(1, 0x83));
+  // An ANY_SERVER worker answers for all server IDs
+  server.registerWorker(ANY_SERVER, READ_INPUT_REGISTER, [](ModbusMessage msg) { return ECHO_RESPONSE; });
+  CHECK(server.localRequest(ModbusMessage(2, READ_INPUT_REGISTER, (uint16_t)0, (uint16_t)1)).getError() == SUCCESS);
+  CHECK(server.localRequest(ModbusMessage(2, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)1)).getError() == INVALID_SERVER);
+}
+
+// registerTagWorker: register a worker answering with tag. Its data is on the heap, so a worker used after it was
+// freed is caught by the address sanitizer
+static bool registerTagWorker(TestServer& server, uint8_t serverID, uint8_t functionCode, uint8_t tag) {
+  std::vector<uint8_t> data(16, tag);
+  return server.registerWorker(serverID, functionCode, [data](ModbusMessage msg) {
+    ModbusMessage response;
+    response.add(msg.getServerID(), msg.getFunctionCode(), static_cast<uint16_t>(data[15]));
+    return response;
+  });
+}
+
+// answerTag: tag of the worker answering a local request, 0 if none did
+static uint16_t answerTag(TestServer& server, uint8_t serverID, uint8_t functionCode) {
+  ModbusMessage response = server.localRequest(ModbusMessage(serverID, functionCode, (uint16_t)0, (uint16_t)1));
+  uint16_t tag = 0;
+  if (response.getError() == SUCCESS) response.get(2, tag);
+  return tag;
+}
+
+// Workers are (un)registered while another task has requests served
+static void testRunningChanges() {
+  TestServer server;
+  registerTagWorker(server, 1, READ_HOLD_REGISTER, 1);
+  std::atomic<bool> done(false);
+  long wrong = 0;
+  long answered = 0;
+  std::thread requester([&]() {
+    while (!done) {
+      uint16_t tag = answerTag(server, 1, READ_HOLD_REGISTER);
+      if (tag > 2) wrong++;
+      if (tag) answered++;
+    }
+  });
+  for (int round = 0; round < 30000; ++round) {
+    switch (round % 3) {
+    case 0: CHECK(registerTagWorker(server, 1, READ_HOLD_REGISTER, 2)); break;
+    case 1: CHECK(server.unregisterWorker(1)); break;
+    default: CHECK(registerTagWorker(server, 1, READ_HOLD_REGISTER, 1)); break;
+    }
+  }
+  done = true;
+  requester.join();
+  CHECK(wrong == 0);
+  CHECK(answered > 0);
+  CHECK(answerTag(server, 1, READ_HOLD_REGISTER) == 1);
+
+  // A worker busy with a request finishes it, though it is unregistered meanwhile
+  struct { std::atomic<bool> started; std::atomic<bool> release; } gate { { false }, { false } };
+  std::vector<uint8_t> data(16, 7);
+  server.registerWorker(2, READ_HOLD_REGISTER, [data, &gate](ModbusMessage msg) {
+    gate.started = true;
+    while (!gate.release) std::this_thread::yield();
+    ModbusMessage response;
+    response.add(msg.getServerID(), msg.getFunctionCode(), static_cast<uint16_t>(data[15]));
+    return response;
+  });
+  uint16_t busyTag = 0;
+  std::thread busy([&]() { busyTag = answerTag(server, 2, READ_HOLD_REGISTER); });
+  while (!gate.started) std::this_thread::yield();
+  CHECK(server.unregisterWorker(2));
+  // Further changes free the registries replaced
+  registerTagWorker(server, 3, READ_HOLD_REGISTER, 3);
+  CHECK(server.unregisterWorker(3));
+  gate.release = true;
+  busy.join();
+  CHECK(busyTag == 7);
+  CHECK(!server.isServerFor(2));
+  CHECK(answerTag(server, 2, READ_HOLD_REGISTER) == 0);
+}
+
+int main() {
+  // The refused registrations would log errors
+  MBUlogLvl = LOG_LEVEL_NONE;
+
+  testRandomRegistrations();
+  testErrors();
+  testRunningChanges();
+
+  return testResult("WorkerDispatchTest");
+}
@@ -0,0 +1,62 @@
+// =================================================================================================
+// eModbus host benchmark: calling handlers held in InlineFunction and std::function
+// =================================================================================================
+#include <chrono>     // NOLINT
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include "InlineFunction.h"
+
+// Count all allocations made through operator new
+static long allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+typedef void Handler(uint32_t, uint32_t);
+
+// Not inlined, so the compiler can not see through the call
+template <typename T> __attribute__((noinline)) void call(const T& f, uint32_t i) { f(i, 1); }
+// What getWorker() did before: hand out a copy of the std::function
+template <typename T> __attribute__((noinline)) void copyAndCall(const T& f, uint32_t i) { T copy = f; copy(i, 1); }
+
+static const int ROUNDS = 100000000;
+
+template <typename T, typename Caller>
+static void measure(const char *name, const T& f, Caller caller) {
+  long a0 = allocations;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < ROUNDS; ++i) caller(f, i);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / ROUNDS;
+  printf("%-52s %5.2f ns, %ld allocations per call\n", name, ns, (allocations - a0) / ROUNDS);
+}
+
+int main() {
+  // A handler capturing 3 pointers
+  volatile uint64_t s1 = 0, s2 = 0, s3 = 0;
+  volatile uint64_t *a = &s1, *b = &s2, *c = &s3;
+  auto handler = [a, b, c](uint32_t x, uint32_t y) { *a += x; *b += y; *c += 1; };
+
+  long a0 = allocations;
+  InlineFunction<Handler> inlined(handler);
+  printf("Registration: InlineFunction %ld allocations, ", allocations - a0);
+  a0 = allocations;
+  std::function<Handler> standard(handler);
+  printf("std::function %ld, ", allocations - a0);
+  a0 = allocations;
+  InlineFunction<Handler> wrapped(standard);
+  printf("InlineFunction holding a std::function %ld\n", allocations - a0);
+
+  measure("InlineFunction holding the lambda", inlined, [](const InlineFunction<Handler>& f, uint32_t i) { call(f, i); });
+  measure("std::function holding the lambda", standard, [](const std::function<Handler>& f, uint32_t i) { call(f, i); });
+  measure("InlineFunction holding a std::function", wrapped, [](const InlineFunction<Handler>& f, uint32_t i) { call(f, i); });
+  measure("copying the std::function out first", standard, [](const std::function<Handler>& f, uint32_t i) { copyAndCall(f, i); });
+  return 0;
+}
@@ -0,0 +1,66 @@
+// =================================================================================================
+// eModbus host benchmark: ModbusServer worker lookup, dispatch tables against the former map walk
+// =================================================================================================
+#include <chrono>     // NOLINT
+#include <cstdio>
+#include "ModbusServer.h"
+#include "Logging.h"
+
+class TestServer : public ModbusServer {
+public:
+  using ModbusServer::findWorker;
+  using ModbusServer::WorkerEntry;
+
+  // mapLookup: the former findWorker, walking the worker map the registrations are still kept in
+  __attribute__((noinline)) WorkerEntry *mapLookup(uint8_t serverID, uint8_t functionCode) {
+    auto& workerMap = registry.load()->workers;
+    auto svmap = workerMap.find(serverID);
+    if (svmap == workerMap.end()) {
+      svmap = workerMap.find(ANY_SERVER);
+      if (svmap == workerMap.end()) return nullptr;
+    }
+    auto fcmap = svmap->second.find(functionCode);
+    if (fcmap == svmap->second.end()) {
+      fcmap = svmap->second.find(ANY_FUNCTION_CODE);
+      if (fcmap == svmap->second.end()) return nullptr;
+    }
+    return fcmap->second.get();
+  }
+
+  __attribute__((noinline)) WorkerEntry *tableLookup(uint8_t serverID, uint8_t functionCode) {
+    return findWorker(serverID, functionCode);
+  }
+
+protected:
+  void isInstance() override { }
+};
+
+static const int ROUNDS = 100000000;
+
+template <typename Lookup>
+static void measure(const char *name, Lookup lookup) {
+  long found = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  // Server IDs 0..7 and function codes 0..7: hits, ANY_* fallbacks and misses
+  for (int i = 0; i < ROUNDS; ++i) found += lookup(i & 7, (i >> 3) & 7) != nullptr;
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / ROUNDS;
+  printf("%-24s %5.2f ns per lookup (%ld found)\n", name, ns, found);
+}
+
+int main() {
+  MBUlogLvl = LOG_LEVEL_NONE;
+  TestServer server;
+  auto worker = [](ModbusMessage request) { return request; };
+  // A typical setup: a few servers with their function codes, one catching all others
+  for (uint8_t serverID = 1; serverID <= 4; ++serverID) {
+    server.registerWorker(serverID, READ_HOLD_REGISTER, worker);
+    server.registerWorker(serverID, READ_INPUT_REGISTER, worker);
+    server.registerWorker(serverID, WRITE_HOLD_REGISTER, worker);
+  }
+  server.registerWorker(5, ANY_FUNCTION_CODE, worker);
+  server.registerWorker(ANY_SERVER, READ_COIL, worker);
+
+  measure("Former map walk", [&server](uint8_t s, uint8_t f) { return server.mapLookup(s, f); });
+  measure("Dispatch tables", [&server](uint8_t s, uint8_t f) { return server.tableLookup(s, f); });
+  return 0;
+}
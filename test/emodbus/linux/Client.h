@@ -0,0 +1,24 @@
+// =================================================================================================
+// Host test stubs: the Client interface as used by the Linux target of eModbus
+// =================================================================================================
+#ifndef _TEST_LINUX_CLIENT_H
+#define _TEST_LINUX_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "IPAddress.h"
+
+class Client {
+public:
+  virtual ~Client() {}
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int read(uint8_t *buffer, size_t size) = 0;
+  virtual void flush() = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+};
+
+#endif
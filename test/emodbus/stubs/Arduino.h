@@ -0,0 +1,57 @@
+// =================================================================================================
+// Host test stubs: the part of the Arduino API used by eModbus, implemented in stubs.cpp
+// =================================================================================================
+#ifndef _TEST_ARDUINO_H
+#define _TEST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include "IPAddress.h"
+#include "freertos/FreeRTOS.h"
+
+#define LOW 0
+#define HIGH 1
+#define OUTPUT 1
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+
+// Print: all output is written to stdout
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+  virtual size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+  size_t write(const char *str) { return write(reinterpret_cast<const uint8_t *>(str), strlen(str)); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t print(const char *str) { return write(str); }
+  size_t println(const char *str = "") { return write(str) + write("\n"); }
+  virtual void flush() { fflush(stdout); }
+};
+
+// Stream: nothing to be read
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+};
+
+class HardwareSerial : public Stream {
+public:
+  uint32_t baudRate() { return 9600; }
+  void setRxFIFOFull(uint8_t) {}
+  void setRxBufferSize(size_t) {}
+  void setTxBufferSize(size_t) {}
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,55 @@
+// =================================================================================================
+// Host test stubs: AsyncTCP client. Nothing is sent - add() and send() calls are only recorded.
+// =================================================================================================
+#ifndef _TEST_ASYNC_TCP_H
+#define _TEST_ASYNC_TCP_H
+
+#include <functional>
+#include <vector>
+#include "Arduino.h"
+
+#define ASYNC_WRITE_FLAG_COPY 0x01
+
+class AsyncClient;
+typedef std::function<void(void *, AsyncClient *)> AcConnectHandler;
+typedef std::function<void(void *, AsyncClient *, int8_t)> AcErrorHandler;
+typedef std::function<void(void *, AsyncClient *, void *, size_t)> AcDataHandler;
+
+class AsyncClient {
+public:
+  AsyncClient() : adds(0), sends(0), sentLast(false) { }
+
+  void onConnect(AcConnectHandler, void * = nullptr) { }
+  void onDisconnect(AcConnectHandler, void * = nullptr) { }
+  void onError(AcErrorHandler, void * = nullptr) { }
+  void onData(AcDataHandler, void * = nullptr) { }
+  void onPoll(AcConnectHandler, void * = nullptr) { }
+  void setNoDelay(bool) { }
+  bool connect(IPAddress, uint16_t) { return true; }
+  void close(bool = false) { }
+  size_t space() { return 5744; }     // lwIP default send buffer
+  const char *errorToString(int8_t) { return "stub"; }
+
+  size_t add(const char *data, size_t size, uint8_t = 0) {
+    adds++;
+    if (sentLast) segment.clear();
+    sentLast = false;
+    segment.insert(segment.end(), data, data + size);
+    return size;
+  }
+
+  bool send() {
+    sends++;
+    sentLast = true;
+    return true;
+  }
+
+  int adds;                       // Number of add() calls
+  int sends;                      // Number of send() calls
+  std::vector<uint8_t> segment;   // Bytes added for the last send()
+
+protected:
+  bool sentLast;                  // The next add() starts a new segment
+};
+
+#endif
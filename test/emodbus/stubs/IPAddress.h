@@ -0,0 +1,25 @@
+// =================================================================================================
+// Host test stubs: Arduino IPAddress
+// =================================================================================================
+#ifndef _TEST_IPADDRESS_H
+#define _TEST_IPADDRESS_H
+
+#include <stdint.h>
+
+class IPAddress {
+public:
+  IPAddress() : IP_address(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) :
+    IP_address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+  explicit IPAddress(uint32_t address) : IP_address(address) {}
+
+  operator uint32_t() const { return IP_address; }
+  uint8_t operator[](int index) const { return (IP_address >> (index * 8)) & 0xFF; }
+  bool operator==(const IPAddress& other) const { return IP_address == other.IP_address; }
+  bool operator!=(const IPAddress& other) const { return IP_address != other.IP_address; }
+
+protected:
+  uint32_t IP_address;
+};
+
+#endif
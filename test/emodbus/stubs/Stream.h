@@ -0,0 +1,4 @@
+// =================================================================================================
+// Host test stubs: Arduino Stream, see Arduino.h
+// =================================================================================================
+#include "Arduino.h"
@@ -0,0 +1,23 @@
+// =================================================================================================
+// Host test stubs: the FreeRTOS types and macros used by eModbus
+// =================================================================================================
+#ifndef _TEST_FREERTOS_H
+#define _TEST_FREERTOS_H
+
+#include <stdint.h>
+
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(x) (x)
+
+#endif
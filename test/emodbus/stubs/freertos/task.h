@@ -0,0 +1,25 @@
+// =================================================================================================
+// Host test stubs: FreeRTOS task functions, implemented in stubs.cpp.
+// Task notifications work between threads. Tasks are not started - tests drive the code directly.
+// =================================================================================================
+#ifndef _TEST_FREERTOS_TASK_H
+#define _TEST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackSize, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t coreID);
+void vTaskDelete(TaskHandle_t task);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
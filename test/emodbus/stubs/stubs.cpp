@@ -0,0 +1,89 @@
+// =================================================================================================
+// Host test stubs: implementation of the Arduino and FreeRTOS functions used by eModbus
+// =================================================================================================
+#include <stdarg.h>
+#include <chrono>               // NOLINT
+#include <thread>               // NOLINT
+#include <mutex>                // NOLINT
+#include <condition_variable>   // NOLINT
+#include "Arduino.h"
+#include "freertos/task.h"
+
+HardwareSerial Serial;
+
+typedef std::chrono::steady_clock clk;
+
+unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(clk::now().time_since_epoch()).count();
+}
+
+unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(clk::now().time_since_epoch()).count();
+}
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(int, int) { }
+void digitalWrite(int, int) { }
+
+size_t Print::printf(const char *format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (len < 0) return 0;
+  return write(reinterpret_cast<const uint8_t *>(buffer), len < static_cast<int>(sizeof(buffer)) ? len : sizeof(buffer) - 1);
+}
+
+// Task notifications: every thread has its own counter to wait on
+struct Notification {
+  std::mutex lock;
+  std::condition_variable cond;
+  uint32_t count = 0;
+};
+
+static thread_local Notification myNotification;
+
+extern "C" {
+
+// No tasks are started by the tests
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *handle, BaseType_t) {
+  if (handle) *handle = nullptr;
+  return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t) { }
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  return &myNotification;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(myNotification.lock);
+  auto notified = [] { return myNotification.count > 0; };
+  if (ticks == portMAX_DELAY) {
+    myNotification.cond.wait(lock, notified);
+  } else {
+    myNotification.cond.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), notified);
+  }
+  uint32_t count = myNotification.count;
+  if (count) myNotification.count = clearOnExit ? 0 : count - 1;
+  return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  Notification *n = static_cast<Notification *>(task);
+  std::lock_guard<std::mutex> lock(n->lock);
+  n->count++;
+  n->cond.notify_one();
+  return pdPASS;
+}
+
+}
@@ -0,0 +1,83 @@
+// =================================================================================================
+// modbus_tcp host tests: binary sensor bit masks on register values
+// =================================================================================================
+#include <vector>
+#include "modbus_tcp_binary_sensor.h"
+#include "TestUtils.h"
+
+using namespace esphome::modbus_tcp;
+
+// state: feed the sensor a FC03 response with the given register words, the way the hub does,
+// and return the state it published
+static bool state(ModbusTCPBinarySensor& sensor, std::vector<uint16_t> words) {
+  ReadRange range;
+  range.type = sensor.get_register_type();
+  range.start = sensor.get_address();
+  range.count = words.size();
+  ModbusMessage response;
+  response.add((uint8_t)1, range.function_code(), (uint8_t)(words.size() * 2));
+  for (uint16_t w : words) response.add(w);
+  uint32_t raw = 0;
+  CHECK(ReadPlanner::decode_raw(response, range, sensor, raw));
+  int published = sensor.published_;
+  sensor.on_raw(raw);
+  CHECK(sensor.published_ == published + 1);
+  return sensor.state_;
+}
+
+static ModbusTCPBinarySensor makeSensor(ValueType type, uint32_t bitmask) {
+  ModbusTCPBinarySensor sensor;
+  sensor.set_register_type(RegisterType::HOLDING);
+  sensor.set_address(10);
+  sensor.set_value_type(type);
+  sensor.set_bitmask(bitmask);
+  return sensor;
+}
+
+int main() {
+  // 16-bit registers
+  ModbusTCPBinarySensor word = makeSensor(ValueType::U_WORD, 0x0004);
+  CHECK(state(word, { 0x0004 }));
+  CHECK(!state(word, { 0xFFFB }));
+
+  // Negative values: the mask applies to the register bits
+  ModbusTCPBinarySensor sign = makeSensor(ValueType::S_WORD, 0x8000);
+  CHECK(state(sign, { 0xFFFF }));
+  CHECK(!state(sign, { 0x7FFF }));
+  ModbusTCPBinarySensor sdword = makeSensor(ValueType::S_DWORD, 0x00000001);
+  CHECK(!state(sdword, { 0xFFFF, 0xFFFE }));
+  CHECK(state(sdword, { 0xFFFF, 0xFFFF }));
+
+  // Low bits of values above 2^24, which a float can not hold
+  ModbusTCPBinarySensor dword = makeSensor(ValueType::U_DWORD, 0x00000001);
+  CHECK(state(dword, { 0x0100, 0x0001 }));
+  CHECK(!state(dword, { 0x0100, 0x0000 }));
+  ModbusTCPBinarySensor high = makeSensor(ValueType::U_DWORD, 0x80000000);
+  CHECK(state(high, { 0x8000, 0x0000 }));
+
+  // Low word first
+  ModbusTCPBinarySensor swapped = makeSensor(ValueType::U_DWORD_R, 0x00010000);
+  CHECK(state(swapped, { 0x0000, 0x0001 }));
+  CHECK(!state(swapped, { 0x0001, 0x0000 }));
+
+  // Default mask: any bit set
+  ModbusTCPBinarySensor any = makeSensor(ValueType::U_DWORD, 0xFFFFFFFF);
+  CHECK(state(any, { 0x0000, 0x0001 }));
+  CHECK(!state(any, { 0x0000, 0x0000 }));
+
+  // Coils ignore the mask
+  ModbusTCPBinarySensor coil = makeSensor(ValueType::U_WORD, 0x0002);
+  coil.set_register_type(RegisterType::COIL);
+  ReadRange range;
+  range.type = RegisterType::COIL;
+  range.start = 8;
+  range.count = 8;
+  ModbusMessage response;
+  response.add((uint8_t)1, (uint8_t)READ_COIL, (uint8_t)1, (uint8_t)0x04);   // coil 10 set
+  uint32_t raw = 0;
+  CHECK(ReadPlanner::decode_raw(response, range, coil, raw) && raw == 1);
+  coil.on_raw(raw);
+  CHECK(coil.state_);
+
+  return testResult("BinarySensorTest");
+}
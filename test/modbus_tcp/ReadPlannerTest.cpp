@@ -0,0 +1,284 @@
+// =================================================================================================
+// modbus_tcp host tests: ReadPlanner merging items into requests, decoding and encoding values
+// =================================================================================================
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+#include "read_planner.h"
+#include "TestUtils.h"
+
+using namespace esphome::modbus_tcp;
+
+// Item: polled value remembering what it was handed
+class Item : public RegisterItem {
+public:
+  Item(RegisterType type, uint16_t address, ValueType value_type = ValueType::U_WORD) {
+    set_register_type(type);
+    set_address(address);
+    set_value_type(value_type);
+  }
+  void on_value(float value) override { value_ = value; }
+  float value_ = NAN;
+};
+
+// Items: owns the items and hands them to the planner
+struct Items {
+  std::vector<Item> items;
+  void add(RegisterType type, uint16_t address, ValueType value_type = ValueType::U_WORD) {
+    items.emplace_back(type, address, value_type);
+  }
+  std::vector<ReadRange> plan(const ReadPlanner& planner) {
+    std::vector<RegisterItem *> pointers;
+    for (Item& item : items) pointers.push_back(&item);
+    return planner.plan(pointers);
+  }
+};
+
+// covers: every item is inside exactly one range of its table, and no range is longer than allowed
+static bool covers(const Items& items, const std::vector<ReadRange>& ranges, uint16_t max_registers) {
+  std::vector<int> seen(items.items.size(), 0);
+  for (const ReadRange& range : ranges) {
+    if (range.count > (is_bit_type(range.type) ? 2000 : max_registers)) return false;
+    for (uint16_t index : range.items) {
+      const Item& item = items.items[index];
+      if (item.get_register_type() != range.type) return false;
+      if (item.get_address() < range.start || item.get_end() > static_cast<uint32_t>(range.start) + range.count) return false;
+      seen[index]++;
+    }
+  }
+  for (int s : seen) {
+    if (s != 1) return false;
+  }
+  return true;
+}
+
+// response: a read response to range, data words or bytes as given
+static ModbusMessage response(const ReadRange& range, const std::vector<uint16_t>& words) {
+  ModbusMessage msg;
+  msg.add((uint8_t)1, range.function_code(), (uint8_t)(words.size() * 2));
+  for (uint16_t w : words) msg.add(w);
+  return msg;
+}
+
+// Registers are merged up to max_registers_, coils and discrete inputs up to 2000 bits
+static void testMerging() {
+  ReadPlanner planner;
+  CHECK(planner.get_max_registers() == 125);
+  Items full;
+  for (uint16_t a = 0; a < 125; ++a) full.add(RegisterType::HOLDING, a);
+  std::vector<ReadRange> ranges = full.plan(planner);
+  CHECK(ranges.size() == 1 && ranges[0].start == 0 && ranges[0].count == 125 && ranges[0].items.size() == 125);
+  CHECK(ranges[0].function_code() == READ_HOLD_REGISTER && ranges[0].byte_count() == 250);
+  // One more does not fit
+  full.add(RegisterType::HOLDING, 125);
+  ranges = full.plan(planner);
+  CHECK(ranges.size() == 2 && ranges[1].start == 125 && ranges[1].count == 1);
+  CHECK(covers(full, ranges, 125));
+
+  // Smaller limit, clamped to what a request can carry
+  planner.set_max_registers(10);
+  ranges = full.plan(planner);
+  CHECK(ranges.size() == 13 && ranges[0].count == 10 && ranges[12].count == 6);
+  CHECK(covers(full, ranges, 10));
+  planner.set_max_registers(1);
+  CHECK(planner.get_max_registers() == 2);
+  planner.set_max_registers(500);
+  CHECK(planner.get_max_registers() == 125);
+
+  // Bits
+  Items coils;
+  for (uint16_t a = 0; a < 2000; ++a) coils.add(RegisterType::COIL, 1000 + a);
+  ranges = coils.plan(planner);
+  CHECK(ranges.size() == 1 && ranges[0].count == 2000 && ranges[0].byte_count() == 250);
+  CHECK(ranges[0].function_code() == READ_COIL);
+  coils.add(RegisterType::COIL, 3000);
+  ranges = coils.plan(planner);
+  CHECK(ranges.size() == 2 && ranges[1].start == 3000 && ranges[1].count == 1);
+  CHECK(covers(coils, ranges, 125));
+
+  // Tables are never mixed, the items may come in any order
+  Items mixed;
+  mixed.add(RegisterType::INPUT, 2);
+  mixed.add(RegisterType::DISCRETE_INPUT, 1);
+  mixed.add(RegisterType::INPUT, 1);
+  mixed.add(RegisterType::HOLDING, 1);
+  mixed.add(RegisterType::DISCRETE_INPUT, 0);
+  ranges = mixed.plan(planner);
+  CHECK(ranges.size() == 3);
+  CHECK(ranges[0].type == RegisterType::DISCRETE_INPUT && ranges[0].start == 0 && ranges[0].count == 2);
+  CHECK(ranges[0].function_code() == READ_DISCR_INPUT && ranges[0].byte_count() == 1);
+  CHECK(ranges[1].type == RegisterType::HOLDING && ranges[1].count == 1);
+  CHECK(ranges[2].type == RegisterType::INPUT && ranges[2].start == 1 && ranges[2].count == 2);
+  CHECK(ranges[2].function_code() == READ_INPUT_REGISTER);
+  CHECK(covers(mixed, ranges, 125));
+
+  // Gaps
+  Items gap;
+  gap.add(RegisterType::HOLDING, 0);
+  gap.add(RegisterType::HOLDING, 5);
+  CHECK(gap.plan(planner).size() == 2);
+  planner.set_max_gap(3);
+  CHECK(gap.plan(planner).size() == 2);
+  planner.set_max_gap(4);
+  ranges = gap.plan(planner);
+  CHECK(ranges.size() == 1 && ranges[0].count == 6);
+}
+
+// 32-bit values are never cut at the end of a request
+static void testRangeEdge() {
+  ReadPlanner planner;
+  planner.set_max_gap(200);
+  Items fits;
+  fits.add(RegisterType::HOLDING, 0);
+  fits.add(RegisterType::HOLDING, 123, ValueType::U_DWORD);
+  std::vector<ReadRange> ranges = fits.plan(planner);
+  CHECK(ranges.size() == 1 && ranges[0].count == 125);
+
+  Items split;
+  split.add(RegisterType::HOLDING, 0);
+  split.add(RegisterType::HOLDING, 124, ValueType::FP32);
+  ranges = split.plan(planner);
+  CHECK(ranges.size() == 2 && ranges[0].count == 1 && ranges[1].start == 124 && ranges[1].count == 2);
+  CHECK(covers(split, ranges, 125));
+
+  // Overlapping items share their registers
+  Items overlap;
+  overlap.add(RegisterType::HOLDING, 10, ValueType::U_DWORD);
+  overlap.add(RegisterType::HOLDING, 11);
+  overlap.add(RegisterType::HOLDING, 10);
+  ranges = overlap.plan(planner);
+  CHECK(ranges.size() == 1 && ranges[0].start == 10 && ranges[0].count == 2 && ranges[0].items.size() == 3);
+
+  // The smallest limit still takes the widest value
+  planner.set_max_registers(0);
+  ranges = split.plan(planner);
+  CHECK(ranges.size() == 2 && covers(split, ranges, 2));
+
+  // Random layouts
+  srand(1);
+  long bad = 0;
+  for (int round = 0; round < 500; ++round) {
+    planner.set_max_registers(2 + rand() % 124);
+    planner.set_max_gap(rand() % 8);
+    Items items;
+    for (int i = 0; i < 60; ++i) {
+      RegisterType type = static_cast<RegisterType>(rand() % 4);
+      items.add(type, rand() % 400, static_cast<ValueType>(rand() % 8));
+    }
+    if (!covers(items, items.plan(planner), planner.get_max_registers())) bad++;
+  }
+  CHECK(bad == 0);
+}
+
+// Items at the top of the address space end at 0x10000
+static void testTopOfTable() {
+  ReadPlanner planner;
+  planner.set_max_gap(200);
+  Items top;
+  top.add(RegisterType::HOLDING, 0xFF90);
+  top.add(RegisterType::HOLDING, 0xFFFE, ValueType::U_DWORD);
+  CHECK(top.items[1].get_end() == 0x10000);
+  std::vector<ReadRange> ranges = top.plan(planner);
+  CHECK(ranges.size() == 1 && ranges[0].start == 0xFF90 && ranges[0].count == 0x70);
+  CHECK(covers(top, ranges, 125));
+  std::vector<uint16_t> words(0x70, 0);
+  words[0x6E] = 0x1234;
+  words[0x6F] = 0x5678;
+  ModbusMessage msg = response(ranges[0], words);
+  float value = 0;
+  CHECK(ReadPlanner::decode(msg, ranges[0], top.items[1], value) && value == 0x12345678);
+
+  // Last register - twice, the range end must not wrap to 0 - and last coil
+  Items last;
+  last.add(RegisterType::INPUT, 0xFFFF);
+  last.add(RegisterType::COIL, 0xFFFF);
+  last.add(RegisterType::COIL, 0xFFF0);
+  last.add(RegisterType::INPUT, 0xFFFF);
+  ranges = last.plan(planner);
+  CHECK(ranges.size() == 2);
+  CHECK(ranges[0].type == RegisterType::COIL && ranges[0].start == 0xFFF0 && ranges[0].count == 16);
+  CHECK(ranges[1].start == 0xFFFF && ranges[1].count == 1 && ranges[1].items.size() == 2);
+  ModbusMessage bits;
+  bits.add((uint8_t)1, (uint8_t)READ_COIL, (uint8_t)2, (uint8_t)0x00, (uint8_t)0x80);
+  uint32_t raw = 0;
+  CHECK(ReadPlanner::decode_raw(bits, ranges[0], last.items[1], raw) && raw == 1);
+  CHECK(ReadPlanner::decode_raw(bits, ranges[0], last.items[2], raw) && raw == 0);
+}
+
+// Every value type survives encode and decode, with its words in the right order
+static void testValueTypes() {
+  struct Case {
+    ValueType type;
+    float value;
+    std::vector<uint16_t> words;
+  };
+  const Case cases[] = {
+    { ValueType::U_WORD, 65535, { 0xFFFF } },
+    { ValueType::S_WORD, -32768, { 0x8000 } },
+    { ValueType::S_WORD, -2, { 0xFFFE } },
+    { ValueType::U_DWORD, 16777216, { 0x0100, 0x0000 } },
+    { ValueType::U_DWORD, 65538, { 0x0001, 0x0002 } },
+    { ValueType::U_DWORD_R, 65538, { 0x0002, 0x0001 } },
+    { ValueType::S_DWORD, -2, { 0xFFFF, 0xFFFE } },
+    { ValueType::S_DWORD_R, -2, { 0xFFFE, 0xFFFF } },
+    { ValueType::S_DWORD, -2000000, { 0xFFE1, 0x7B80 } },
+    { ValueType::FP32, 1.0f, { 0x3F80, 0x0000 } },
+    { ValueType::FP32_R, 1.0f, { 0x0000, 0x3F80 } },
+    { ValueType::FP32, -0.15625f, { 0xBE20, 0x0000 } },
+  };
+  for (const Case& c : cases) {
+    uint16_t words[2] = { 0xAAAA, 0xAAAA };
+    uint8_t n = ReadPlanner::encode(c.type, c.value, words);
+    CHECK(n == register_count(c.type) && n == c.words.size());
+    CHECK(words[0] == c.words[0] && (n == 1 || words[1] == c.words[1]));
+
+    // Item behind some other register in the range
+    Item item(RegisterType::HOLDING, 101, c.type);
+    ReadRange range;
+    range.type = RegisterType::HOLDING;
+    range.start = 100;
+    range.count = 1 + n;
+    std::vector<uint16_t> data = { 0x5555 };
+    data.insert(data.end(), c.words.begin(), c.words.end());
+    ModbusMessage msg = response(range, data);
+    float value = 0;
+    CHECK(ReadPlanner::decode(msg, range, item, value) && value == c.value);
+    uint32_t raw = 0;
+    CHECK(ReadPlanner::decode_raw(msg, range, item, raw));
+    item.on_raw(raw);
+    CHECK(item.value_ == c.value);
+  }
+}
+
+// Responses too short for the item are not decoded
+static void testShortResponse() {
+  ReadRange range;
+  range.type = RegisterType::HOLDING;
+  range.start = 0;
+  range.count = 3;
+  Item dword(RegisterType::HOLDING, 1, ValueType::U_DWORD);
+  ModbusMessage msg = response(range, { 1, 2 });
+  float value = 0;
+  CHECK(!ReadPlanner::decode(msg, range, dword, value));
+  msg = response(range, { 1, 2, 3 });
+  CHECK(ReadPlanner::decode(msg, range, dword, value) && value == 0x00020003);
+
+  range.type = RegisterType::DISCRETE_INPUT;
+  range.count = 16;
+  Item bit(RegisterType::DISCRETE_INPUT, 9);
+  ModbusMessage bits;
+  bits.add((uint8_t)1, (uint8_t)READ_DISCR_INPUT, (uint8_t)1, (uint8_t)0xFF);
+  CHECK(!ReadPlanner::decode(bits, range, bit, value));
+  bits.add((uint8_t)0x02);
+  CHECK(ReadPlanner::decode(bits, range, bit, value) && value == 1);
+}
+
+int main() {
+  testMerging();
+  testRangeEdge();
+  testTopOfTable();
+  testValueTypes();
+  testShortResponse();
+
+  return testResult("ReadPlannerTest");
+}
@@ -0,0 +1,145 @@
+// =================================================================================================
+// modbus_tcp host tests: ScanScheduler grouping by update interval, deadlines across millis() wrap
+// =================================================================================================
+#include <algorithm>
+#include <vector>
+#include "scan_scheduler.h"
+#include "esphome/core/log.h"
+#include "TestUtils.h"
+
+using namespace esphome::modbus_tcp;
+
+// Item: polled value with an update interval
+class Item : public RegisterItem {
+public:
+  explicit Item(uint32_t interval) { set_update_interval(interval); }
+  void on_value(float value) override { }
+};
+
+static std::vector<RegisterItem *> pointers(std::vector<Item>& items) {
+  std::vector<RegisterItem *> result;
+  for (Item& item : items) result.push_back(&item);
+  return result;
+}
+
+// group: index of the group with interval, -1 if there is none
+static int group(const ScanScheduler& scheduler, uint32_t interval) {
+  for (uint8_t g = 0; g < scheduler.get_group_count(); ++g) {
+    if (scheduler.get_group_interval(g) == interval) return g;
+  }
+  return -1;
+}
+
+// Items are grouped by interval, 0 meaning the default one
+static void testGroups() {
+  std::vector<Item> items = { Item(0), Item(1000), Item(500), Item(500) };
+  ScanScheduler scheduler;
+  scheduler.build(pointers(items), 1000, 5000);
+  CHECK(scheduler.get_group_count() == 2);
+  int slow = group(scheduler, 1000);
+  int fast = group(scheduler, 500);
+  CHECK(slow >= 0 && fast >= 0);
+  CHECK(scheduler.items(1UL << slow).size() == 2 && scheduler.items(1UL << fast).size() == 2);
+  CHECK(scheduler.items(0).empty());
+
+  // All due right away, then each at its own pace
+  CHECK(scheduler.due(5000) == ((1UL << slow) | (1UL << fast)));
+  CHECK(scheduler.due(5000) == 0);
+  CHECK(scheduler.due(5499) == 0);
+  CHECK(scheduler.due(5500) == (1UL << fast));
+  CHECK(scheduler.due(6000) == ((1UL << slow) | (1UL << fast)));
+
+  // Missed runs are not caught up on: one run, the next a full interval later
+  CHECK(scheduler.due(9700) == ((1UL << slow) | (1UL << fast)));
+  CHECK(scheduler.due(9800) == 0);
+  CHECK(scheduler.due(10199) == 0);
+  CHECK(scheduler.due(10200) == (1UL << fast));
+  CHECK(scheduler.due(10700) == ((1UL << slow) | (1UL << fast)));
+
+  // A rebuild starts over
+  scheduler.build(pointers(items), 2000, 20000);
+  CHECK(scheduler.get_group_count() == 3);
+  CHECK(scheduler.due(20000) == 0x7);
+}
+
+// Deadlines on both sides of the millis() wrap-around keep their order and pace
+static void testWrapAround() {
+  const uint32_t intervals[] = { 70, 300, 1000, 2500 };
+  std::vector<Item> items;
+  for (uint32_t i : intervals) items.emplace_back(i);
+  for (uint32_t start : { 0xFFFFF000UL, 0x7FFFF000UL, 0xFFFFFFFFUL }) {
+    ScanScheduler scheduler;
+    scheduler.build(pointers(items), 1000, start);
+    std::vector<uint32_t> last(4, 0);
+    std::vector<int> runs(4, 0);
+    long early = 0;
+    // 10 s in steps of 10 ms, through the wrap
+    for (uint32_t t = 0; t <= 10000; t += 10) {
+      uint32_t mask = scheduler.due(start + t);
+      for (uint8_t g = 0; g < 4; ++g) {
+        if (!(mask & (1UL << g))) continue;
+        if (runs[g] && t - last[g] != scheduler.get_group_interval(g)) early++;
+        last[g] = t;
+        runs[g]++;
+      }
+    }
+    CHECK(early == 0);
+    for (uint8_t g = 0; g < 4; ++g) {
+      // Steps of 10 ms: a 70 ms interval is kept exactly, 10000 / 70 runs after the first
+      CHECK(runs[g] == static_cast<int>(10000 / scheduler.get_group_interval(g)) + 1);
+    }
+  }
+
+  // A deadline just behind the wrap is not mistaken for one long past
+  std::vector<Item> one = { Item(100) };
+  ScanScheduler scheduler;
+  scheduler.build(pointers(one), 1000, 0xFFFFFFC0);
+  CHECK(scheduler.due(0xFFFFFFC0) == 1);
+  CHECK(scheduler.due(0xFFFFFFFF) == 0);
+  CHECK(scheduler.due(0x00000010) == 0);
+  CHECK(scheduler.due(0x00000023) == 0);
+  CHECK(scheduler.due(0x00000024) == 1);
+
+  // A run a little late just before the wrap keeps the cadence: the next deadline is behind the wrap
+  scheduler.build(pointers(one), 1000, 0xFFFFFFA0);
+  CHECK(scheduler.due(0xFFFFFFB0) == 1);
+  CHECK(scheduler.due(0x00000003) == 0);
+  CHECK(scheduler.due(0x00000004) == 1);
+}
+
+// More distinct intervals than groups: the surplus items go to the fastest group
+static void testTooManyIntervals() {
+  std::vector<Item> items;
+  for (uint32_t i = 40; i >= 1; --i) items.emplace_back(i * 100);
+  items.emplace_back(3000);
+  ScanScheduler scheduler;
+  int warnings = esphome::log_warnings;
+  scheduler.build(pointers(items), 1000, 0);
+  CHECK(scheduler.get_group_count() == ScanScheduler::MAX_GROUPS);
+  // 800 ms and faster did not get a group of their own
+  CHECK(esphome::log_warnings - warnings == 8);
+  CHECK(group(scheduler, 900) == 31 && group(scheduler, 800) == -1);
+
+  // No item is lost, the ones left over are polled with the fastest group
+  std::vector<RegisterItem *> all = scheduler.items(0xFFFFFFFF);
+  CHECK(all.size() == items.size());
+  for (Item& item : items) {
+    CHECK(std::count(all.begin(), all.end(), &item) == 1);
+  }
+  int fastest = group(scheduler, 900);
+  CHECK(scheduler.items(1UL << fastest).size() == 9);
+  CHECK(scheduler.items(1UL << group(scheduler, 3000)).size() == 2);
+
+  // The highest group bit is reported too
+  CHECK(scheduler.due(0) == 0xFFFFFFFF);
+  CHECK(scheduler.due(899) == 0);
+  CHECK(scheduler.due(900) == (1UL << 31));
+}
+
+int main() {
+  testGroups();
+  testWrapAround();
+  testTooManyIntervals();
+
+  return testResult("ScanSchedulerTest");
+}
@@ -0,0 +1,21 @@
+// =================================================================================================
+// Host test stubs: ESPHome binary sensor, remembering the state published last
+// =================================================================================================
+#pragma once
+
+namespace esphome {
+namespace binary_sensor {
+
+class BinarySensor {
+ public:
+  void publish_state(bool state) {
+    state_ = state;
+    published_++;
+  }
+
+  bool state_{false};
+  int published_{0};
+};
+
+}  // namespace binary_sensor
+}  // namespace esphome
@@ -0,0 +1,16 @@
+// =================================================================================================
+// Host test stubs: ESPHome logging. Messages are dropped, warnings are counted
+// =================================================================================================
+#pragma once
+
+namespace esphome {
+
+inline int log_warnings = 0;
+
+}  // namespace esphome
+
+#define ESP_LOGE(tag, ...) (void)tag
+#define ESP_LOGW(tag, ...) ((void)tag, esphome::log_warnings++)
+#define ESP_LOGI(tag, ...) (void)tag
+#define ESP_LOGD(tag, ...) (void)tag
+#define ESP_LOGV(tag, ...) (void)tag